@@ -0,0 +1,182 @@
+/* HexChat
+ * Copyright (C) 1998-2010 Peter Zelezny.
+ * Copyright (C) 2009-2013 Berke Viktor.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#include <string.h>
+#include <time.h>
+
+#include "bench.h"
+
+#define BENCH_MAX_DEPTH 64
+
+gboolean bench_enabled = FALSE;
+struct bench_stat bench_stats[BENCH_NUM_STAGES];
+guint64 bench_other_allocs;
+
+static bench_stage stage_stack[BENCH_MAX_DEPTH];
+static int stage_depth;
+static gint64 stage_mark;		/* when the innermost stage was last resumed */
+
+static const char * const stage_names[BENCH_NUM_STAGES] =
+{
+	"parse",
+	"plugins",
+	"text_emit",
+	"logging",
+	"scrollback",
+	"frontend",
+};
+
+/* monotonic time in nanoseconds */
+
+gint64
+bench_now (void)
+{
+#ifdef CLOCK_MONOTONIC
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (gint64) ts.tv_sec * G_GINT64_CONSTANT (1000000000) + ts.tv_nsec;
+#else
+	return g_get_monotonic_time () * 1000;
+#endif
+}
+
+void
+bench_push (bench_stage stage)
+{
+	gint64 now = bench_now ();
+
+	/* the stage we're interrupting stops its clock */
+	if (stage_depth > 0 && stage_depth <= BENCH_MAX_DEPTH)
+		bench_stats[stage_stack[stage_depth - 1]].ns += now - stage_mark;
+
+	if (stage_depth < BENCH_MAX_DEPTH)
+		stage_stack[stage_depth] = stage;
+	stage_depth++;
+
+	bench_stats[stage].calls++;
+	stage_mark = now;
+}
+
+void
+bench_pop (void)
+{
+	gint64 now = bench_now ();
+
+	if (stage_depth == 0)
+		return;
+
+	stage_depth--;
+	if (stage_depth < BENCH_MAX_DEPTH)
+		bench_stats[stage_stack[stage_depth]].ns += now - stage_mark;
+
+	stage_mark = now;
+}
+
+/* charge one allocation to the innermost stage */
+
+void
+bench_count_alloc (void)
+{
+	if (stage_depth > 0 && stage_depth <= BENCH_MAX_DEPTH)
+		bench_stats[stage_stack[stage_depth - 1]].allocs++;
+	else
+		bench_other_allocs++;
+}
+
+void
+bench_reset (void)
+{
+	memset (bench_stats, 0, sizeof (bench_stats));
+	bench_other_allocs = 0;
+	stage_depth = 0;
+}
+
+const char *
+bench_stage_name (bench_stage stage)
+{
+	return stage_names[stage];
+}
+
+/* === latency === */
+
+#define LATENCY_BUCKETS 32		/* bucket n: under 2^n microseconds */
+#define LATENCY_MARK "bench-sent="
+
+gboolean bench_latency = FALSE;
+
+static guint64 latency_hist[LATENCY_BUCKETS];
+static guint64 latency_count;
+static gint64 latency_sum;
+static gint64 latency_max;
+
+void
+bench_latency_init (void)
+{
+	bench_latency = g_getenv ("HEXCHAT_BENCH_LATENCY") != NULL;
+}
+
+void
+bench_latency_note (const char *text)
+{
+	const char *mark;
+	gint64 sent, us;
+	guint bucket;
+
+	mark = strstr (text, LATENCY_MARK);
+	if (!mark)
+		return;
+
+	sent = g_ascii_strtoll (mark + sizeof (LATENCY_MARK) - 1, NULL, 10);
+	us = g_get_monotonic_time () - sent;
+	if (sent <= 0 || us < 0)
+		return;
+
+	bucket = MIN (g_bit_storage ((gulong) us), LATENCY_BUCKETS - 1);
+	latency_hist[bucket]++;
+	latency_count++;
+	latency_sum += us;
+	latency_max = MAX (latency_max, us);
+}
+
+void
+bench_latency_report (void)
+{
+	guint64 seen = 0;
+	int i;
+
+	if (!latency_count)
+		return;
+
+	g_printerr ("\nServer send to fe_print_text, %" G_GUINT64_FORMAT " messages, "
+					"average %" G_GINT64_FORMAT " us, max %" G_GINT64_FORMAT " us\n",
+					latency_count, latency_sum / (gint64) latency_count, latency_max);
+
+	for (i = 0; i < LATENCY_BUCKETS; i++)
+	{
+		if (!latency_hist[i])
+			continue;
+
+		seen += latency_hist[i];
+		g_printerr ("  < %10lu us %12" G_GUINT64_FORMAT " %6.2f%% %7.2f%%\n",
+						1UL << i, latency_hist[i],
+						100.0 * latency_hist[i] / latency_count,
+						100.0 * seen / latency_count);
+	}
+}
@@ -0,0 +1,75 @@
+/* HexChat
+ * Copyright (C) 1998-2010 Peter Zelezny.
+ * Copyright (C) 2009-2013 Berke Viktor.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/* Time spent in each stage of the inbound path, for the replay benchmark
+   (hexchat-bench). Stages nest, e.g. a plugin hook runs inside text_emit
+   which runs inside the parser; the time of a nested stage is not counted
+   again in the stage around it. Off unless bench_enabled is set, then a
+   stage costs two clock reads. */
+
+#ifndef HEXCHAT_BENCH_H
+#define HEXCHAT_BENCH_H
+
+#include <glib.h>
+
+typedef enum
+{
+	BENCH_PARSE,			/* server_inline and the protocol handlers */
+	BENCH_PLUGIN,			/* running plugin hooks */
+	BENCH_EMIT,				/* text_emit: alerts and rendering the event */
+	BENCH_LOG,				/* log_write */
+	BENCH_SCROLLBACK,		/* scrollback_save */
+	BENCH_FRONTEND,		/* fe_print_text */
+	BENCH_NUM_STAGES
+} bench_stage;
+
+struct bench_stat
+{
+	gint64 ns;				/* time spent in this stage alone */
+	guint64 calls;
+	guint64 allocs;		/* only when something calls bench_count_alloc */
+};
+
+extern gboolean bench_enabled;
+extern struct bench_stat bench_stats[BENCH_NUM_STAGES];
+extern guint64 bench_other_allocs;	/* made outside of any stage */
+
+gint64 bench_now (void);
+void bench_push (bench_stage stage);
+void bench_pop (void);
+void bench_count_alloc (void);
+void bench_reset (void);
+const char *bench_stage_name (bench_stage stage);
+
+/* Latency from a server sending a message to fe_print_text showing it,
+   for messages from hexchat-fake-ircd, which carry their send time as
+   "bench-sent=<g_get_monotonic_time>". Turned on by setting
+   HEXCHAT_BENCH_LATENCY in the environment, the histogram is printed to
+   stderr on exit. */
+
+extern gboolean bench_latency;
+
+void bench_latency_init (void);
+void bench_latency_note (const char *text);
+void bench_latency_report (void);
+
+#define BENCH_PUSH(stage) G_STMT_START { if (bench_enabled) bench_push (stage); } G_STMT_END
+#define BENCH_POP() G_STMT_START { if (bench_enabled) bench_pop (); } G_STMT_END
+
+#endif
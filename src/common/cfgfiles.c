@@ -474,6 +474,7 @@ const struct prefs vars[] =
 	{"irc_invisible", P_OFFINT (hex_irc_invisible), TYPE_BOOL},
 	{"irc_join_delay", P_OFFINT (hex_irc_join_delay), TYPE_INT},
 	{"irc_logging", P_OFFINT (hex_irc_logging), TYPE_BOOL},
+	{"irc_logging_thread", P_OFFINT (hex_irc_logging_thread), TYPE_BOOL},
 	{"irc_logmask", P_OFFSET (hex_irc_logmask), TYPE_STR},
 	{"irc_nick1", P_OFFSET (hex_irc_nick1), TYPE_STR},
 	{"irc_nick2", P_OFFSET (hex_irc_nick2), TYPE_STR},
@@ -46,7 +46,9 @@
 #include "servlist.h"
 #include "outbound.h"
 #include "text.h"
+#include "logthread.h"
 #include "url.h"
+#include "bench.h"
 #include "hexchatc.h"
 
 #if ! GLIB_CHECK_VERSION (2, 36, 0)
@@ -182,41 +184,119 @@ is_session (session * sess)
 	return g_slist_find (sess_list, sess) ? 1 : 0;
 }
 
-session *
-find_dialog (server *serv, char *nick)
+/* Each server keeps its channel and dialog sessions in a hash table keyed
+   by name, so find_channel/find_dialog don't have to walk sess_list for
+   every incoming line. Whoever changes sess->channel of a channel or dialog
+   must call sess_index_update, and a change of serv->p_cmp needs a
+   sess_index_rebuild. */
+
+static GHashTable **
+sess_index_table (session *sess)
 {
-	GSList *list = sess_list;
-	session *sess;
+	switch (sess->type)
+	{
+	case SESS_CHANNEL:
+		return &sess->server->chan_index;
+	case SESS_DIALOG:
+		return &sess->server->dialog_index;
+	}
+	return NULL;
+}
 
-	while (list)
+static void
+sess_index_add (session *sess)
+{
+	GHashTable **table = sess_index_table (sess);
+
+	if (!table || !sess->channel[0])
+		return;
+
+	if (!*table)
+		*table = server_casemap_table_new (sess->server, NULL, NULL);
+
+	/* two tabs with the same name, the first one wins */
+	if (g_hash_table_lookup (*table, sess->channel))
+		return;
+
+	sess->index_key = g_strdup (sess->channel);
+	g_hash_table_insert (*table, sess->index_key, sess);
+}
+
+static void
+sess_index_remove (session *sess)
+{
+	GHashTable **table = sess_index_table (sess);
+	GSList *list;
+	session *other;
+	char *key = sess->index_key;
+
+	if (!key)
+		return;
+
+	g_hash_table_remove (*table, key);
+	sess->index_key = NULL;
+
+	/* let another tab of the same name take over, if there is one */
+	for (list = sess_list; list; list = list->next)
 	{
-		sess = list->data;
-		if (sess->server == serv && sess->type == SESS_DIALOG)
+		other = list->data;
+		if (other != sess && other->server == sess->server &&
+			 other->type == sess->type && !other->index_key &&
+			 !sess->server->p_cmp (key, other->channel))
 		{
-			if (!serv->p_cmp (nick, sess->channel))
-				return (sess);
+			sess_index_add (other);
+			break;
 		}
-		list = list->next;
 	}
-	return NULL;
+
+	g_free (key);
 }
 
-session *
-find_channel (server *serv, char *chan)
+/* call after sess->channel changed */
+
+void
+sess_index_update (session *sess)
 {
+	sess_index_remove (sess);
+	sess_index_add (sess);
+}
+
+/* call after serv->p_cmp changed */
+
+void
+sess_index_rebuild (server *serv)
+{
+	GSList *list;
 	session *sess;
-	GSList *list = sess_list;
-	while (list)
+
+	g_clear_pointer (&serv->chan_index, g_hash_table_destroy);
+	g_clear_pointer (&serv->dialog_index, g_hash_table_destroy);
+
+	for (list = sess_list; list; list = list->next)
 	{
 		sess = list->data;
-		if ((serv == sess->server) && sess->type == SESS_CHANNEL)
+		if (sess->server == serv)
 		{
-			if (!serv->p_cmp (chan, sess->channel))
-				return sess;
+			g_clear_pointer (&sess->index_key, g_free);
+			sess_index_add (sess);
 		}
-		list = list->next;
 	}
-	return NULL;
+}
+
+session *
+find_dialog (server *serv, char *nick)
+{
+	if (!serv->dialog_index)
+		return NULL;
+	return g_hash_table_lookup (serv->dialog_index, nick);
+}
+
+session *
+find_channel (server *serv, char *chan)
+{
+	if (!serv->chan_index)
+		return NULL;
+	return g_hash_table_lookup (serv->chan_index, chan);
 }
 
 static void
@@ -478,7 +558,6 @@ session_new (server *serv, char *from, int type, int focus)
 	sess = g_new0 (struct session, 1);
 
 	sess->server = serv;
-	sess->logfd = -1;
 	sess->type = type;
 
 	sess->alert_balloon = SET_DEFAULT;
@@ -500,6 +579,7 @@ session_new (server *serv, char *from, int type, int focus)
 	}
 
 	sess_list = g_slist_prepend (sess_list, sess);
+	sess_index_add (sess);
 
 	fe_new_window (sess, focus);
 
@@ -535,8 +615,7 @@ new_ircwindow (server *serv, char *name, int type, int focus)
 
 	irc_init (sess);
 	chanopt_load (sess);
-	scrollback_load (sess);
-	if (sess->scrollwritten && sess->scrollback_replay_marklast)
+	if (scrollback_load (sess) && sess->scrollback_replay_marklast)
 		sess->scrollback_replay_marklast (sess);
 	if (type == SESS_DIALOG)
 	{
@@ -654,6 +733,7 @@ session_free (session *killsess)
 		killserv->server_session = killserv->front_session;
 
 	sess_list = g_slist_remove (sess_list, killsess);
+	sess_index_remove (killsess);
 
 	if (killsess->type == SESS_CHANNEL)
 		userlist_free (killsess);
@@ -822,6 +902,7 @@ xchat_init (void)
 	signal (SIGPIPE, SIG_IGN);
 #endif
 
+	bench_latency_init ();
 	load_text_events ();
 	sound_load ();
 	notify_load ();
@@ -979,8 +1060,10 @@ hexchat_exit (void)
 	notify_save ();
 	ignore_save ();
 	free_sessions ();
+	log_thread_shutdown ();
 	chanopt_save_all (TRUE);
 	servlist_cleanup ();
+	bench_latency_report ();
 	fe_exit ();
 }
 
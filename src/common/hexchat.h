@@ -160,6 +160,7 @@ struct hexchatprefs
 	unsigned int hex_irc_hide_version;
 	unsigned int hex_irc_invisible;
 	unsigned int hex_irc_logging;
+	unsigned int hex_irc_logging_thread;
 	unsigned int hex_irc_raw_modes;
 	unsigned int hex_irc_servernotice;
 	unsigned int hex_irc_skip_motd;
@@ -361,16 +362,27 @@ typedef struct session
 	struct server *server;
 	tree *usertree;					/* alphabetical tree */
 	struct User *me;					/* points to myself in the usertree */
+	GPtrArray *names_pending;		/* users from 353, added to usertree on 366 */
 	char channel[CHANLEN];
 	char waitchannel[CHANLEN];		  /* waiting to join channel (/join sent) */
 	char willjoinchannel[CHANLEN];	  /* will issue /join for this channel */
 	char session_name[CHANLEN];		 /* the name of the session, should not modified */
+	char *index_key;					/* name it's registered under in the server's chan/dialog_index */
 	char channelkey[64];			  /* XXX correct max length? */
 	int limit;						  /* channel user limit */
-	int logfd;
+	struct _log_file *logfile;
+	char *logpath;						  /* what logfile was opened on */
+	time_t logcheck;					  /* when to look at logpath again */
+	GString *logbuf;					  /* unwritten log lines */
+	int logflush_tag;
 
 	GFile *scrollfile;							/* scrollback file */
-	int scrollwritten;					/* number of lines written */
+	struct _log_file *scrolllog;		/* writer on scrollfile */
+	GString *scrollbuf;					/* lines not handed to scrolllog yet */
+	int scrollflush_tag;
+	int scrollwritten;					/* number of lines in scrollfile, -1 = not counted */
+	int scrollreplay_seg;				/* segment the oldest replayed line is in */
+	goffset scrollreplay_pos;			/* and where in it that line starts */
 
 	char lastnick[NICKLEN];			  /* last nick you /msg'ed */
 
@@ -462,13 +474,9 @@ typedef struct server
 	int (*p_cmp)(const char *s1, const char *s2);
 
 	int port;
-	int sok;					/* is equal to sok4 or sok6 (the one we are using) */
-	int sok4;					/* tcp4 socket */
-	int sok6;					/* tcp6 socket */
+	int sok;
 	int proxy_type;
-	int proxy_sok;				/* Additional information for MS Proxy beast */
-	int proxy_sok4;
-	int proxy_sok6;
+	struct connect_state *conn;	/* the connection attempt, while connecting */
 	int id;					/* unique ID number (for plugin API) */
 
 	/* dcc_ip moved from hexchatprefs to make it per-server */
@@ -481,9 +489,6 @@ typedef struct server
 #else
 	void *ssl;
 #endif
-	int childread;
-	int childwrite;
-	int childpid;
 	int iotag;
 	int recondelay_tag;				/* reconnect delay timeout */
 	int joindelay_tag;				/* waiting before we send JOIN */
@@ -491,9 +496,11 @@ typedef struct server
 	char servername[128];			/* what the server says is its name */
 	char password[1024];
 	char nick[NICKLEN];
-	char linebuf[8704];				/* RFC says 512 chars including \r\n, IRCv3 message tags add 8191, plus the NUL byte */
+	char *linebuf;						/* receive buffer, lines are framed in place (see server_read) */
+	gsize linebuf_size;				/* allocated size of linebuf, grows for overlong lines */
+	gsize linebuf_start;				/* first byte not yet handed to server_inline */
+	gsize linebuf_end;				/* end of the data received so far */
 	char *last_away_reason;
-	int pos;								/* current position in linebuf */
 	int nickcount;
 	int loginmethod;					/* see login_types[] */
 
@@ -534,6 +541,20 @@ typedef struct server
 
 	GSList *favlist;			/* list of channels & keys to join */
 
+	GHashTable *chan_index;		/* casemapped channel -> SESS_CHANNEL session (see find_channel) */
+	GHashTable *dialog_index;	/* casemapped nick -> SESS_DIALOG session (see find_dialog) */
+	GHashTable *user_index;		/* casemapped nick -> GPtrArray of sessions it's in (see userlist.c) */
+	GHashTable *account_index;	/* casemapped nick -> interned account, "*" if none (see userlist.c) */
+	int names_pending;			/* sessions with a NAMES burst not yet in user_index */
+	GHashTable *notify_index;	/* casemapped nick -> notify_per_server watched here (see notify.c) */
+	int notify_index_gen;		/* notify list generation it was built for */
+	char *notify_index_net;		/* network name it was built for */
+	GHashTable *notify_ison_seen;	/* notify_per_server reported online this ISON round */
+	int notify_ison_pending;		/* 303 replies still to come this round */
+	time_t notify_ison_sent;		/* when this round was sent */
+	guint notify_ison_round;		/* tag of the latest round, 0 means none yet */
+	GQueue *notify_ison_out;		/* round tag per ISON awaiting its 303, 0 if not ours */
+
 	unsigned int motd_skipped:1;
 	unsigned int connected:1;
 	unsigned int connecting:1;
@@ -546,6 +567,7 @@ typedef struct server
 	unsigned int doing_dns:1;			/* /dns has been done */
 	unsigned int end_of_motd:1;		/* end of motd reached (logged in) */
 	unsigned int sent_quit:1;			/* sent a QUIT already? */
+	unsigned int linebuf_discard:1;	/* skipping the rest of an overlong line */
 	unsigned int use_listargs:1;		/* undernet and dalnet need /list >0,<10000 */
 	unsigned int is_away:1;
 	unsigned int reconnect_away:1;	/* whether to reconnect in is_away state */
@@ -51,6 +51,7 @@ clear_channel (session *sess)
 	if (sess->channel[0])
 		strcpy (sess->waitchannel, sess->channel);
 	sess->channel[0] = 0;
+	sess_index_update (sess);
 	sess->doing_who = FALSE;
 	sess->done_away_check = FALSE;
 
@@ -79,11 +80,11 @@ set_topic (session *sess, char *topic, char *stripped_topic)
 {
 	/* The topic of dialogs are the users hostname which is logged is new */
 	if (sess->type == SESS_DIALOG && (!sess->topic || strcmp(sess->topic, stripped_topic))
-		&& sess->logfd != -1)
+		&& sess->logfile)
 	{
 		char tbuf[1024];
 		g_snprintf (tbuf, sizeof (tbuf), "[%s has address %s]\n", sess->channel, stripped_topic);
-		write (sess->logfd, tbuf, strlen (tbuf));
+		log_write_raw (sess, tbuf, strlen (tbuf));
 	}
 
 	g_free (sess->topic);
@@ -215,42 +216,116 @@ inbound_privmsg (server *serv, char *from, char *ip, char *text, int id,
 									  tags_data->timestamp);
 }
 
-/* used for Alerts section. Masks can be separated by commas and spaces. */
+/* used for Alerts section. Masks can be separated by commas and spaces.
+   Each list is split up once into a set of plain masks, which take one
+   lookup per word, and the ones with wildcards, which take a match (). */
 
-gboolean
-alert_match_word (char *word, char *masks)
+struct alert_matcher
 {
-	char *p = masks;
-	char endchar;
-	int res;
+	GHashTable *literals;	/* masks without wildcards, compared caselessly */
+	GPtrArray *wild;			/* masks for match () */
+	gboolean empty;			/* has an empty mask, which matches an empty word */
+};
 
-	if (masks[0] == 0)
-		return FALSE;
+static GHashTable *alert_matchers = NULL;	/* mask list -> struct alert_matcher */
+
+static gboolean
+alert_literal_equal (gconstpointer a, gconstpointer b)
+{
+	return rfc_casecmp (a, b) == 0;
+}
+
+static void
+alert_matcher_free (struct alert_matcher *am)
+{
+	g_hash_table_destroy (am->literals);
+	g_ptr_array_free (am->wild, TRUE);
+	g_free (am);
+}
+
+static struct alert_matcher *
+alert_matcher_get (char *masks)
+{
+	struct alert_matcher *am;
+	char *p, *start, *mask;
+
+	if (!alert_matchers)
+		alert_matchers = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+															 (GDestroyNotify) alert_matcher_free);
+
+	am = g_hash_table_lookup (alert_matchers, masks);
+	if (am)
+		return am;
+
+	/* lists only change with the settings and nicks, don't let old ones pile up */
+	if (g_hash_table_size (alert_matchers) >= 32)
+		g_hash_table_remove_all (alert_matchers);
 
+	am = g_new0 (struct alert_matcher, 1);
+	am->literals = g_hash_table_new_full ((GHashFunc) str_ihash, alert_literal_equal,
+													  g_free, NULL);
+	am->wild = g_ptr_array_new_with_free_func (g_free);
+
+	start = p = masks;
 	while (1)
 	{
-		/* if it's a 0, space or comma, the word has ended. */
+		/* if it's a 0, space or comma, the mask has ended. */
 		if (*p == 0 || *p == ' ' || *p == ',')
 		{
-			endchar = *p;
-			*p = 0;
-			res = match (g_strchug (masks), word);
-			*p = endchar;
+			mask = g_strchug (g_strndup (start, p - start));
 
-			if (res)
-				return TRUE;	/* yes, matched! */
+			if (mask[0] == 0)
+			{
+				am->empty = TRUE;
+				g_free (mask);
+			}
+			else if (strpbrk (mask, "*?\\"))
+				g_ptr_array_add (am->wild, mask);
+			else if (!g_hash_table_add (am->literals, mask))
+				g_free (mask);	/* a duplicate, the set kept the first one */
 
-			masks = p + 1;
 			if (*p == 0)
-				return FALSE;
+				break;
+			start = p + 1;
 		}
 		p++;
 	}
+
+	g_hash_table_insert (alert_matchers, g_strdup (masks), am);
+	return am;
+}
+
+static gboolean
+alert_matcher_match (struct alert_matcher *am, char *word)
+{
+	guint i;
+
+	if (am->empty && word[0] == 0)
+		return TRUE;
+
+	if (g_hash_table_contains (am->literals, word))
+		return TRUE;
+
+	for (i = 0; i < am->wild->len; i++)
+		if (match (g_ptr_array_index (am->wild, i), word))
+			return TRUE;
+
+	return FALSE;
+}
+
+gboolean
+alert_match_word (char *word, char *masks)
+{
+	if (masks[0] == 0)
+		return FALSE;
+
+	return alert_matcher_match (alert_matcher_get (masks), word);
 }
 
 gboolean
 alert_match_text (char *text, char *masks)
 {
+	struct alert_matcher *am;
 	unsigned char *p = text;
 	unsigned char endchar;
 	int res;
@@ -258,6 +333,8 @@ alert_match_text (char *text, char *masks)
 	if (masks[0] == 0)
 		return FALSE;
 
+	am = alert_matcher_get (masks);
+
 	while (1)
 	{
 		if (*p >= '0' && *p <= '9')
@@ -283,7 +360,7 @@ alert_match_text (char *text, char *masks)
 		{
 			endchar = *p;
 			*p = 0;
-			res = alert_match_word (text, masks);
+			res = alert_matcher_match (am, text);
 			*p = endchar;
 
 			if (res)
@@ -491,7 +568,7 @@ inbound_newnick (server *serv, char *nick, char *newnick, int quiet,
 {
 	int me = FALSE;
 	session *sess;
-	GSList *list = sess_list;
+	GSList *list, *sessions;
 
 	if (!serv->p_cmp (nick, serv->nick))
 	{
@@ -499,32 +576,53 @@ inbound_newnick (server *serv, char *nick, char *newnick, int quiet,
 		safe_strcpy (serv->nick, newnick, NICKLEN);
 	}
 
-	while (list)
+	if (me)
 	{
-		sess = list->data;
-		if (sess->server == serv)
+		/* our nick is in every title of this server */
+		for (list = sess_list; list; list = list->next)
 		{
-			if (userlist_change (sess, nick, newnick) || (me && sess->type == SESS_SERVER))
+			sess = list->data;
+			if (sess->server != serv)
+				continue;
+
+			if (userlist_change (sess, nick, newnick) || sess->type == SESS_SERVER)
 			{
 				if (!quiet)
-				{
-					if (me)
-						EMIT_SIGNAL_TIMESTAMP (XP_TE_UCHANGENICK, sess, nick, 
-													  newnick, NULL, NULL, 0,
-													  tags_data->timestamp);
-					else
-						EMIT_SIGNAL_TIMESTAMP (XP_TE_CHANGENICK, sess, nick,
-													  newnick, NULL, NULL, 0, tags_data->timestamp);
-				}
+					EMIT_SIGNAL_TIMESTAMP (XP_TE_UCHANGENICK, sess, nick, 
+												  newnick, NULL, NULL, 0,
+												  tags_data->timestamp);
 			}
 			if (sess->type == SESS_DIALOG && !serv->p_cmp (sess->channel, nick))
 			{
 				safe_strcpy (sess->channel, newnick, CHANLEN);
+				sess_index_update (sess);
+				sess->logcheck = 0;	/* the log file name may follow the nick */
 				fe_set_channel (sess);
 			}
 			fe_set_title (sess);
 		}
-		list = list->next;
+	} else
+	{
+		/* only visit the channels the user is in */
+		sessions = userlist_find_sessions (serv, nick);
+		for (list = sessions; list; list = list->next)
+		{
+			sess = list->data;
+			if (userlist_change (sess, nick, newnick) && !quiet)
+				EMIT_SIGNAL_TIMESTAMP (XP_TE_CHANGENICK, sess, nick,
+											  newnick, NULL, NULL, 0, tags_data->timestamp);
+		}
+		g_slist_free (sessions);
+
+		sess = find_dialog (serv, nick);
+		if (sess)
+		{
+			safe_strcpy (sess->channel, newnick, CHANLEN);
+			sess_index_update (sess);
+			sess->logcheck = 0;	/* the log file name may follow the nick */
+			fe_set_channel (sess);
+			fe_set_title (sess);
+		}
 	}
 
 	dcc_change_nick (serv, nick, newnick);
@@ -596,11 +694,11 @@ inbound_ujoin (server *serv, char *chan, char *nick, char *ip,
 	}
 
 	safe_strcpy (sess->channel, chan, CHANLEN);
+	sess_index_update (sess);
 	if (found_unused)
 	{
 		chanopt_load (sess);
-		scrollback_load (sess);
-		if (sess->scrollwritten && sess->scrollback_replay_marklast)
+		if (scrollback_load (sess) && sess->scrollback_replay_marklast)
 			sess->scrollback_replay_marklast (sess);
 	}
 
@@ -722,7 +820,7 @@ inbound_nameslist (server *serv, char *chan, char *names,
 
 		g_strlcpy (name, name_list[i], MIN(offset, sizeof(name)));
 
-		userlist_add (sess, name, host, NULL, NULL, tags_data);
+		userlist_names_add (sess, name, host, tags_data);
 	}
 	g_strfreev (name_list);
 }
@@ -828,31 +926,29 @@ void
 inbound_quit (server *serv, char *nick, char *ip, char *reason,
 				  const message_tags_data *tags_data)
 {
-	GSList *list = sess_list;
+	GSList *list, *sessions;
 	session *sess;
 	struct User *user;
-	int was_on_front_session = FALSE;
+	int was_on_front_session = (current_sess && current_sess->server == serv);
 
-	while (list)
+	/* only visit the channels the user was in */
+	sessions = userlist_find_sessions (serv, nick);
+	for (list = sessions; list; list = list->next)
 	{
-		sess = (session *) list->data;
-		if (sess->server == serv)
+		sess = list->data;
+		if ((user = userlist_find (sess, nick)))
 		{
- 			if (sess == current_sess)
- 				was_on_front_session = TRUE;
-			if ((user = userlist_find (sess, nick)))
-			{
-				EMIT_SIGNAL_TIMESTAMP (XP_TE_QUIT, sess, nick, reason, ip, NULL, 0,
-											  tags_data->timestamp);
-				userlist_remove_user (sess, user);
-			} else if (sess->type == SESS_DIALOG && !serv->p_cmp (sess->channel, nick))
-			{
-				EMIT_SIGNAL_TIMESTAMP (XP_TE_QUIT, sess, nick, reason, ip, NULL, 0,
-											  tags_data->timestamp);
-			}
+			EMIT_SIGNAL_TIMESTAMP (XP_TE_QUIT, sess, nick, reason, ip, NULL, 0,
+										  tags_data->timestamp);
+			userlist_remove_user (sess, user);
 		}
-		list = list->next;
 	}
+	g_slist_free (sessions);
+
+	sess = find_dialog (serv, nick);
+	if (sess)
+		EMIT_SIGNAL_TIMESTAMP (XP_TE_QUIT, sess, nick, reason, ip, NULL, 0,
+									  tags_data->timestamp);
 
 	notify_set_offline (serv, nick, was_on_front_session, tags_data);
 }
@@ -861,17 +957,7 @@ void
 inbound_account (server *serv, char *nick, char *account,
 					  const message_tags_data *tags_data)
 {
-	session *sess = NULL;
-	GSList *list;
-
-	list = sess_list;
-	while (list)
-	{
-		sess = list->data;
-		if (sess->server == serv)
-			userlist_set_account (sess, nick, account);
-		list = list->next;
-	}
+	userlist_set_account_global (serv, nick, account);
 }
 
 void
@@ -1042,7 +1128,7 @@ inbound_away (server *serv, char *nick, char *msg,
 {
 	struct away_msg *away = server_away_find_message (serv, nick);
 	session *sess = NULL;
-	GSList *list;
+	GSList *list, *sessions;
 
 	if (away && !strcmp (msg, away->message))	/* Seen the msg before? */
 	{
@@ -1074,41 +1160,32 @@ inbound_away (server *serv, char *nick, char *msg,
 										  tags_data->timestamp);
 	}
 
-	list = sess_list;
-	while (list)
-	{
-		sess = list->data;
-		if (sess->server == serv)
-			userlist_set_away (sess, nick, TRUE);
-		list = list->next;
-	}
+	sessions = userlist_find_sessions (serv, nick);
+	for (list = sessions; list; list = list->next)
+		userlist_set_away (list->data, nick, TRUE);
+	g_slist_free (sessions);
 }
 
 void
 inbound_away_notify (server *serv, char *nick, char *reason,
 							const message_tags_data *tags_data)
 {
-	session *sess = NULL;
-	GSList *list;
+	session *sess = serv->front_session;
+	GSList *list, *sessions;
 
-	list = sess_list;
-	while (list)
+	sessions = userlist_find_sessions (serv, nick);
+	for (list = sessions; list; list = list->next)
+		userlist_set_away (list->data, nick, reason ? TRUE : FALSE);
+	g_slist_free (sessions);
+
+	if (sess && notify_is_in_list (serv, nick))
 	{
-		sess = list->data;
-		if (sess->server == serv)
-		{
-			userlist_set_away (sess, nick, reason ? TRUE : FALSE);
-			if (sess == serv->front_session && notify_is_in_list (serv, nick))
-			{
-				if (reason)
-					EMIT_SIGNAL_TIMESTAMP (XP_TE_NOTIFYAWAY, sess, nick, reason, NULL,
-												  NULL, 0, tags_data->timestamp);
-				else
-					EMIT_SIGNAL_TIMESTAMP (XP_TE_NOTIFYBACK, sess, nick, NULL, NULL, 
-												  NULL, 0, tags_data->timestamp);
-			}
-		}
-		list = list->next;
+		if (reason)
+			EMIT_SIGNAL_TIMESTAMP (XP_TE_NOTIFYAWAY, sess, nick, reason, NULL,
+										  NULL, 0, tags_data->timestamp);
+		else
+			EMIT_SIGNAL_TIMESTAMP (XP_TE_NOTIFYBACK, sess, nick, NULL, NULL, 
+										  NULL, 0, tags_data->timestamp);
 	}
 }
 
@@ -1127,6 +1204,7 @@ inbound_nameslist_end (server *serv, char *chan,
 			sess = list->data;
 			if (sess->server == serv)
 			{
+				userlist_names_flush (sess);
 				sess->end_of_names = TRUE;
 				sess->ignore_names = FALSE;
 				fe_userlist_numbers (sess);
@@ -1138,6 +1216,7 @@ inbound_nameslist_end (server *serv, char *chan,
 	sess = find_channel (serv, chan);
 	if (sess)
 	{
+		userlist_names_flush (sess);
 		sess->end_of_names = TRUE;
 		sess->ignore_names = FALSE;
 		fe_userlist_numbers (sess);
@@ -0,0 +1,313 @@
+/* HexChat
+ * Copyright (C) 1998-2010 Peter Zelezny.
+ * Copyright (C) 2009-2013 Berke Viktor.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/* Log and scrollback file I/O. Jobs run right away, or, once
+ * irc_logging_thread is set, on a worker thread so a slow disk never
+ * holds up the main loop. Either way they run in the order they were
+ * queued. Only the main thread queues jobs.
+ *
+ * The queue is bounded by LOG_QUEUE_MAX bytes of pending writes; when
+ * it's full the main thread waits for room, and that is counted in the
+ * stats shown by /DEBUG. */
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "hexchat.h"
+#include "hexchatc.h"
+#include "logthread.h"
+
+#define LOG_QUEUE_MAX (4 * 1024 * 1024)
+
+struct _log_file
+{
+	int fd;
+};
+
+typedef enum
+{
+	LOG_JOB_OPEN,
+	LOG_JOB_WRITE,
+	LOG_JOB_CLOSE,
+	LOG_JOB_RENAME,
+	LOG_JOB_QUIT
+} log_job_type;
+
+typedef struct
+{
+	log_job_type type;
+	log_file *lf;
+	char *data;		/* bytes to write, or the path to open/rename */
+	char *to;		/* rename target */
+	gsize len;		/* of data, for writes only */
+} log_job;
+
+static GThread *log_thread;
+static GMutex log_mutex;
+static GCond log_cond_job;		/* a job was queued */
+static GCond log_cond_done;	/* a job finished */
+static GQueue log_queue = G_QUEUE_INIT;
+static gboolean log_busy;
+static log_thread_stats log_stats;
+
+static log_job *
+log_job_new (log_job_type type, log_file *lf)
+{
+	log_job *job = g_new0 (log_job, 1);
+
+	job->type = type;
+	job->lf = lf;
+
+	return job;
+}
+
+static void
+log_job_free (log_job *job)
+{
+	g_free (job->data);
+	g_free (job->to);
+	g_free (job);
+}
+
+/* returns the number of bytes written */
+
+static gsize
+log_job_run (log_job *job)
+{
+	char *dir;
+	gssize n;
+	gsize done = 0;
+
+	switch (job->type)
+	{
+	case LOG_JOB_OPEN:
+		dir = g_path_get_dirname (job->data);
+		g_mkdir_with_parents (dir, 0700);
+		g_free (dir);
+		job->lf->fd = g_open (job->data, O_CREAT | O_APPEND | O_WRONLY | OFLAGS, 0600);
+		break;
+
+	case LOG_JOB_WRITE:
+		if (job->lf->fd == -1)
+			break;
+		while (done < job->len)
+		{
+			n = write (job->lf->fd, job->data + done, job->len - done);
+			if (n < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				break;
+			}
+			done += n;
+		}
+		break;
+
+	case LOG_JOB_CLOSE:
+		if (job->lf->fd != -1)
+			close (job->lf->fd);
+		g_free (job->lf);
+		break;
+
+	case LOG_JOB_RENAME:
+		g_rename (job->data, job->to);
+		break;
+
+	case LOG_JOB_QUIT:
+		break;
+	}
+
+	return done;
+}
+
+static gpointer
+log_thread_main (gpointer data)
+{
+	log_job *job;
+	gsize written;
+
+	g_mutex_lock (&log_mutex);
+	while (1)
+	{
+		while (g_queue_is_empty (&log_queue))
+			g_cond_wait (&log_cond_job, &log_mutex);
+
+		job = g_queue_pop_head (&log_queue);
+		if (job->type == LOG_JOB_QUIT)
+		{
+			log_job_free (job);
+			break;
+		}
+
+		log_busy = TRUE;
+		g_mutex_unlock (&log_mutex);
+
+		written = log_job_run (job);
+
+		g_mutex_lock (&log_mutex);
+		log_busy = FALSE;
+		log_stats.queue_bytes -= job->len;
+		log_stats.bytes_written += written;
+		g_cond_broadcast (&log_cond_done);
+
+		log_job_free (job);
+	}
+	g_mutex_unlock (&log_mutex);
+
+	return NULL;
+}
+
+static void
+log_job_queue (log_job *job)
+{
+	gint64 start;
+
+	/* once started, the thread stays until exit so the order holds */
+	if (!log_thread && prefs.hex_irc_logging_thread)
+		log_thread = g_thread_new ("hexchat-log", log_thread_main, NULL);
+
+	if (!log_thread)
+	{
+		log_stats.bytes_queued += job->len;
+		log_stats.bytes_written += log_job_run (job);
+		log_job_free (job);
+		return;
+	}
+
+	g_mutex_lock (&log_mutex);
+
+	if (log_stats.queue_bytes > 0 && log_stats.queue_bytes + job->len > LOG_QUEUE_MAX)
+	{
+		log_stats.stalls++;
+		start = g_get_monotonic_time ();
+		while (log_stats.queue_bytes > 0 && log_stats.queue_bytes + job->len > LOG_QUEUE_MAX)
+			g_cond_wait (&log_cond_done, &log_mutex);
+		log_stats.stall_usec += g_get_monotonic_time () - start;
+	}
+
+	log_stats.queue_bytes += job->len;
+	log_stats.bytes_queued += job->len;
+	if (log_stats.queue_bytes > log_stats.queue_peak)
+		log_stats.queue_peak = log_stats.queue_bytes;
+
+	g_queue_push_tail (&log_queue, job);
+	g_cond_signal (&log_cond_job);
+
+	g_mutex_unlock (&log_mutex);
+}
+
+/* wrap an fd the caller opened; it's closed by log_file_close() */
+
+log_file *
+log_file_new (int fd)
+{
+	log_file *lf = g_new (log_file, 1);
+
+	lf->fd = fd;
+	return lf;
+}
+
+/* open path for appending, creating it and its directories if needed */
+
+log_file *
+log_file_open (const char *path)
+{
+	log_file *lf = log_file_new (-1);
+	log_job *job = log_job_new (LOG_JOB_OPEN, lf);
+
+	job->data = g_strdup (path);
+	log_job_queue (job);
+
+	return lf;
+}
+
+void
+log_file_write (log_file *lf, const char *data, gsize len)
+{
+	log_job *job;
+
+	if (len == 0)
+		return;
+
+	job = log_job_new (LOG_JOB_WRITE, lf);
+	job->data = g_malloc (len);
+	memcpy (job->data, data, len);
+	job->len = len;
+	log_job_queue (job);
+}
+
+/* lf must not be used after this */
+
+void
+log_file_close (log_file *lf)
+{
+	log_job_queue (log_job_new (LOG_JOB_CLOSE, lf));
+}
+
+void
+log_file_rename (const char *from, const char *to)
+{
+	log_job *job = log_job_new (LOG_JOB_RENAME, NULL);
+
+	job->data = g_strdup (from);
+	job->to = g_strdup (to);
+	log_job_queue (job);
+}
+
+/* wait until everything queued so far is on disk */
+
+void
+log_thread_sync (void)
+{
+	if (!log_thread)
+		return;
+
+	g_mutex_lock (&log_mutex);
+	while (!g_queue_is_empty (&log_queue) || log_busy)
+		g_cond_wait (&log_cond_done, &log_mutex);
+	g_mutex_unlock (&log_mutex);
+}
+
+/* finish all queued jobs and stop the thread, call on exit */
+
+void
+log_thread_shutdown (void)
+{
+	if (!log_thread)
+		return;
+
+	g_mutex_lock (&log_mutex);
+	g_queue_push_tail (&log_queue, log_job_new (LOG_JOB_QUIT, NULL));
+	g_cond_signal (&log_cond_job);
+	g_mutex_unlock (&log_mutex);
+
+	g_thread_join (log_thread);
+	log_thread = NULL;
+}
+
+void
+log_thread_get_stats (log_thread_stats *stats)
+{
+	g_mutex_lock (&log_mutex);
+	*stats = log_stats;
+	stats->running = (log_thread != NULL);
+	g_mutex_unlock (&log_mutex);
+}
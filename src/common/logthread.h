@@ -0,0 +1,48 @@
+/* HexChat
+ * Copyright (C) 1998-2010 Peter Zelezny.
+ * Copyright (C) 2009-2013 Berke Viktor.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#ifndef HEXCHAT_LOGTHREAD_H
+#define HEXCHAT_LOGTHREAD_H
+
+#include <glib.h>
+
+typedef struct _log_file log_file;
+
+typedef struct
+{
+	guint64 bytes_queued;		/* total handed to log_file_write() */
+	guint64 bytes_written;
+	gsize queue_bytes;			/* waiting right now */
+	gsize queue_peak;
+	guint stalls;					/* times the queue was full */
+	gint64 stall_usec;			/* time spent waiting for room */
+	gboolean running;
+} log_thread_stats;
+
+log_file *log_file_new (int fd);
+log_file *log_file_open (const char *path);
+void log_file_write (log_file *lf, const char *data, gsize len);
+void log_file_close (log_file *lf);
+void log_file_rename (const char *from, const char *to);
+
+void log_thread_sync (void);
+void log_thread_shutdown (void);
+void log_thread_get_stats (log_thread_stats *stats);
+
+#endif
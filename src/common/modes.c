@@ -28,6 +28,7 @@
 #include "fe.h"
 #include "util.h"
 #include "inbound.h"
+#include "notify.h"
 #ifdef HAVE_STRINGS_H
 #include <strings.h>
 #endif
@@ -906,7 +907,12 @@ inbound_005 (server * serv, char *word[], const message_tags_data *tags_data)
 		} else if (g_strcmp0 (tokname, "CASEMAPPING") == 0)
 		{
 			if (g_strcmp0 (tokvalue, "ascii") == 0)
+			{
 				serv->p_cmp = (void *)g_ascii_strcasecmp;
+				sess_index_rebuild (serv);
+				userlist_index_rebuild (serv);
+				notify_index_reset (serv);
+			}
 		} else if (g_strcmp0 (tokname, "CHARSET") == 0)
 		{
 			if (g_ascii_strcasecmp (tokvalue, "UTF-8") == 0)
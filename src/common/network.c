@@ -23,20 +23,18 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <glib.h>
 
 #include <unistd.h>
 
 #define WANTSOCKET
 #define WANTARPA
-#define WANTDNS
 #include "inet.h"
 
-#define NETWORK_PRIVATE
 #include "network.h"
 
-#define RAND_INT(n) ((int)(rand() / (RAND_MAX + 1.0) * (n)))
-
 
 /* ================== COMMON ================= */
 
@@ -60,124 +58,40 @@ net_ip (guint32 addr)
 	return inet_ntoa (ia);
 }
 
-void
-net_store_destroy (netstore * ns)
-{
-	if (ns->ip6_hostent)
-		freeaddrinfo (ns->ip6_hostent);
-	g_free (ns);
-}
-
-netstore *
-net_store_new (void)
-{
-	return g_new0 (netstore, 1);
-}
-
-/* =================== IPV6 ================== */
-
-char *
-net_resolve (netstore * ns, char *hostname, int port, char **real_host)
-{
-	struct addrinfo hints;
-	char ipstring[MAX_HOSTNAME];
-	char portstring[MAX_HOSTNAME];
-	int ret;
-
-/*	if (ns->ip6_hostent)
-		freeaddrinfo (ns->ip6_hostent);*/
-
-	sprintf (portstring, "%d", port);
-
-	memset (&hints, 0, sizeof (struct addrinfo));
-	hints.ai_family = PF_UNSPEC; /* support ipv6 and ipv4 */
-	hints.ai_flags = AI_CANONNAME | AI_ADDRCONFIG;
-	hints.ai_socktype = SOCK_STREAM;
-
-	if (port == 0)
-		ret = getaddrinfo (hostname, NULL, &hints, &ns->ip6_hostent);
-	else
-		ret = getaddrinfo (hostname, portstring, &hints, &ns->ip6_hostent);
-	if (ret != 0)
-		return NULL;
-
-#ifdef LOOKUPD	/* See note about lookupd above the IPv4 version of net_resolve. */
-	struct addrinfo *tmp;
-	int count = 0;
-
-	for (tmp = ns->ip6_hostent; tmp; tmp = tmp->ai_next)
-		count ++;
-
-	count = RAND_INT(count);
-	
-	while (count--) ns->ip6_hostent = ns->ip6_hostent->ai_next;
-#endif
-
-	/* find the numeric IP number */
-	ipstring[0] = 0;
-	getnameinfo (ns->ip6_hostent->ai_addr, ns->ip6_hostent->ai_addrlen,
-					 ipstring, sizeof (ipstring), NULL, 0, NI_NUMERICHOST);
-
-	if (ns->ip6_hostent->ai_canonname)
-		*real_host = g_strdup (ns->ip6_hostent->ai_canonname);
-	else
-		*real_host = g_strdup (hostname);
-
-	return g_strdup (ipstring);
-}
-
-/* the only thing making this interface unclean, this shitty sok4, sok6 business */
+/* start a non-blocking TCP connect to "addr", bound to "bind_addr" if it's
+   the same family. Returns 0 with the socket in *sok_return, the caller
+   waits for it to become writable. Otherwise an errno value. */
 
 int
-net_connect (netstore * ns, int sok4, int sok6, int *sok_return)
+net_connect_start (const struct sockaddr *addr, int addr_len,
+						 const struct sockaddr *bind_addr, int bind_len, int *sok_return)
 {
-	struct addrinfo *res, *res0;
-	int error = -1;
+	int sok, error;
+
+	sok = socket (addr->sa_family, SOCK_STREAM, IPPROTO_TCP);
+	if (sok == -1)
+		return sock_error ();
 
-	res0 = ns->ip6_hostent;
+	net_set_socket_options (sok);
+	set_nonblocking (sok);
 
-	for (res = res0; res; res = res->ai_next)
+	if (bind_addr && bind_addr->sa_family == addr->sa_family &&
+		 bind (sok, bind_addr, bind_len) != 0)
 	{
-/*		sok = socket (res->ai_family, res->ai_socktype, res->ai_protocol);
-		if (sok < 0)
-			continue;*/
-		switch (res->ai_family)
-		{
-		case AF_INET:
-			error = connect (sok4, res->ai_addr, res->ai_addrlen);
-			*sok_return = sok4;
-			break;
-		case AF_INET6:
-			error = connect (sok6, res->ai_addr, res->ai_addrlen);
-			*sok_return = sok6;
-			break;
-		default:
-			error = 1;
-		}
-
-		if (error == 0)
-			break;
+		error = sock_error ();
+		closesocket (sok);
+		return error;
 	}
 
-	return error;
-}
-
-void
-net_bind (netstore * tobindto, int sok4, int sok6)
-{
-	bind (sok4, tobindto->ip6_hostent->ai_addr,
-			tobindto->ip6_hostent->ai_addrlen);
-	bind (sok6, tobindto->ip6_hostent->ai_addr,
-			tobindto->ip6_hostent->ai_addrlen);
-}
+	if (connect (sok, addr, addr_len) != 0 && sock_error () != EINPROGRESS)
+	{
+		error = sock_error ();
+		closesocket (sok);
+		return error;
+	}
 
-void
-net_sockets (int *sok4, int *sok6)
-{
-	*sok4 = socket (AF_INET, SOCK_STREAM, IPPROTO_TCP);
-	*sok6 = socket (AF_INET6, SOCK_STREAM, IPPROTO_TCP);
-	net_set_socket_options (*sok4);
-	net_set_socket_options (*sok6);
+	*sok_return = sok;
+	return 0;
 }
 
 void
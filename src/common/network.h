@@ -20,23 +20,10 @@
 #ifndef HEXCHAT_NETWORK_H
 #define HEXCHAT_NETWORK_H
 
-typedef struct netstore_
-{
-#ifdef NETWORK_PRIVATE
-	struct addrinfo *ip6_hostent;
-#else
-	int _dummy;	/* some compilers don't like empty structs */
-#endif
-} netstore;
-
-#define MAX_HOSTNAME 128
+struct sockaddr;
 
-netstore *net_store_new (void);
-void net_store_destroy (netstore *ns);
-int net_connect (netstore *ns, int sok4, int sok6, int *sok_return);
-char *net_resolve (netstore *ns, char *hostname, int port, char **real_host);
-void net_bind (netstore *tobindto, int sok4, int sok6);
+int net_connect_start (const struct sockaddr *addr, int addr_len,
+							  const struct sockaddr *bind_addr, int bind_len, int *sok_return);
 char *net_ip (guint32 addr);
-void net_sockets (int *sok4, int *sok6);
 
 #endif
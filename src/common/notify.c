@@ -39,6 +39,16 @@
 GSList *notify_list = 0;
 int notify_tag = 0;
 
+/* bumped whenever notify_list or its per-server entries change,
+   which makes every serv->notify_index stale */
+static int notify_generation = 0;
+
+/* an ISON round that got no answer for this long is given up */
+#define NOTIFY_ISON_WAIT 60
+
+/* set while notify_checklist_for_server sends its own ISONs */
+static gboolean notify_ison_ours = FALSE;
+
 
 static char *
 despacify_dup (char *str)
@@ -173,31 +183,93 @@ notify_load (void)
 	}
 }
 
-static struct notify_per_server *
-notify_find (server *serv, char *nick)
+/* serv->notify_index maps each nick watched on this server's network to
+   its notify_per_server. It is rebuilt on first use after the notify list
+   or the network name changed. */
+
+static GHashTable *
+notify_index (server *serv)
 {
-	GSList *list = notify_list;
-	struct notify_per_server *servnot;
+	char *net = server_get_network (serv, TRUE);
+	GSList *list;
 	struct notify *notify;
+	struct notify_per_server *servnot;
 
-	while (list)
+	if (serv->notify_index && serv->notify_index_gen == notify_generation &&
+		 g_strcmp0 (serv->notify_index_net, net) == 0)
+		return serv->notify_index;
+
+	if (serv->notify_index)
+		g_hash_table_destroy (serv->notify_index);
+	g_free (serv->notify_index_net);
+
+	serv->notify_index = server_casemap_table_new (serv, NULL, NULL);
+	serv->notify_index_gen = notify_generation;
+	serv->notify_index_net = g_strdup (net);
+
+	for (list = notify_list; list; list = list->next)
 	{
 		notify = (struct notify *) list->data;
-
 		servnot = notify_find_server_entry (notify, serv);
-		if (!servnot)
-		{
-			list = list->next;
-			continue;
-		}
+		/* the first one in the list wins, as it always has */
+		if (servnot && !g_hash_table_lookup (serv->notify_index, notify->name))
+			g_hash_table_insert (serv->notify_index, notify->name, servnot);
+	}
 
-		if (!serv->p_cmp (notify->name, nick))
-			return servnot;
+	return serv->notify_index;
+}
 
-		list = list->next;
+static void
+notify_ison_end (server *serv)
+{
+	if (serv->notify_ison_seen)
+	{
+		g_hash_table_destroy (serv->notify_ison_seen);
+		serv->notify_ison_seen = NULL;
+	}
+	serv->notify_ison_pending = 0;
+}
+
+/* An ISON line is on its way to the server. Replies come back in the
+   same order, so remember which round it belongs to (0 if the user
+   sent it) and notify_markonline can tell its 303 apart. */
+
+void
+notify_ison_queued (server *serv)
+{
+	if (!serv->notify_ison_out)
+		serv->notify_ison_out = g_queue_new ();
+
+	g_queue_push_tail (serv->notify_ison_out,
+							 GUINT_TO_POINTER (notify_ison_ours ? serv->notify_ison_round : 0));
+}
+
+/* forget the index and any ISON round, e.g. on disconnect or when
+   CASEMAPPING changes how nicks compare */
+
+void
+notify_index_reset (server *serv)
+{
+	if (serv->notify_index)
+	{
+		g_hash_table_destroy (serv->notify_index);
+		serv->notify_index = NULL;
 	}
+	g_free (serv->notify_index_net);
+	serv->notify_index_net = NULL;
 
-	return NULL;
+	notify_ison_end (serv);
+	if (serv->notify_ison_out)
+	{
+		g_queue_free (serv->notify_ison_out);
+		serv->notify_ison_out = NULL;
+	}
+}
+
+static struct notify_per_server *
+notify_find (server *serv, char *nick)
+{
+	return g_hash_table_lookup (notify_index (serv), nick);
 }
 
 static void
@@ -408,11 +480,12 @@ notify_send_watches (server * serv)
 
 		if (notify_do_network (notify, serv))
 		{
-			send_list = g_slist_append (send_list, notify);
+			send_list = g_slist_prepend (send_list, notify);
 		}
 
 		list = list->next;
 	}
+	send_list = g_slist_reverse (send_list);
 
 	/* Now send that list in batches */
 	point = list = send_list;
@@ -440,86 +513,124 @@ notify_send_watches (server * serv)
 	g_slist_free (send_list);
 }
 
-/* called when receiving a ISON 303 - should this func go? */
+/* called when receiving a ISON 303, "nicks" is the space separated
+   list. A round of ISONs may be split over several replies: nicks are
+   only marked offline once the last of them is in. A reply nobody
+   asked for (e.g. /quote ISON) just marks its nicks online. */
 
 void
-notify_markonline (server *serv, char *word[], const message_tags_data *tags_data)
+notify_markonline (server *serv, char *nicks, const message_tags_data *tags_data)
 {
-	struct notify *notify;
 	struct notify_per_server *servnot;
-	GSList *list = notify_list;
-	int i, seen;
+	GHashTableIter iter;
+	GSList *offline = NULL, *list;
+	char nick[NICKLEN];
+	char *end;
+	guint tag = 0;
+	gboolean round;
 
-	while (list)
+	if (serv->notify_ison_out && !g_queue_is_empty (serv->notify_ison_out))
+		tag = GPOINTER_TO_UINT (g_queue_pop_head (serv->notify_ison_out));
+	/* only the current round's replies count, not the user's own
+	   /ison or a late answer to a round that timed out */
+	round = serv->notify_ison_pending > 0 && tag == serv->notify_ison_round;
+
+	while (*nicks)
 	{
-		notify = (struct notify *) list->data;
-		servnot = notify_find_server_entry (notify, serv);
-		if (!servnot)
-		{
-			list = list->next;
-			continue;
-		}
-		i = 4;
-		seen = FALSE;
-		while (*word[i])
+		end = strchr (nicks, ' ');
+		if (!end)
+			end = nicks + strlen (nicks);
+
+		if (end != nicks)
 		{
-			if (!serv->p_cmp (notify->name, word[i]))
-			{
-				seen = TRUE;
-				notify_announce_online (serv, servnot, notify->name, tags_data);
-				break;
-			}
-			i++;
-			/* FIXME: word[] is only a 32 element array, limits notify list to
-			   about 27 people */
-			if (i > PDIWORDS - 5)
+			g_strlcpy (nick, nicks, MIN (sizeof (nick), end - nicks + 1));
+			servnot = notify_find (serv, nick);
+			if (servnot)
 			{
-				/*fprintf (stderr, _("*** HEXCHAT WARNING: notify list too large.\n"));*/
-				break;
+				notify_announce_online (serv, servnot, servnot->notify->name, tags_data);
+				if (round)
+					g_hash_table_add (serv->notify_ison_seen, servnot);
 			}
 		}
-		if (!seen && servnot->ison)
+
+		nicks = *end ? end + 1 : end;
+	}
+
+	if (round && --serv->notify_ison_pending == 0)
+	{
+		/* the whole list is answered, whoever wasn't in it is gone */
+		g_hash_table_iter_init (&iter, notify_index (serv));
+		while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &servnot))
 		{
-			notify_announce_offline (serv, servnot, notify->name, FALSE, tags_data);
+			if (servnot->ison && !g_hash_table_contains (serv->notify_ison_seen, servnot))
+				offline = g_slist_prepend (offline, servnot);
 		}
-		list = list->next;
+		notify_ison_end (serv);
+
+		for (list = offline; list; list = list->next)
+		{
+			servnot = list->data;
+			notify_announce_offline (serv, servnot, servnot->notify->name, FALSE, tags_data);
+		}
+		g_slist_free (offline);
 	}
 	fe_notify_update (0);
 }
 
-/* yuck! Old routine for ISON notify */
+/* Old routine for ISON notify, for servers without WATCH or MONITOR.
+   The list goes out in as many ISONs as it takes to fit in 512 bytes. */
 
 static void
 notify_checklist_for_server (server *serv)
 {
-	char outbuf[512];
+	GString *outbuf;
 	struct notify *notify;
 	GSList *list = notify_list;
-	int i = 0;
+	int pending = 0;
+
+	if (serv->notify_ison_pending)
+	{
+		/* still waiting on the last one */
+		if (time (0) - serv->notify_ison_sent < NOTIFY_ISON_WAIT)
+			return;
+		notify_ison_end (serv);
+	}
+
+	serv->notify_ison_round++;
+	notify_ison_ours = TRUE;
 
-	strcpy (outbuf, "ISON ");
+	outbuf = g_string_new ("ISON");
 	while (list)
 	{
 		notify = list->data;
 		if (notify_do_network (notify, serv))
 		{
-			i++;
-			strcat (outbuf, notify->name);
-			strcat (outbuf, " ");
-			if (strlen (outbuf) > 460)
+			if (outbuf->len > 4 && outbuf->len + strlen (notify->name) + 1 > 460)
 			{
-				/* LAME: we can't send more than 512 bytes to the server, but     *
-				 * if we split it in two packets, our offline detection wouldn't  *
-				 work                                                           */
-				/*fprintf (stderr, _("*** HEXCHAT WARNING: notify list too large.\n"));*/
-				break;
+				serv->p_raw (serv, outbuf->str);
+				pending++;
+				g_string_assign (outbuf, "ISON");
 			}
+			g_string_append_c (outbuf, ' ');
+			g_string_append (outbuf, notify->name);
 		}
 		list = list->next;
 	}
 
-	if (i)
-		serv->p_raw (serv, outbuf);
+	if (outbuf->len > 4)
+	{
+		serv->p_raw (serv, outbuf->str);
+		pending++;
+	}
+	g_string_free (outbuf, TRUE);
+	notify_ison_ours = FALSE;
+
+	if (pending)
+	{
+		serv->notify_ison_pending = pending;
+		serv->notify_ison_sent = time (0);
+		serv->notify_ison_seen = g_hash_table_new (g_direct_hash, g_direct_equal);
+	}
 }
 
 int
@@ -595,6 +706,7 @@ notify_deluser (char *name)
 				g_free (servnot);
 			}
 			notify_list = g_slist_remove (notify_list, notify);
+			notify_generation++;
 			notify_watch_all (notify, FALSE);
 			g_free (notify->networks);
 			g_free (notify->name);
@@ -618,6 +730,7 @@ notify_adduser (char *name, char *networks)
 		notify->networks = despacify_dup (networks);
 	notify->server_list = 0;
 	notify_list = g_slist_prepend (notify_list, notify);
+	notify_generation++;
 	notify_checklist ();
 	fe_notify_update (notify->name);
 	fe_notify_update (0);
@@ -644,21 +757,11 @@ notify_is_in_list (server *serv, char *name)
 int
 notify_isnotify (struct session *sess, char *name)
 {
-	struct notify *notify;
 	struct notify_per_server *servnot;
-	GSList *list = notify_list;
 
-	while (list)
-	{
-		notify = (struct notify *) list->data;
-		if (!sess->server->p_cmp (notify->name, name))
-		{
-			servnot = notify_find_server_entry (notify, sess->server);
-			if (servnot && servnot->ison)
-				return TRUE;
-		}
-		list = list->next;
-	}
+	servnot = notify_find (sess->server, name);
+	if (servnot && servnot->ison)
+		return TRUE;
 
 	return FALSE;
 }
@@ -709,5 +812,6 @@ notify_cleanup ()
 		}
 		list = list->next;
 	}
+	notify_generation++;
 	fe_notify_update (0);
 }
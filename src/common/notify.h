@@ -63,10 +63,12 @@ void notify_save (void);
 void notify_showlist (session *sess, const message_tags_data *tags_data);
 gboolean notify_is_in_list (server *serv, char *name);
 int notify_isnotify (session *sess, char *name);
+void notify_index_reset (server *serv);
 struct notify_per_server *notify_find_server_entry (struct notify *notify, struct server *serv);
 
 /* the old ISON stuff - remove me? */
-void notify_markonline (server *serv, char *word[], 
+void notify_ison_queued (server *serv);
+void notify_markonline (server *serv, char *nicks,
 								const message_tags_data *tags_data);
 int notify_checklist (void);
 
@@ -47,6 +47,7 @@
 #include "notify.h"
 #include "inbound.h"
 #include "text.h"
+#include "logthread.h"
 #include "hexchatc.h"
 #include "servlist.h"
 #include "server.h"
@@ -884,6 +885,7 @@ cmd_debug (struct session *sess, char *tbuf, char *word[], char *word_eol[])
 	struct session *s;
 	struct server *v;
 	GSList *list = sess_list;
+	log_thread_stats stats;
 
 	PrintText (sess, "Session   T Channel    WaitChan  WillChan  Server\n");
 	while (list)
@@ -913,6 +915,18 @@ cmd_debug (struct session *sess, char *tbuf, char *word[], char *word_eol[])
 				sess->server->front_session, current_tab);
 	PrintText (sess, tbuf);
 
+	log_thread_get_stats (&stats);
+	sprintf (tbuf,
+				"Log writer: %s\n"
+				"  bytes queued/written: %" G_GUINT64_FORMAT "/%" G_GUINT64_FORMAT "\n"
+				"  pending: %lu (peak %lu)\n"
+				"  queue full: %u times, %" G_GINT64_FORMAT " ms waiting\n\n",
+				stats.running ? "thread" : "inline",
+				stats.bytes_queued, stats.bytes_written,
+				(unsigned long) stats.queue_bytes, (unsigned long) stats.queue_peak,
+				stats.stalls, stats.stall_usec / 1000);
+	PrintText (sess, tbuf);
+
 	return TRUE;
 }
 
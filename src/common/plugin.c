@@ -35,6 +35,7 @@
 #include "servlist.h"
 #include "modes.h"
 #include "notify.h"
+#include "bench.h"
 #include "text.h"
 #define PLUGIN_C
 typedef struct session hexchat_context;
@@ -53,7 +54,6 @@ typedef struct session hexchat_context;
 
 #define DEBUG(x) {x;}
 
-/* crafted to be an even 32 bytes */
 struct _hexchat_hook
 {
 	hexchat_plugin *pl;	/* the plugin to which it belongs */
@@ -64,6 +64,18 @@ struct _hexchat_hook
 	int tag;				/* for timers & FDs only */
 	int type;			/* HOOK_* */
 	int pri;	/* fd */	/* priority / fd for HOOK_FD only */
+	int order;			/* insertion order, newer hooks run first on equal pri */
+	GList *link;		/* our node in hook_list */
+	struct hook_bucket *bucket;	/* NULL for timers & fds */
+};
+
+/* all hooks of one group with the same (caseless) name, highest priority
+   first. plugin_hook_run only ever looks at these */
+struct hook_bucket
+{
+	char *name;
+	int group;			/* HOOK_GROUP_* */
+	GList *hooks;
 };
 
 struct _hexchat_list
@@ -111,6 +123,15 @@ enum
 	HOOK_DELETED      = 1 << 7  /* marked for deletion */
 };
 
+/* hook types that share a namespace, and so a hook_table */
+enum
+{
+	HOOK_GROUP_COMMAND,
+	HOOK_GROUP_SERVER,
+	HOOK_GROUP_PRINT,
+	HOOK_GROUPS
+};
+
 enum
 {
 	CHANNEL_FLAG_CONNECTED             = 1 << 0,
@@ -140,7 +161,11 @@ enum
 };
 
 GSList *plugin_list = NULL;	/* export for plugingui.c */
-static GSList *hook_list = NULL;
+static GList *hook_list = NULL;
+static GHashTable *hook_table[HOOK_GROUPS];	/* name -> struct hook_bucket */
+static GSList *hook_deleted = NULL;	/* unhooked, freed once no hook runs */
+static int hook_run_depth = 0;
+static int hook_order = 0;
 
 extern const struct prefs vars[];	/* cfgfiles.c */
 
@@ -150,7 +175,7 @@ extern const struct prefs vars[];	/* cfgfiles.c */
 static int
 plugin_free (hexchat_plugin *pl, int do_deinit, int allow_refuse)
 {
-	GSList *list, *next;
+	GList *list, *next;
 	hexchat_hook *hook;
 	hexchat_deinit_func *deinit_func;
 
@@ -500,27 +525,86 @@ plugin_reload (session *sess, char *name, int by_filename)
 
 #endif
 
-static GSList *
-plugin_hook_find (GSList *list, int type, char *name)
+static int
+plugin_hook_group (int type)
+{
+	if (type & HOOK_COMMAND)
+		return HOOK_GROUP_COMMAND;
+	if (type & (HOOK_SERVER | HOOK_SERVER_ATTRS))
+		return HOOK_GROUP_SERVER;
+	if (type & (HOOK_PRINT | HOOK_PRINT_ATTRS))
+		return HOOK_GROUP_PRINT;
+	return -1;
+}
+
+/* hook names are matched caselessly */
+static guint
+plugin_hook_hash (gconstpointer key)
 {
+	const char *p;
+	guint h = 5381;
+
+	for (p = key; *p; p++)
+		h = h * 33 + g_ascii_tolower (*p);
+
+	return h;
+}
+
+static gboolean
+plugin_hook_equal (gconstpointer a, gconstpointer b)
+{
+	return g_ascii_strcasecmp (a, b) == 0;
+}
+
+static struct hook_bucket *
+plugin_hook_bucket (int type, const char *name)
+{
+	int group = plugin_hook_group (type);
+
+	if (group < 0 || !hook_table[group] || !name)
+		return NULL;
+
+	return g_hash_table_lookup (hook_table[group], name);
+}
+
+/* does hook a run before hook b? */
+static gboolean
+plugin_hook_before (hexchat_hook *a, hexchat_hook *b)
+{
+	return a->pri > b->pri || (a->pri == b->pri && a->order > b->order);
+}
+
+/* really remove unhooked hooks, without walking hook_list */
+
+static void
+plugin_hook_purge (void)
+{
+	GSList *list;
 	hexchat_hook *hook;
+	struct hook_bucket *bucket;
 
-	while (list)
+	for (list = hook_deleted; list; list = list->next)
 	{
 		hook = list->data;
-		if (hook && (hook->type & type))
-		{
-			if (g_ascii_strcasecmp (hook->name, name) == 0)
-				return list;
+		hook_list = g_list_delete_link (hook_list, hook->link);
 
-			if ((type & HOOK_SERVER)
-				&& g_ascii_strcasecmp (hook->name, "RAW LINE") == 0)
-					return list;
+		bucket = hook->bucket;
+		if (bucket)
+		{
+			bucket->hooks = g_list_remove (bucket->hooks, hook);
+			if (!bucket->hooks)
+			{
+				g_hash_table_remove (hook_table[bucket->group], bucket->name);
+				g_free (bucket->name);
+				g_free (bucket);
+			}
 		}
-		list = list->next;
+
+		g_free (hook);
 	}
 
-	return NULL;
+	g_slist_free (hook_deleted);
+	hook_deleted = NULL;
 }
 
 /* check for plugin hooks and run them */
@@ -529,19 +613,47 @@ static int
 plugin_hook_run (session *sess, char *name, char *word[], char *word_eol[],
 				 hexchat_event_attrs *attrs, int type)
 {
-	GSList *list, *next;
+	struct hook_bucket *bucket, *raw = NULL;
+	GList *list, *raw_list;
 	hexchat_hook *hook;
 	int ret, eat = 0;
 
-	list = hook_list;
-	while (1)
+	BENCH_PUSH (BENCH_PLUGIN);
+
+	bucket = plugin_hook_bucket (type, name);
+	/* RAW LINE server hooks see every line, interleaved by priority */
+	if (type & HOOK_SERVER)
+		raw = plugin_hook_bucket (type, "RAW LINE");
+	if (raw == bucket)
+		raw = NULL;
+
+	list = bucket ? bucket->hooks : NULL;
+	raw_list = raw ? raw->hooks : NULL;
+	if (!list && !raw_list)
 	{
-		list = plugin_hook_find (list, type, name);
-		if (!list)
-			goto xit;
+		BENCH_POP ();
+		return 0;
+	}
+
+	/* unhooking only marks hooks as deleted while we walk the buckets */
+	hook_run_depth++;
+
+	while (list || raw_list)
+	{
+		if (!list || (raw_list && plugin_hook_before (raw_list->data, list->data)))
+		{
+			hook = raw_list->data;
+			raw_list = raw_list->next;
+		} else
+		{
+			hook = list->data;
+			list = list->next;
+		}
+
+		/* deleted, or a type the caller didn't ask for */
+		if (!(hook->type & type))
+			continue;
 
-		hook = list->data;
-		next = list->next;
 		hook->pl->context = sess;
 
 		/* run the plugin's callback function */
@@ -573,25 +685,14 @@ plugin_hook_run (session *sess, char *name, char *word[], char *word_eol[],
 			goto xit;	/* stop running plugins */
 		if (ret & HEXCHAT_EAT_HEXCHAT)
 			eat = 1;	/* eventually we'll return 1, but continue running plugins */
-
-		list = next;
 	}
 
 xit:
-	/* really remove deleted hooks now */
-	list = hook_list;
-	while (list)
-	{
-		hook = list->data;
-		next = list->next;
-		if (!hook || hook->type == HOOK_DELETED)
-		{
-			hook_list = g_slist_remove (hook_list, hook);
-			g_free (hook);
-		}
-		list = next;
-	}
+	hook_run_depth--;
+	if (hook_run_depth == 0)
+		plugin_hook_purge ();
 
+	BENCH_POP ();
 	return eat;
 }
 
@@ -700,7 +801,7 @@ plugin_timeout_cb (hexchat_hook *hook)
 	ret = ((hexchat_timer_cb *)hook->callback) (hook->userdata);
 
 	/* the callback might have already unhooked it! */
-	if (!g_slist_find (hook_list, hook) || hook->type == HOOK_DELETED)
+	if (!g_list_find (hook_list, hook) || hook->type == HOOK_DELETED)
 		return 0;
 
 	if (ret == 0)
@@ -712,14 +813,17 @@ plugin_timeout_cb (hexchat_hook *hook)
 	return ret;
 }
 
-/* insert a hook into hook_list according to its priority */
+/* insert a hook into hook_list and its bucket according to its priority */
 
 static void
 plugin_insert_hook (hexchat_hook *new_hook)
 {
-	GSList *list;
+	GList *list;
 	hexchat_hook *hook;
-	int new_hook_type;
+	struct hook_bucket *bucket;
+	int new_hook_type, group;
+
+	new_hook->order = ++hook_order;
  
 	switch (new_hook->type)
 	{
@@ -740,14 +844,34 @@ plugin_insert_hook (hexchat_hook *new_hook)
 	{
 		hook = list->data;
 		if (hook && (hook->type & new_hook_type) && hook->pri <= new_hook->pri)
-		{
-			hook_list = g_slist_insert_before (hook_list, list, new_hook);
-			return;
-		}
+			break;
 		list = list->next;
 	}
 
-	hook_list = g_slist_append (hook_list, new_hook);
+	hook_list = g_list_insert_before (hook_list, list, new_hook);
+	new_hook->link = list ? list->prev : g_list_last (hook_list);
+
+	group = plugin_hook_group (new_hook->type);
+	if (group < 0 || !new_hook->name)
+		return;
+
+	if (!hook_table[group])
+		hook_table[group] = g_hash_table_new (plugin_hook_hash, plugin_hook_equal);
+
+	bucket = g_hash_table_lookup (hook_table[group], new_hook->name);
+	if (!bucket)
+	{
+		bucket = g_new0 (struct hook_bucket, 1);
+		bucket->name = g_strdup (new_hook->name);
+		bucket->group = group;
+		g_hash_table_insert (hook_table[group], bucket->name, bucket);
+	}
+
+	list = bucket->hooks;
+	while (list && plugin_hook_before (list->data, new_hook))
+		list = list->next;
+	bucket->hooks = g_list_insert_before (bucket->hooks, list, new_hook);
+	new_hook->bucket = bucket;
 }
 
 static gboolean
@@ -766,7 +890,7 @@ plugin_fd_cb (GIOChannel *source, GIOCondition condition, hexchat_hook *hook)
 	ret = ((hexchat_fd_cb2 *)hook->callback) (hook->pri, flags, hook->userdata, source);
 
 	/* the callback might have already unhooked it! */
-	if (!g_slist_find (hook_list, hook) || hook->type == HOOK_DELETED)
+	if (!g_list_find (hook_list, hook) || hook->type == HOOK_DELETED)
 		return 0;
 
 	if (ret == 0)
@@ -808,7 +932,7 @@ GList *
 plugin_command_list(GList *tmp_list)
 {
 	hexchat_hook *hook;
-	GSList *list = hook_list;
+	GList *list = hook_list;
 
 	while (list)
 	{
@@ -824,7 +948,7 @@ void
 plugin_command_foreach (session *sess, void *userdata,
 			void (*cb) (session *sess, void *userdata, char *name, char *help))
 {
-	GSList *list;
+	GList *list;
 	hexchat_hook *hook;
 
 	list = hook_list;
@@ -842,18 +966,22 @@ plugin_command_foreach (session *sess, void *userdata,
 int
 plugin_show_help (session *sess, char *cmd)
 {
-	GSList *list;
+	struct hook_bucket *bucket;
+	GList *list;
 	hexchat_hook *hook;
 
-	list = plugin_hook_find (hook_list, HOOK_COMMAND, cmd);
-	if (list)
+	bucket = plugin_hook_bucket (HOOK_COMMAND, cmd);
+	for (list = bucket ? bucket->hooks : NULL; list; list = list->next)
 	{
 		hook = list->data;
+		if (hook->type != HOOK_COMMAND)
+			continue;
 		if (hook->help_text)
 		{
 			PrintText (sess, hook->help_text);
 			return 1;
 		}
+		break;
 	}
 
 	return 0;
@@ -927,8 +1055,10 @@ plugin_find_context (const char *servname, const char *channel, server *current_
 void *
 hexchat_unhook (hexchat_plugin *ph, hexchat_hook *hook)
 {
+	void *userdata;
+
 	/* perl.c trips this */
-	if (!g_slist_find (hook_list, hook) || hook->type == HOOK_DELETED)
+	if (!g_list_find (hook_list, hook) || hook->type == HOOK_DELETED)
 		return NULL;
 
 	if (hook->type == HOOK_TIMER && hook->tag != 0)
@@ -938,11 +1068,17 @@ hexchat_unhook (hexchat_plugin *ph, hexchat_hook *hook)
 		fe_input_remove (hook->tag);
 
 	hook->type = HOOK_DELETED;	/* expunge later */
+	hook_deleted = g_slist_prepend (hook_deleted, hook);
 
 	g_free (hook->name);	/* NULL for timers & fds */
 	g_free (hook->help_text);	/* NULL for non-commands */
 
-	return hook->userdata;
+	/* only a running plugin_hook_run() can still be walking it */
+	userdata = hook->userdata;
+	if (hook_run_depth == 0)
+		plugin_hook_purge ();
+
+	return userdata;
 }
 
 hexchat_hook *
@@ -31,8 +31,6 @@
 #define WANTARPA
 #include "inet.h"
 
-#include <signal.h>
-#include <sys/wait.h>
 #include <unistd.h>
 
 #include "hexchat.h"
@@ -49,6 +47,7 @@
 #include "proto-irc.h"
 #include "servlist.h"
 #include "server.h"
+#include "bench.h"
 
 #ifdef USE_OPENSSL
 #include <openssl/ssl.h>		  /* SSL_() */
@@ -68,6 +67,7 @@ static void auto_reconnect (server *serv, int send_quit, int err);
 static void server_disconnect (session * sess, int sendquit, int err);
 static int server_cleanup (server * serv);
 static void server_connect (server *serv, char *hostname, int port, int no_login);
+static void connect_state_drop (struct connect_state *st);
 
 static void
 write_error (char *message, GError **error)
@@ -181,6 +181,9 @@ tcp_send_len (server *serv, char *buf, int len)
 	char *dbuf;
 	int noqueue = !serv->outbound_queue;
 
+	if (g_ascii_strncasecmp (buf, "ISON ", 5) == 0)
+		notify_ison_queued (serv);
+
 	if (!prefs.hex_net_throttle)
 		return server_send_real (serv, buf, len);
 
@@ -273,10 +276,13 @@ close_socket (int sok)
 
 /* handle 1 line of text received from the server */
 
-static void
+void
 server_inline (server *serv, char *line, gssize len)
 {
 	gsize len_utf8;
+
+	BENCH_PUSH (BENCH_PARSE);
+
 	if (!strcmp (serv->encoding, "UTF-8"))
 		line = text_fixup_invalid_utf8 (line, len, &len_utf8);
 	else
@@ -288,6 +294,86 @@ server_inline (server *serv, char *line, gssize len)
 	serv->p_inline (serv, line, len_utf8);
 
 	g_free (line);
+
+	BENCH_POP ();
+}
+
+/* The receive buffer starts out with room for a couple of maximum-sized
+   lines (512 bytes plus 8191 bytes of IRCv3 message tags) and only grows
+   when a server sends something longer than that. */
+
+#define LINEBUF_INITIAL_SIZE	16384
+#define LINEBUF_MIN_READ		4096		/* compact or grow when less is free */
+#define LINEBUF_MAX_SIZE		(1024 * 1024)
+
+/* make room for at least LINEBUF_MIN_READ bytes after linebuf_end.
+   Returns FALSE if a single line has outgrown LINEBUF_MAX_SIZE. */
+
+static gboolean
+server_linebuf_reserve (server *serv)
+{
+	gsize pending;
+
+	if (!serv->linebuf)
+	{
+		serv->linebuf_size = LINEBUF_INITIAL_SIZE;
+		serv->linebuf = g_malloc (serv->linebuf_size);
+		serv->linebuf_start = serv->linebuf_end = 0;
+	}
+
+	if (serv->linebuf_size - serv->linebuf_end >= LINEBUF_MIN_READ)
+		return TRUE;
+
+	/* move the incomplete line (if any) to the front */
+	pending = serv->linebuf_end - serv->linebuf_start;
+	if (serv->linebuf_start > 0)
+	{
+		memmove (serv->linebuf, serv->linebuf + serv->linebuf_start, pending);
+		serv->linebuf_start = 0;
+		serv->linebuf_end = pending;
+		if (serv->linebuf_size - pending >= LINEBUF_MIN_READ)
+			return TRUE;
+	}
+
+	/* one line fills the whole buffer */
+	if (serv->linebuf_size >= LINEBUF_MAX_SIZE)
+		return FALSE;
+
+	serv->linebuf_size *= 2;
+	serv->linebuf = g_realloc (serv->linebuf, serv->linebuf_size);
+	return TRUE;
+}
+
+static void
+server_linebuf_reset (server *serv)
+{
+	serv->linebuf_start = serv->linebuf_end = 0;
+	serv->linebuf_discard = FALSE;
+
+	/* give back what an overlong line made us allocate */
+	if (serv->linebuf_size > LINEBUF_INITIAL_SIZE)
+	{
+		g_clear_pointer (&serv->linebuf, g_free);
+		serv->linebuf_size = 0;
+	}
+}
+
+/* remove stray CRs from a NUL terminated line, starting at the first one */
+
+static gsize
+strip_cr (char *line, char *cr, gsize len)
+{
+	char *end = line + len;
+	char *dst = cr;
+
+	for (; cr < end; cr++)
+	{
+		if (*cr != '\r')
+			*dst++ = *cr;
+	}
+	*dst = 0;
+
+	return dst - line;
 }
 
 /* read data from socket */
@@ -296,18 +382,33 @@ static gboolean
 server_read (GIOChannel *source, GIOCondition condition, server *serv)
 {
 	int sok = serv->sok;
-	int error, i, len;
-	char lbuf[2050];
+	int error, len;
+	char *line, *eol, *cr;
+	gsize line_len, scan;
 
 	while (1)
 	{
+		if (!server_linebuf_reserve (serv))
+		{
+			fprintf (stderr,
+						"*** HEXCHAT WARNING: Buffer overflow - non-compliant server!\n");
+			/* throw away the overlong line, up to its end */
+			serv->linebuf_start = serv->linebuf_end = 0;
+			serv->linebuf_discard = TRUE;
+		}
+
+		/* what's already pending holds no \n, only look at the new data */
+		scan = serv->linebuf_end;
+
 #ifdef USE_OPENSSL
 		if (!serv->ssl)
 #endif
-			len = recv (sok, lbuf, sizeof (lbuf) - 2, 0);
+			len = recv (sok, serv->linebuf + serv->linebuf_end,
+							serv->linebuf_size - serv->linebuf_end, 0);
 #ifdef USE_OPENSSL
 		else
-			len = _SSL_recv (serv->ssl, lbuf, sizeof (lbuf) - 2);
+			len = _SSL_recv (serv->ssl, serv->linebuf + serv->linebuf_end,
+								  serv->linebuf_size - serv->linebuf_end);
 #endif
 		if (len < 1)
 		{
@@ -336,33 +437,37 @@ server_read (GIOChannel *source, GIOCondition condition, server *serv)
 			return TRUE;
 		}
 
-		i = 0;
+		serv->linebuf_end += len;
 
-		lbuf[len] = 0;
-
-		while (i < len)
+		/* hand every complete line to server_inline straight from the buffer */
+		while ((eol = memchr (serv->linebuf + scan, '\n', serv->linebuf_end - scan)))
 		{
-			switch (lbuf[i])
+			line = serv->linebuf + serv->linebuf_start;
+			serv->linebuf_start = scan = eol - serv->linebuf + 1;
+
+			if (serv->linebuf_discard)
 			{
-			case '\r':
-				break;
+				serv->linebuf_discard = FALSE;
+				continue;
+			}
 
-			case '\n':
-				serv->linebuf[serv->pos] = 0;
-				server_inline (serv, serv->linebuf, serv->pos);
-				serv->pos = 0;
-				break;
+			*eol = 0;
+			line_len = eol - line;
 
-			default:
-				serv->linebuf[serv->pos] = lbuf[i];
-				if (serv->pos >= (sizeof (serv->linebuf) - 1))
-					fprintf (stderr,
-								"*** HEXCHAT WARNING: Buffer overflow - non-compliant server!\n");
-				else
-					serv->pos++;
-			}
-			i++;
+			/* CRs are ignored wherever they are, usually it's just the one before \n */
+			cr = memchr (line, '\r', line_len);
+			if (cr)
+				line_len = strip_cr (line, cr, line_len);
+
+			server_inline (serv, line, line_len);
+
+			/* the line might have made us disconnect (or reconnect) */
+			if (!serv->connected)
+				return TRUE;
 		}
+
+		if (serv->linebuf_start == serv->linebuf_end)
+			serv->linebuf_start = serv->linebuf_end = 0;
 	}
 }
 
@@ -419,12 +524,12 @@ server_stopconnecting (server * serv)
 		serv->joindelay_tag = 0;
 	}
 
-	/* kill the child process trying to connect */
-	kill (serv->childpid, SIGKILL);
-	waitpid (serv->childpid, NULL, 0);
-
-	close (serv->childwrite);
-	close (serv->childread);
+	/* abandon the connection attempt */
+	if (serv->conn)
+	{
+		connect_state_drop (serv->conn);
+		serv->conn = NULL;
+	}
 
 #ifdef USE_OPENSSL
 	if (serv->ssl_do_connect_tag)
@@ -761,125 +866,6 @@ server_connect_success (server *serv)
 	server_connected (serv);
 }
 
-/* receive info from the child-process about connection progress */
-
-static gboolean
-server_read_child (GIOChannel *source, GIOCondition condition, server *serv)
-{
-	session *sess = serv->server_session;
-	char tbuf[128];
-	char outbuf[512];
-	char host[100];
-	char ip[100];
-
-	waitline2 (source, tbuf, sizeof tbuf);
-
-	switch (tbuf[0])
-	{
-	case '0':	/* print some text */
-		waitline2 (source, tbuf, sizeof tbuf);
-		PrintText (serv->server_session, tbuf);
-		break;
-	case '1':						  /* unknown host */
-		server_stopconnecting (serv);
-		closesocket (serv->sok4);
-		if (serv->proxy_sok4 != -1)
-			closesocket (serv->proxy_sok4);
-		if (serv->sok6 != -1)
-			closesocket (serv->sok6);
-		if (serv->proxy_sok6 != -1)
-			closesocket (serv->proxy_sok6);
-		EMIT_SIGNAL (XP_TE_UKNHOST, sess, NULL, NULL, NULL, NULL, 0);
-		if (!servlist_cycle (serv))
-			if (prefs.hex_net_auto_reconnectonfail)
-				auto_reconnect (serv, FALSE, -1);
-		break;
-	case '2':						  /* connection failed */
-		waitline2 (source, tbuf, sizeof tbuf);
-		server_stopconnecting (serv);
-		closesocket (serv->sok4);
-		if (serv->proxy_sok4 != -1)
-			closesocket (serv->proxy_sok4);
-		if (serv->sok6 != -1)
-			closesocket (serv->sok6);
-		if (serv->proxy_sok6 != -1)
-			closesocket (serv->proxy_sok6);
-		EMIT_SIGNAL (XP_TE_CONNFAIL, sess, errorstring (atoi (tbuf)), NULL,
-						 NULL, NULL, 0);
-		if (!servlist_cycle (serv))
-			if (prefs.hex_net_auto_reconnectonfail)
-				auto_reconnect (serv, FALSE, -1);
-		break;
-	case '3':						  /* gethostbyname finished */
-		waitline2 (source, host, sizeof host);
-		waitline2 (source, ip, sizeof ip);
-		waitline2 (source, outbuf, sizeof outbuf);
-		EMIT_SIGNAL (XP_TE_CONNECT, sess, host, ip, outbuf, NULL, 0);
-		break;
-	case '4':						  /* success */
-		waitline2 (source, tbuf, sizeof (tbuf));
-		serv->sok = atoi (tbuf);
-		/* close the one we didn't end up using */
-		if (serv->sok == serv->sok4)
-			closesocket (serv->sok6);
-		else
-			closesocket (serv->sok4);
-		if (serv->proxy_sok != -1)
-		{
-			if (serv->proxy_sok == serv->proxy_sok4)
-				closesocket (serv->proxy_sok6);
-			else
-				closesocket (serv->proxy_sok4);
-		}
-
-		{
-			struct sockaddr_storage addr;
-			int addr_len = sizeof (addr);
-			guint16 port;
-			ircnet *net = serv->network;
-
-			if (!getsockname (serv->sok, (struct sockaddr *)&addr, &addr_len))
-			{
-				if (addr.ss_family == AF_INET)
-					port = ntohs(((struct sockaddr_in *)&addr)->sin_port);
-				else
-					port = ntohs(((struct sockaddr_in6 *)&addr)->sin6_port);
-
-				g_snprintf (outbuf, sizeof (outbuf), "IDENTD %"G_GUINT16_FORMAT" ", port);
-				if (net && net->user && !(net->flags & FLAG_USE_GLOBAL))
-					g_strlcat (outbuf, net->user, sizeof (outbuf));
-				else
-					g_strlcat (outbuf, prefs.hex_irc_user_name, sizeof (outbuf));
-
-				handle_command (serv->server_session, outbuf, FALSE);
-			}
-		}
-
-		server_connect_success (serv);
-		break;
-	case '5':						  /* prefs ip discovered */
-		waitline2 (source, tbuf, sizeof tbuf);
-		prefs.local_ip = inet_addr (tbuf);
-		break;
-	case '7':						  /* gethostbyname (prefs.hex_net_bind_host) failed */
-		sprintf (outbuf,
-					_("Cannot resolve hostname %s\nCheck your IP Settings!\n"),
-					prefs.hex_net_bind_host);
-		PrintText (sess, outbuf);
-		break;
-	case '8':
-		PrintText (sess, _("Proxy traversal failed.\n"));
-		server_disconnect (sess, FALSE, -1);
-		break;
-	case '9':
-		waitline2 (source, tbuf, sizeof tbuf);
-		EMIT_SIGNAL (XP_TE_SERVERLOOKUP, sess, tbuf, NULL, NULL, NULL, 0);
-		break;
-	}
-
-	return TRUE;
-}
-
 /* kill all sockets & iotags of a server. Stop a connection attempt, or
    disconnect if already connected. */
 
@@ -912,21 +898,12 @@ server_cleanup (server * serv)
 	if (serv->connecting)
 	{
 		server_stopconnecting (serv);
-		closesocket (serv->sok4);
-		if (serv->proxy_sok4 != -1)
-			closesocket (serv->proxy_sok4);
-		if (serv->sok6 != -1)
-			closesocket (serv->sok6);
-		if (serv->proxy_sok6 != -1)
-			closesocket (serv->proxy_sok6);
 		return 1;
 	}
 
 	if (serv->connected)
 	{
 		close_socket (serv->sok);
-		if (serv->proxy_sok)
-			close_socket (serv->proxy_sok);
 		serv->connected = FALSE;
 		serv->end_of_motd = FALSE;
 		return 2;
@@ -948,7 +925,6 @@ server_disconnect (session * sess, int sendquit, int err)
 {
 	server *serv = sess->server;
 	GSList *list;
-	char tbuf[64];
 	gboolean shutup = FALSE;
 
 	/* send our QUIT reason */
@@ -966,8 +942,7 @@ server_disconnect (session * sess, int sendquit, int err)
 		notc_msg (sess);
 		return;
 	case 1:							  /* it was in the process of connecting */
-		sprintf (tbuf, "%d", sess->server->childpid);
-		EMIT_SIGNAL (XP_TE_STOPCONNECT, sess, tbuf, NULL, NULL, NULL, 0);
+		EMIT_SIGNAL (XP_TE_STOPCONNECT, sess, serv->hostname, NULL, NULL, NULL, 0);
 		return;
 	case 3:
 		shutup = TRUE;	/* won't print "disconnected" in channels */
@@ -991,202 +966,16 @@ server_disconnect (session * sess, int sendquit, int err)
 		list = list->next;
 	}
 
-	serv->pos = 0;
+	server_linebuf_reset (serv);
 	serv->motd_skipped = FALSE;
 	serv->no_login = FALSE;
 	serv->servername[0] = 0;
 	serv->lag_sent = 0;
 
+	notify_index_reset (serv);
 	notify_cleanup ();
 }
 
-/* send a "print text" command to the parent process - MUST END IN \n! */
-
-static void
-proxy_error (int fd, char *msg)
-{
-	write (fd, "0\n", 2);
-	write (fd, msg, strlen (msg));
-}
-
-struct sock_connect
-{
-	char version;
-	char type;
-	guint16 port;
-	guint32 address;
-	char username[10];
-};
-
-/* traverse_socks() returns:
- *				0 success                *
- *          1 socks traversal failed */
-
-static int
-traverse_socks (int print_fd, int sok, char *serverAddr, int port)
-{
-	struct sock_connect sc;
-	unsigned char buf[256];
-
-	sc.version = 4;
-	sc.type = 1;
-	sc.port = htons (port);
-	sc.address = inet_addr (serverAddr);
-	g_strlcpy (sc.username, prefs.hex_irc_user_name, sizeof (sc.username));
-
-	send (sok, (char *) &sc, 8 + strlen (sc.username) + 1, 0);
-	buf[1] = 0;
-	recv (sok, buf, 10, 0);
-	if (buf[1] == 90)
-		return 0;
-
-	g_snprintf (buf, sizeof (buf), "SOCKS\tServer reported error %d,%d.\n", buf[0], buf[1]);
-	proxy_error (print_fd, buf);
-	return 1;
-}
-
-struct sock5_connect1
-{
-	char version;
-	char nmethods;
-	char method;
-};
-
-static int
-traverse_socks5 (int print_fd, int sok, char *serverAddr, int port)
-{
-	struct sock5_connect1 sc1;
-	unsigned char *sc2;
-	unsigned int packetlen, addrlen;
-	unsigned char buf[260];
-	int auth = prefs.hex_net_proxy_auth && prefs.hex_net_proxy_user[0] && prefs.hex_net_proxy_pass[0];
-
-	sc1.version = 5;
-	sc1.nmethods = 1;
-	if (auth)
-		sc1.method = 2;  /* Username/Password Authentication (UPA) */
-	else
-		sc1.method = 0;  /* NO Authentication */
-	send (sok, (char *) &sc1, 3, 0);
-	if (recv (sok, buf, 2, 0) != 2)
-		goto read_error;
-
-	if (buf[0] != 5)
-	{
-		proxy_error (print_fd, "SOCKS\tServer is not socks version 5.\n");
-		return 1;
-	}
-
-	/* did the server say no auth required? */
-	if (buf[1] == 0)
-		auth = 0;
-
-	if (auth)
-	{
-		int len_u=0, len_p=0;
-		unsigned char *u_p_buf;
-
-		/* authentication sub-negotiation (RFC1929) */
-		if (buf[1] != 2)  /* UPA not supported by server */
-		{
-			proxy_error (print_fd, "SOCKS\tServer doesn't support UPA authentication.\n");
-			return 1;
-		}
-
-		/* form the UPA request */
-		len_u = strlen (prefs.hex_net_proxy_user);
-		len_p = strlen (prefs.hex_net_proxy_pass);
-
-        packetlen = 2 + len_u + 1 + len_p;
-		u_p_buf = g_malloc0 (packetlen);
-
-		u_p_buf[0] = 1;
-		u_p_buf[1] = len_u;
-		memcpy (u_p_buf + 2, prefs.hex_net_proxy_user, len_u);
-		u_p_buf[2 + len_u] = len_p;
-		memcpy (u_p_buf + 3 + len_u, prefs.hex_net_proxy_pass, len_p);
-
-		send (sok, u_p_buf, packetlen, 0);
-		g_free(u_p_buf);
-
-		if ( recv (sok, buf, 2, 0) != 2 )
-			goto read_error;
-		if ( buf[1] != 0 )
-		{
-			proxy_error (print_fd, "SOCKS\tAuthentication failed. "
-							 "Is username and password correct?\n");
-			return 1; /* UPA failed! */
-		}
-	}
-	else
-	{
-		if (buf[1] != 0)
-		{
-			proxy_error (print_fd, "SOCKS\tAuthentication required but disabled in settings.\n");
-			return 1;
-		}
-	}
-
-	addrlen = strlen (serverAddr);
-	packetlen = 4 + 1 + addrlen + 2;
-	sc2 = g_malloc (packetlen);
-	sc2[0] = 5;						  /* version */
-	sc2[1] = 1;						  /* command */
-	sc2[2] = 0;						  /* reserved */
-	sc2[3] = 3;						  /* address type */
-	sc2[4] = (unsigned char) addrlen;	/* hostname length */
-	memcpy (sc2 + 5, serverAddr, addrlen);
-	*((unsigned short *) (sc2 + 5 + addrlen)) = htons (port);
-	send (sok, sc2, packetlen, 0);
-	g_free (sc2);
-
-	/* consume all of the reply */
-	if (recv (sok, buf, 4, 0) != 4)
-		goto read_error;
-	if (buf[0] != 5 || buf[1] != 0)
-	{
-		if (buf[1] == 2)
-			g_snprintf (buf, sizeof (buf), "SOCKS\tProxy refused to connect to host (not allowed).\n");
-		else
-			g_snprintf (buf, sizeof (buf), "SOCKS\tProxy failed to connect to host (error %d).\n", buf[1]);
-		proxy_error (print_fd, buf);
-		return 1;
-	}
-	if (buf[3] == 1)	/* IPV4 32bit address */
-	{
-		if (recv (sok, buf, 6, 0) != 6)
-			goto read_error;
-	} else if (buf[3] == 4)	/* IPV6 128bit address */
-	{
-		if (recv (sok, buf, 18, 0) != 18)
-			goto read_error;
-	} else if (buf[3] == 3)	/* string, 1st byte is size */
-	{
-		if (recv (sok, buf, 1, 0) != 1)	/* read the string size */
-			goto read_error;
-		packetlen = buf[0] + 2;	/* can't exceed 260 */
-		if (recv (sok, buf, packetlen, 0) != packetlen)
-			goto read_error;
-	}
-
-	return 0;	/* success */
-
-read_error:
-	proxy_error (print_fd, "SOCKS\tRead error from server.\n");
-	return 1;
-}
-
-static int
-traverse_wingate (int print_fd, int sok, char *serverAddr, int port)
-{
-	char buf[128];
-
-	g_snprintf (buf, sizeof (buf), "%s %d\r\n", serverAddr, port);
-	send (sok, buf, strlen (buf), 0);
-
-	return 0;
-}
-
 /* stuff for HTTP auth is here */
 
 static void
@@ -1238,271 +1027,903 @@ base64_encode (char *to, char *from, unsigned int len)
 	to[0] = 0;
 }
 
-static int
-http_read_line (int print_fd, int sok, char *buf, int len)
+/* The connection attempt runs in this process: the bind host, proxy and
+   server names are looked up with GResolver (which does the blocking part
+   on glib's own threads), then every address is tried with a non-blocking
+   connect, a new one starting every CONNECT_ATTEMPT_DELAY ms while the
+   older ones are still pending, alternating IPv6 and IPv4 (RFC 8305).
+   The first one to connect wins. Any proxy is then traversed from the
+   main loop too. */
+
+#define CONNECT_ATTEMPT_DELAY 250	/* ms */
+
+struct connect_try
 {
-	len = waitline (sok, buf, len, TRUE);
-	if (len >= 1)
-	{
-		/* print the message out (send it to the parent process) */
-		write (print_fd, "0\n", 2);
+	struct connect_state *st;
+	int sok;
+	int tag;
+};
 
-		if (buf[len-1] == '\r')
-		{
-			buf[len-1] = '\n';
-			write (print_fd, buf, len);
-		} else
-		{
-			write (print_fd, buf, len);
-			write (print_fd, "\n", 1);
-		}
-	}
+struct connect_state
+{
+	server *serv;					/* NULL once the attempt is abandoned */
+	GCancellable *cancel;
+	gboolean lookup_pending;	/* a GResolver callback still owns us */
 
-	return len;
-}
+	int proxy_type;
+	char *proxy_host;
+	int proxy_port;
+	char *target;					/* what we ask the proxy to connect to */
 
-static int
-traverse_http (int print_fd, int sok, char *serverAddr, int port)
+	struct sockaddr_storage bind_addr;
+	int bind_len;
+
+	GList *addrs;					/* GInetAddress *, in the order to try */
+	GList *next;
+	int connect_port;
+	GSList *tries;					/* struct connect_try *, still connecting */
+	int delay_tag;
+	int error;						/* from the last attempt that failed */
+
+	/* proxy traversal, once connected */
+	int sok;
+	int proxy_tag;
+	int phase;
+	GString *proxy_buf;
+};
+
+static void connect_lookup (struct connect_state *st);
+static void connect_next (struct connect_state *st);
+
+static void
+connect_tries_close (struct connect_state *st)
 {
-	char buf[512];
-	char auth_data[256];
-	char auth_data2[252];
-	int n, n2;
+	GSList *list;
+	struct connect_try *try;
 
-	n = g_snprintf (buf, sizeof (buf), "CONNECT %s:%d HTTP/1.0\r\n",
-					  serverAddr, port);
-	if (prefs.hex_net_proxy_auth)
+	for (list = st->tries; list; list = list->next)
 	{
-		n2 = g_snprintf (auth_data2, sizeof (auth_data2), "%s:%s",
-							prefs.hex_net_proxy_user, prefs.hex_net_proxy_pass);
-		base64_encode (auth_data, auth_data2, n2);
-		n += g_snprintf (buf+n, sizeof (buf)-n, "Proxy-Authorization: Basic %s\r\n", auth_data);
+		try = list->data;
+		fe_input_remove (try->tag);
+		closesocket (try->sok);
+		g_free (try);
 	}
-	n += g_snprintf (buf+n, sizeof (buf)-n, "\r\n");
-	send (sok, buf, n, 0);
+	g_slist_free (st->tries);
+	st->tries = NULL;
 
-	n = http_read_line (print_fd, sok, buf, sizeof (buf));
-	/* "HTTP/1.0 200 OK" */
-	if (n < 12)
-		return 1;
-	if (memcmp (buf, "HTTP/", 5) || memcmp (buf + 9, "200", 3))
-		return 1;
-	while (1)
+	if (st->delay_tag)
 	{
-		/* read until blank line */
-		n = http_read_line (print_fd, sok, buf, sizeof (buf));
-		if (n < 1 || (n == 1 && buf[0] == '\n'))
-			break;
+		fe_timeout_remove (st->delay_tag);
+		st->delay_tag = 0;
 	}
-	return 0;
 }
 
-static int
-traverse_proxy (int proxy_type, int print_fd, int sok, char *ip, int port, netstore *ns_proxy, int csok4, int csok6, int *csok, char bound)
+static void
+connect_state_free (struct connect_state *st)
 {
-	switch (proxy_type)
-	{
-	case 1:
-		return traverse_wingate (print_fd, sok, ip, port);
-	case 2:
-		return traverse_socks (print_fd, sok, ip, port);
-	case 3:
-		return traverse_socks5 (print_fd, sok, ip, port);
-	case 4:
-		return traverse_http (print_fd, sok, ip, port);
-	}
-
-	return 1;
+	connect_tries_close (st);
+
+	if (st->proxy_tag)
+		fe_input_remove (st->proxy_tag);
+	if (st->sok != -1)
+		closesocket (st->sok);
+	if (st->proxy_buf)
+		g_string_free (st->proxy_buf, TRUE);
+
+	g_list_free_full (st->addrs, g_object_unref);
+	g_object_unref (st->cancel);
+	g_free (st->proxy_host);
+	g_free (st->target);
+	g_free (st);
 }
 
-/* this is the child process making the connection attempt */
-
-static int
-server_child (server * serv)
-{
-	netstore *ns_server;
-	netstore *ns_proxy = NULL;
-	netstore *ns_local;
-	int port = serv->port;
-	int error;
-	int sok, psok;
-	char *hostname = serv->hostname;
-	char *real_hostname = NULL;
-	char *ip;
-	char *proxy_ip = NULL;
-	char *local_ip;
-	int connect_port;
-	char buf[512];
-	char bound = 0;
-	int proxy_type = 0;
-	char *proxy_host = NULL;
-	int proxy_port;
+/* detach a connection attempt from its server. A lookup in progress is
+   cancelled, its callback frees the state. */
 
-	ns_server = net_store_new ();
+static void
+connect_state_drop (struct connect_state *st)
+{
+	st->serv = NULL;
 
-	/* is a hostname set? - bind to it */
-	if (prefs.hex_net_bind_host[0])
-	{
-		ns_local = net_store_new ();
-		local_ip = net_resolve (ns_local, prefs.hex_net_bind_host, 0, &real_hostname);
-		if (local_ip != NULL)
-		{
-			g_snprintf (buf, sizeof (buf), "5\n%s\n", local_ip);
-			write (serv->childwrite, buf, strlen (buf));
-			net_bind (ns_local, serv->sok4, serv->sok6);
-			bound = 1;
-		} else
-		{
-			write (serv->childwrite, "7\n", 2);
-		}
-		net_store_destroy (ns_local);
-	}
+	if (st->lookup_pending)
+		g_cancellable_cancel (st->cancel);
+	else
+		connect_state_free (st);
+}
 
-	if (!serv->dont_use_proxy) /* blocked in serverlist? */
-	{
-		if (prefs.hex_net_proxy_type == 5)
-		{
-			char **proxy_list;
-			char *url, *proxy;
-			GProxyResolver *resolver;
-			GError *error = NULL;
-
-			resolver = g_proxy_resolver_get_default ();
-			url = g_strdup_printf ("irc://%s:%d", hostname, port);
-			proxy_list = g_proxy_resolver_lookup (resolver, url, NULL, &error);
-
-			if (proxy_list) {
-				/* can use only one */
-				proxy = proxy_list[0];
-				if (!strncmp (proxy, "direct", 6))
-					proxy_type = 0;
-				else if (!strncmp (proxy, "http", 4))
-					proxy_type = 4;
-				else if (!strncmp (proxy, "socks5", 6))
-					proxy_type = 3;
-				else if (!strncmp (proxy, "socks", 5))
-					proxy_type = 2;
-			} else {
-				write_error ("Failed to lookup proxy", &error);
-			}
+/* the state is still ours after an event that could have run a plugin? */
 
-			if (proxy_type) {
-				char *c;
-				c = strchr (proxy, ':') + 3;
-				proxy_host = g_strdup (c);
-				c = strchr (proxy_host, ':');
-				*c = '\0';
-				proxy_port = atoi (c + 1);
-			}
+static gboolean
+connect_state_valid (server *serv, struct connect_state *st)
+{
+	return is_server (serv) && serv->connecting && serv->conn == st;
+}
 
-			g_strfreev (proxy_list);
-			g_free (url);
-		}
+static void
+connect_unknown_host (server *serv)
+{
+	server_stopconnecting (serv);
+	EMIT_SIGNAL (XP_TE_UKNHOST, serv->server_session, NULL, NULL, NULL, NULL, 0);
+	if (!servlist_cycle (serv))
+		if (prefs.hex_net_auto_reconnectonfail)
+			auto_reconnect (serv, FALSE, -1);
+}
+
+static void
+connect_failed (server *serv, int err)
+{
+	server_stopconnecting (serv);
+	EMIT_SIGNAL (XP_TE_CONNFAIL, serv->server_session, errorstring (err), NULL,
+					 NULL, NULL, 0);
+	if (!servlist_cycle (serv))
+		if (prefs.hex_net_auto_reconnectonfail)
+			auto_reconnect (serv, FALSE, -1);
+}
+
+static void
+connect_proxy_failed (server *serv)
+{
+	PrintText (serv->server_session, _("Proxy traversal failed.\n"));
+	server_disconnect (serv->server_session, FALSE, -1);
+}
+
+/* the socket "sok" is connected to the server, all the way through */
+
+static void
+connect_done (struct connect_state *st, int sok)
+{
+	server *serv = st->serv;
+	struct sockaddr_storage addr;
+	socklen_t addr_len = sizeof (addr);
+	guint16 port;
+	ircnet *net = serv->network;
+	char outbuf[512];
+
+	if (st->sok == sok)
+		st->sok = -1;
+	serv->conn = NULL;
+	connect_state_free (st);
+
+	serv->sok = sok;
+
+	if (!getsockname (serv->sok, (struct sockaddr *)&addr, &addr_len))
+	{
+		if (addr.ss_family == AF_INET)
+			port = ntohs(((struct sockaddr_in *)&addr)->sin_port);
+		else
+			port = ntohs(((struct sockaddr_in6 *)&addr)->sin6_port);
 
-		if (prefs.hex_net_proxy_host[0] &&
-			   prefs.hex_net_proxy_type > 0 &&
-			   prefs.hex_net_proxy_use != 2) /* proxy is NOT dcc-only */
+		g_snprintf (outbuf, sizeof (outbuf), "IDENTD %"G_GUINT16_FORMAT" ", port);
+		if (net && net->user && !(net->flags & FLAG_USE_GLOBAL))
+			g_strlcat (outbuf, net->user, sizeof (outbuf));
+		else
+			g_strlcat (outbuf, prefs.hex_irc_user_name, sizeof (outbuf));
+
+		handle_command (serv->server_session, outbuf, FALSE);
+	}
+
+	server_connect_success (serv);
+}
+
+/* ================ proxy traversal ================ */
+
+struct sock_connect
+{
+	char version;
+	char type;
+	guint16 port;
+	guint32 address;
+	char username[10];
+};
+
+static gboolean
+connect_proxy_send (struct connect_state *st, const void *buf, int len)
+{
+	return send (st->sok, buf, len, 0) == len;
+}
+
+static gboolean
+connect_socks5_request (struct connect_state *st)
+{
+	unsigned char *sc2;
+	unsigned int packetlen, addrlen;
+	guint16 port = htons (st->serv->port);
+	gboolean ret;
+
+	addrlen = strlen (st->target);
+	packetlen = 4 + 1 + addrlen + 2;
+	sc2 = g_malloc (packetlen);
+	sc2[0] = 5;						  /* version */
+	sc2[1] = 1;						  /* command */
+	sc2[2] = 0;						  /* reserved */
+	sc2[3] = 3;						  /* address type */
+	sc2[4] = (unsigned char) addrlen;	/* hostname length */
+	memcpy (sc2 + 5, st->target, addrlen);
+	memcpy (sc2 + 5 + addrlen, &port, 2);
+	ret = connect_proxy_send (st, sc2, packetlen);
+	g_free (sc2);
+
+	st->phase = 2;
+	return ret;
+}
+
+/* how many more bytes make up the proxy's current reply. Never more,
+   whatever follows belongs to the IRC server. */
+
+static int
+connect_proxy_want (struct connect_state *st)
+{
+	unsigned char *buf = (unsigned char *) st->proxy_buf->str;
+	int len = st->proxy_buf->len;
+
+	switch (st->proxy_type)
+	{
+	case 2:
+		return 8 - len;
+	case 3:
+		if (st->phase < 2)
+			return 2 - len;
+		if (len < 4)
+			return 4 - len;
+		if (buf[0] != 5 || buf[1] != 0)
+			return 0;
+		if (buf[3] == 1)	/* IPV4 32bit address */
+			return 10 - len;
+		if (buf[3] == 4)	/* IPV6 128bit address */
+			return 22 - len;
+		if (buf[3] == 3)	/* string, 1st byte is size */
+			return len < 5 ? 1 : 7 + buf[4] - len;
+		return 0;
+	case 4:
+		if (len == 512 || (len && buf[len - 1] == '\n'))
+			return 0;
+		return 1;
+	}
+
+	return 0;
+}
+
+/* a whole reply is in. Returns 1 when the proxy is through, 0 to wait
+   for another reply, -1 when it failed. */
+
+static int
+connect_proxy_step (struct connect_state *st)
+{
+	unsigned char *buf = (unsigned char *) st->proxy_buf->str;
+	session *sess = st->serv->server_session;
+	int auth = prefs.hex_net_proxy_auth && prefs.hex_net_proxy_user[0] && prefs.hex_net_proxy_pass[0];
+	int len_u, len_p, packetlen;
+	unsigned char *u_p_buf;
+	gboolean sent;
+
+	switch (st->proxy_type)
+	{
+	case 2:
+		if (buf[1] == 90)
+			return 1;
+		PrintTextf (sess, "SOCKS\tServer reported error %d,%d.\n", buf[0], buf[1]);
+		return -1;
+
+	case 3:
+		if (st->phase == 0)
 		{
-			proxy_type = prefs.hex_net_proxy_type;
-			proxy_host = g_strdup (prefs.hex_net_proxy_host);
-			proxy_port = prefs.hex_net_proxy_port;
+			if (buf[0] != 5)
+			{
+				PrintText (sess, "SOCKS\tServer is not socks version 5.\n");
+				return -1;
+			}
+
+			/* did the server say no auth required? */
+			if (buf[1] == 0)
+				auth = 0;
+
+			if (!auth)
+			{
+				if (buf[1] != 0)
+				{
+					PrintText (sess, "SOCKS\tAuthentication required but disabled in settings.\n");
+					return -1;
+				}
+				sent = connect_socks5_request (st);
+			} else
+			{
+				/* authentication sub-negotiation (RFC1929) */
+				if (buf[1] != 2)  /* UPA not supported by server */
+				{
+					PrintText (sess, "SOCKS\tServer doesn't support UPA authentication.\n");
+					return -1;
+				}
+
+				/* form the UPA request */
+				len_u = strlen (prefs.hex_net_proxy_user);
+				len_p = strlen (prefs.hex_net_proxy_pass);
+
+				packetlen = 2 + len_u + 1 + len_p;
+				u_p_buf = g_malloc0 (packetlen);
+
+				u_p_buf[0] = 1;
+				u_p_buf[1] = len_u;
+				memcpy (u_p_buf + 2, prefs.hex_net_proxy_user, len_u);
+				u_p_buf[2 + len_u] = len_p;
+				memcpy (u_p_buf + 3 + len_u, prefs.hex_net_proxy_pass, len_p);
+
+				sent = connect_proxy_send (st, u_p_buf, packetlen);
+				g_free (u_p_buf);
+				st->phase = 1;
+			}
+		} else if (st->phase == 1)
+		{
+			if (buf[1] != 0)
+			{
+				PrintText (sess, "SOCKS\tAuthentication failed. "
+							  "Is username and password correct?\n");
+				return -1; /* UPA failed! */
+			}
+			sent = connect_socks5_request (st);
+		} else
+		{
+			if (buf[0] == 5 && buf[1] == 0)
+				return 1;
+			if (buf[1] == 2)
+				PrintText (sess, "SOCKS\tProxy refused to connect to host (not allowed).\n");
+			else
+				PrintTextf (sess, "SOCKS\tProxy failed to connect to host (error %d).\n", buf[1]);
+			return -1;
 		}
+
+		if (!sent)
+			return -1;
+		g_string_truncate (st->proxy_buf, 0);
+		return 0;
+
+	case 4:
+		/* print the message out */
+		g_string_truncate (st->proxy_buf, strcspn (st->proxy_buf->str, "\r\n"));
+		if (st->proxy_buf->len)
+			PrintTextf (sess, "%s\n", st->proxy_buf->str);
+
+		if (st->phase == 0)
+		{
+			/* "HTTP/1.0 200 OK" */
+			if (st->proxy_buf->len < 12)
+				return -1;
+			if (memcmp (buf, "HTTP/", 5) || memcmp (buf + 9, "200", 3))
+				return -1;
+			st->phase = 1;
+		} else if (st->proxy_buf->len == 0)
+		{
+			/* blank line, end of the headers */
+			return 1;
+		}
+
+		g_string_truncate (st->proxy_buf, 0);
+		return 0;
+	}
+
+	return -1;
+}
+
+static gboolean
+connect_proxy_read (GIOChannel *source, GIOCondition condition, struct connect_state *st)
+{
+	server *serv = st->serv;
+	char buf[256];
+	int len;
+
+	len = recv (st->sok, buf, MIN (connect_proxy_want (st), sizeof (buf)), 0);
+	if (len < 0 && would_block ())
+		return TRUE;
+
+	if (len < 1)
+	{
+		if (st->proxy_type == 3)
+			PrintText (serv->server_session, "SOCKS\tRead error from server.\n");
+		connect_proxy_failed (serv);
+		return TRUE;
+	}
+
+	g_string_append_len (st->proxy_buf, buf, len);
+	if (connect_proxy_want (st) > 0)
+		return TRUE;
+
+	switch (connect_proxy_step (st))
+	{
+	case 1:
+		connect_done (st, st->sok);
+		break;
+	case -1:
+		connect_proxy_failed (serv);
+		break;
 	}
 
-	serv->proxy_type = proxy_type;
+	return TRUE;
+}
+
+static void
+connect_proxy_start (struct connect_state *st)
+{
+	server *serv = st->serv;
+	struct sock_connect sc;
+	struct sock5_connect1
+	{
+		char version;
+		char nmethods;
+		char method;
+	} sc1;
+	char buf[512];
+	char auth_data[256];
+	char auth_data2[252];
+	int n, n2;
+	gboolean sent = FALSE;
 
-	/* first resolve where we want to connect to */
-	if (proxy_type > 0)
+	switch (st->proxy_type)
 	{
-		g_snprintf (buf, sizeof (buf), "9\n%s\n", proxy_host);
-		write (serv->childwrite, buf, strlen (buf));
-		ip = net_resolve (ns_server, proxy_host, proxy_port, &real_hostname);
-		g_free (proxy_host);
-		if (!ip)
+	case 1:
+		/* wingate, nothing comes back */
+		g_snprintf (buf, sizeof (buf), "%s %d\r\n", st->target, serv->port);
+		connect_proxy_send (st, buf, strlen (buf));
+		connect_done (st, st->sok);
+		return;
+	case 2:
+		sc.version = 4;
+		sc.type = 1;
+		sc.port = htons (serv->port);
+		sc.address = inet_addr (st->target);
+		g_strlcpy (sc.username, prefs.hex_irc_user_name, sizeof (sc.username));
+		sent = connect_proxy_send (st, &sc, 8 + strlen (sc.username) + 1);
+		break;
+	case 3:
+		sc1.version = 5;
+		sc1.nmethods = 1;
+		if (prefs.hex_net_proxy_auth && prefs.hex_net_proxy_user[0] && prefs.hex_net_proxy_pass[0])
+			sc1.method = 2;  /* Username/Password Authentication (UPA) */
+		else
+			sc1.method = 0;  /* NO Authentication */
+		sent = connect_proxy_send (st, &sc1, 3);
+		break;
+	case 4:
+		n = g_snprintf (buf, sizeof (buf), "CONNECT %s:%d HTTP/1.0\r\n",
+							 st->target, serv->port);
+		if (prefs.hex_net_proxy_auth)
 		{
-			write (serv->childwrite, "1\n", 2);
-			goto xit;
+			n2 = g_snprintf (auth_data2, sizeof (auth_data2), "%s:%s",
+								  prefs.hex_net_proxy_user, prefs.hex_net_proxy_pass);
+			base64_encode (auth_data, auth_data2, n2);
+			n += g_snprintf (buf+n, sizeof (buf)-n, "Proxy-Authorization: Basic %s\r\n", auth_data);
 		}
-		connect_port = proxy_port;
+		n += g_snprintf (buf+n, sizeof (buf)-n, "\r\n");
+		sent = connect_proxy_send (st, buf, n);
+		break;
+	}
+
+	if (!sent)
+	{
+		connect_proxy_failed (serv);
+		return;
+	}
 
-		/* if using socks4 or MS Proxy, attempt to resolve ip for irc server */
-		if ((proxy_type == 2) || (proxy_type == 5))
+	st->phase = 0;
+	st->proxy_buf = g_string_sized_new (64);
+	st->proxy_tag = fe_input_add (st->sok, FIA_READ|FIA_EX, connect_proxy_read, st);
+}
+
+/* ================ racing the addresses ================ */
+
+static gboolean
+connect_try_cb (GIOChannel *source, GIOCondition condition, struct connect_try *try)
+{
+	struct connect_state *st = try->st;
+	int sok = try->sok;
+	int err = 0;
+	socklen_t len = sizeof (err);
+
+	if (getsockopt (sok, SOL_SOCKET, SO_ERROR, (char *)&err, &len) < 0)
+		err = sock_error ();
+
+	fe_input_remove (try->tag);
+	st->tries = g_slist_remove (st->tries, try);
+	g_free (try);
+
+	if (err)
+	{
+		/* don't wait out the delay, go straight to the next address */
+		closesocket (sok);
+		st->error = err;
+		connect_next (st);
+		return TRUE;
+	}
+
+	/* the winner, drop the others */
+	connect_tries_close (st);
+
+	if (!st->proxy_type)
+	{
+		connect_done (st, sok);
+		return TRUE;
+	}
+
+	st->sok = sok;
+	connect_proxy_start (st);
+	return TRUE;
+}
+
+static int
+connect_delay_cb (struct connect_state *st)
+{
+	st->delay_tag = 0;
+	connect_next (st);
+	return 0;
+}
+
+/* start a connect to the next address that gets as far as that */
+
+static void
+connect_next (struct connect_state *st)
+{
+	GSocketAddress *saddr;
+	struct sockaddr_storage addr;
+	int addr_len;
+	struct connect_try *try;
+	int sok, err;
+
+	if (st->delay_tag)
+	{
+		fe_timeout_remove (st->delay_tag);
+		st->delay_tag = 0;
+	}
+
+	while (st->next)
+	{
+		saddr = g_inet_socket_address_new (st->next->data, st->connect_port);
+		st->next = st->next->next;
+		addr_len = g_socket_address_get_native_size (saddr);
+		if (!g_socket_address_to_native (saddr, &addr, sizeof (addr), NULL))
+			addr_len = 0;
+		g_object_unref (saddr);
+		if (!addr_len)
+			continue;
+
+		err = net_connect_start ((struct sockaddr *)&addr, addr_len,
+										 st->bind_len ? (struct sockaddr *)&st->bind_addr : NULL,
+										 st->bind_len, &sok);
+		if (err)
 		{
-			ns_proxy = net_store_new ();
-			proxy_ip = net_resolve (ns_proxy, hostname, port, &real_hostname);
-			if (!proxy_ip)
-			{
-				write (serv->childwrite, "1\n", 2);
-				goto xit;
-			}
-		} else						  /* otherwise we can just use the hostname */
-			proxy_ip = g_strdup (hostname);
-	} else
+			st->error = err;
+			continue;
+		}
+
+		try = g_new (struct connect_try, 1);
+		try->st = st;
+		try->sok = sok;
+		try->tag = fe_input_add (sok, FIA_WRITE|FIA_EX, connect_try_cb, try);
+		st->tries = g_slist_prepend (st->tries, try);
+
+		if (st->next)
+			st->delay_tag = fe_timeout_add (CONNECT_ATTEMPT_DELAY, connect_delay_cb, st);
+		return;
+	}
+
+	/* nothing left to try and nothing still trying */
+	if (!st->tries)
+		connect_failed (st->serv, st->error);
+}
+
+/* reorder a GResolver result so the address families alternate, starting
+   with the family the resolver put first */
+
+static GList *
+connect_interleave (GList *addrs)
+{
+	GSocketFamily family = g_inet_address_get_family (addrs->data);
+	GList *first = NULL;
+	GList *other = NULL;
+	GList *out = NULL;
+	GList *list;
+
+	for (list = addrs; list; list = list->next)
+	{
+		if (g_inet_address_get_family (list->data) == family)
+			first = g_list_prepend (first, list->data);
+		else
+			other = g_list_prepend (other, list->data);
+	}
+	g_list_free (addrs);
+
+	first = g_list_reverse (first);
+	other = g_list_reverse (other);
+	while (first || other)
+	{
+		if (first)
+		{
+			out = g_list_prepend (out, first->data);
+			first = g_list_delete_link (first, first);
+		}
+		if (other)
+		{
+			out = g_list_prepend (out, other->data);
+			other = g_list_delete_link (other, other);
+		}
+	}
+
+	return g_list_reverse (out);
+}
+
+/* ================ lookups ================ */
+
+/* returns the state, or NULL when it was abandoned (and is now freed) */
+
+static struct connect_state *
+connect_lookup_finish (struct connect_state *st)
+{
+	st->lookup_pending = FALSE;
+	if (st->serv)
+		return st;
+
+	connect_state_free (st);
+	return NULL;
+}
+
+static void
+connect_target_cb (GObject *obj, GAsyncResult *result, gpointer user_data)
+{
+	struct connect_state *st = user_data;
+	GList *addrs, *list;
+
+	addrs = g_resolver_lookup_by_name_finish (G_RESOLVER (obj), result, NULL);
+	if (!connect_lookup_finish (st))
 	{
-		ip = net_resolve (ns_server, hostname, port, &real_hostname);
-		if (!ip)
+		g_resolver_free_addresses (addrs);
+		return;
+	}
+
+	/* socks4 can only take an IPv4 address */
+	for (list = addrs; list; list = list->next)
+	{
+		if (g_inet_address_get_family (list->data) == G_SOCKET_FAMILY_IPV4)
 		{
-			write (serv->childwrite, "1\n", 2);
-			goto xit;
+			st->target = g_inet_address_to_string (list->data);
+			break;
 		}
-		connect_port = port;
 	}
+	g_resolver_free_addresses (addrs);
 
-	g_snprintf (buf, sizeof (buf), "3\n%s\n%s\n%d\n",
-				 real_hostname, ip, connect_port);
-	write (serv->childwrite, buf, strlen (buf));
+	if (!st->target)
+	{
+		connect_unknown_host (st->serv);
+		return;
+	}
 
-	if (!serv->dont_use_proxy && (proxy_type == 5))
-		error = net_connect (ns_server, serv->proxy_sok4, serv->proxy_sok6, &psok);
-	else
+	connect_next (st);
+}
+
+static void
+connect_lookup_cb (GObject *obj, GAsyncResult *result, gpointer user_data)
+{
+	struct connect_state *st = user_data;
+	server *serv;
+	GResolver *resolver;
+	GList *addrs;
+	char *ip;
+	char port[16];
+
+	addrs = g_resolver_lookup_by_name_finish (G_RESOLVER (obj), result, NULL);
+	if (!connect_lookup_finish (st))
 	{
-		error = net_connect (ns_server, serv->sok4, serv->sok6, &sok);
-		psok = sok;
+		g_resolver_free_addresses (addrs);
+		return;
 	}
 
-	if (error != 0)
+	serv = st->serv;
+	if (!addrs)
 	{
-		g_snprintf (buf, sizeof (buf), "2\n%d\n", sock_error ());
-		write (serv->childwrite, buf, strlen (buf));
-	} else
+		connect_unknown_host (serv);
+		return;
+	}
+	st->addrs = st->next = connect_interleave (addrs);
+
+	ip = g_inet_address_to_string (st->addrs->data);
+	g_snprintf (port, sizeof (port), "%d", st->connect_port);
+	EMIT_SIGNAL (XP_TE_CONNECT, serv->server_session,
+					 st->proxy_type ? st->proxy_host : serv->hostname, ip, port, NULL, 0);
+	g_free (ip);
+	if (!connect_state_valid (serv, st))
+		return;
+
+	if (st->proxy_type == 2)
+	{
+		/* socks4: resolve the irc server's ip ourselves */
+		resolver = g_resolver_get_default ();
+		st->lookup_pending = TRUE;
+		g_resolver_lookup_by_name_async (resolver, serv->hostname, st->cancel,
+													connect_target_cb, st);
+		g_object_unref (resolver);
+		return;
+	}
+
+	/* otherwise we can just use the hostname */
+	if (st->proxy_type)
+		st->target = g_strdup (serv->hostname);
+
+	connect_next (st);
+}
+
+/* first resolve where we want to connect to */
+
+static void
+connect_lookup (struct connect_state *st)
+{
+	server *serv = st->serv;
+	GResolver *resolver;
+	char *host = serv->hostname;
+
+	st->connect_port = serv->port;
+	if (st->proxy_type)
+	{
+		EMIT_SIGNAL (XP_TE_SERVERLOOKUP, serv->server_session, st->proxy_host,
+						 NULL, NULL, NULL, 0);
+		if (!connect_state_valid (serv, st))
+			return;
+		host = st->proxy_host;
+		st->connect_port = st->proxy_port;
+	}
+
+	resolver = g_resolver_get_default ();
+	st->lookup_pending = TRUE;
+	g_resolver_lookup_by_name_async (resolver, host, st->cancel, connect_lookup_cb, st);
+	g_object_unref (resolver);
+}
+
+/* "proxy" comes from GProxyResolver, e.g. "socks5://host:port", or NULL */
+
+static void
+connect_use_proxy (struct connect_state *st, const char *proxy)
+{
+	server *serv = st->serv;
+	const char *c;
+	char *colon;
+
+	if (proxy)
 	{
-		/* connect succeeded */
-		if (proxy_ip)
+		if (!strncmp (proxy, "http", 4))
+			st->proxy_type = 4;
+		else if (!strncmp (proxy, "socks5", 6))
+			st->proxy_type = 3;
+		else if (!strncmp (proxy, "socks", 5))
+			st->proxy_type = 2;
+
+		c = strstr (proxy, "://");
+		if (st->proxy_type && c)
 		{
-			switch (traverse_proxy (proxy_type, serv->childwrite, psok, proxy_ip, port, ns_proxy, serv->sok4, serv->sok6, &sok, bound))
+			st->proxy_host = g_strdup (c + 3);
+			colon = strrchr (st->proxy_host, ':');
+			if (colon)
 			{
-			case 0:	/* success */
-				g_snprintf (buf, sizeof (buf), "4\n%d\n", sok);	/* success */
-				write (serv->childwrite, buf, strlen (buf));
-				break;
-			case 1:	/* socks traversal failed */
-				write (serv->childwrite, "8\n", 2);
-				break;
+				*colon = 0;
+				st->proxy_port = atoi (colon + 1);
 			}
 		} else
 		{
-			g_snprintf (buf, sizeof (buf), "4\n%d\n", sok);	/* success */
-			write (serv->childwrite, buf, strlen (buf));
+			st->proxy_type = 0;
 		}
 	}
 
-xit:
+	if (!serv->dont_use_proxy && prefs.hex_net_proxy_host[0] &&
+		 prefs.hex_net_proxy_type > 0 && prefs.hex_net_proxy_type < 5 &&
+		 prefs.hex_net_proxy_use != 2) /* proxy is NOT dcc-only */
+	{
+		st->proxy_type = prefs.hex_net_proxy_type;
+		g_free (st->proxy_host);
+		st->proxy_host = g_strdup (prefs.hex_net_proxy_host);
+		st->proxy_port = prefs.hex_net_proxy_port;
+	}
 
-	/* this is probably not needed */
-	net_store_destroy (ns_server);
-	if (ns_proxy)
-		net_store_destroy (ns_proxy);
+	serv->proxy_type = st->proxy_type;
+	connect_lookup (st);
+}
 
-	/* no need to free ip/real_hostname, this process is exiting */
+static void
+connect_proxy_cb (GObject *obj, GAsyncResult *result, gpointer user_data)
+{
+	struct connect_state *st = user_data;
+	char **proxy_list;
+	GError *error = NULL;
 
-	return 0;
-	/* cppcheck-suppress memleak */
+	proxy_list = g_proxy_resolver_lookup_finish (G_PROXY_RESOLVER (obj), result, &error);
+	if (!connect_lookup_finish (st))
+	{
+		g_strfreev (proxy_list);
+		g_clear_error (&error);
+		return;
+	}
+
+	if (!proxy_list)
+		write_error ("Failed to lookup proxy", &error);
+
+	/* can use only one */
+	connect_use_proxy (st, proxy_list ? proxy_list[0] : NULL);
+	g_strfreev (proxy_list);
+}
+
+static void
+connect_find_proxy (struct connect_state *st)
+{
+	server *serv = st->serv;
+	char *url;
+
+	if (!serv->dont_use_proxy && prefs.hex_net_proxy_type == 5)
+	{
+		url = g_strdup_printf ("irc://%s:%d", serv->hostname, serv->port);
+		st->lookup_pending = TRUE;
+		g_proxy_resolver_lookup_async (g_proxy_resolver_get_default (), url,
+												 st->cancel, connect_proxy_cb, st);
+		g_free (url);
+		return;
+	}
+
+	connect_use_proxy (st, NULL);
+}
+
+static void
+connect_bind_cb (GObject *obj, GAsyncResult *result, gpointer user_data)
+{
+	struct connect_state *st = user_data;
+	GSocketAddress *saddr;
+	GList *addrs;
+	char *ip;
+	char outbuf[512];
+
+	addrs = g_resolver_lookup_by_name_finish (G_RESOLVER (obj), result, NULL);
+	if (!connect_lookup_finish (st))
+	{
+		g_resolver_free_addresses (addrs);
+		return;
+	}
+
+	if (addrs)
+	{
+		ip = g_inet_address_to_string (addrs->data);
+		prefs.local_ip = inet_addr (ip);
+		g_free (ip);
+
+		saddr = g_inet_socket_address_new (addrs->data, 0);
+		if (g_socket_address_to_native (saddr, &st->bind_addr, sizeof (st->bind_addr), NULL))
+			st->bind_len = g_socket_address_get_native_size (saddr);
+		g_object_unref (saddr);
+		g_resolver_free_addresses (addrs);
+	} else
+	{
+		g_snprintf (outbuf, sizeof (outbuf),
+						_("Cannot resolve hostname %s\nCheck your IP Settings!\n"),
+						prefs.hex_net_bind_host);
+		PrintText (st->serv->server_session, outbuf);
+	}
+
+	connect_find_proxy (st);
+}
+
+static void
+connect_begin (struct connect_state *st)
+{
+	GResolver *resolver;
+
+	/* is a hostname set? - bind to it */
+	if (prefs.hex_net_bind_host[0])
+	{
+		resolver = g_resolver_get_default ();
+		st->lookup_pending = TRUE;
+		g_resolver_lookup_by_name_async (resolver, prefs.hex_net_bind_host,
+													st->cancel, connect_bind_cb, st);
+		g_object_unref (resolver);
+		return;
+	}
+
+	connect_find_proxy (st);
 }
 
 static void
 server_connect (server *serv, char *hostname, int port, int no_login)
 {
-	int pid, read_des[2];
+	struct connect_state *st;
 	session *sess = serv->server_session;
 
 #ifdef USE_OPENSSL
@@ -1579,41 +2000,12 @@ server_connect (server *serv, char *hostname, int port, int no_login)
 	fe_set_away (serv);
 	server_flush_queue (serv);
 
-	if (pipe (read_des) < 0)
-		return;
-#ifdef __EMX__ /* os/2 */
-	setmode (read_des[0], O_BINARY);
-	setmode (read_des[1], O_BINARY);
-#endif
-	serv->childread = read_des[0];
-	serv->childwrite = read_des[1];
-
-	/* create both sockets now, drop one later */
-	net_sockets (&serv->sok4, &serv->sok6);
-	serv->proxy_sok4 = -1;
-	serv->proxy_sok6 = -1;
-
-#ifdef LOOKUPD
-	/* CL: net_resolve calls rand() when LOOKUPD is set, so prepare a different
-	 * seed for each child. This method gives a bigger variation in seed values
-	 * than calling srand(time(0)) in the child itself.
-	 */
-	rand();
-#endif
-	switch (pid = fork ())
-	{
-	case -1:
-		return;
-
-	case 0:
-		/* this is the child */
-		setuid (getuid ());
-		server_child (serv);
-		_exit (0);
-	}
-	serv->childpid = pid;
-	serv->iotag = fe_input_add (serv->childread, FIA_READ, server_read_child,
-										 serv);
+	st = g_new0 (struct connect_state, 1);
+	st->serv = serv;
+	st->cancel = g_cancellable_new ();
+	st->sok = -1;
+	serv->conn = st;
+	connect_begin (st);
 }
 
 void
@@ -1747,6 +2139,32 @@ server_set_defaults (server *serv)
 	serv->have_invite = FALSE;
 }
 
+static gboolean
+casemap_equal_rfc (gconstpointer a, gconstpointer b)
+{
+	return rfc_casecmp (a, b) == 0;
+}
+
+static gboolean
+casemap_equal_ascii (gconstpointer a, gconstpointer b)
+{
+	return g_ascii_strcasecmp (a, b) == 0;
+}
+
+/* a hash table keyed by nick or channel name, comparing the way
+   serv->p_cmp does. Needs to be rebuilt when p_cmp changes. */
+
+GHashTable *
+server_casemap_table_new (server *serv, GDestroyNotify key_destroy,
+								  GDestroyNotify value_destroy)
+{
+	/* str_ihash folds the RFC1459 way, which is also fine for "ascii" */
+	return g_hash_table_new_full ((GHashFunc) str_ihash,
+											serv->p_cmp == (void *) g_ascii_strcasecmp ?
+											casemap_equal_ascii : casemap_equal_rfc,
+											key_destroy, value_destroy);
+}
+
 char *
 server_get_network (server *serv, gboolean fallback)
 {
@@ -1876,6 +2294,7 @@ server_free (server *serv)
 	g_free (serv->bad_nick_prefixes);
 	g_free (serv->last_away_reason);
 	g_free (serv->encoding);
+	g_free (serv->linebuf);
 
 	if (serv->whois_info)
 	{
@@ -1900,6 +2319,15 @@ server_free (server *serv)
 
 	if (serv->favlist)
 		g_slist_free_full (serv->favlist, (GDestroyNotify) servlist_favchan_free);
+	if (serv->chan_index)
+		g_hash_table_destroy (serv->chan_index);
+	if (serv->dialog_index)
+		g_hash_table_destroy (serv->dialog_index);
+	if (serv->user_index)
+		g_hash_table_destroy (serv->user_index);
+	if (serv->account_index)
+		g_hash_table_destroy (serv->account_index);
+	notify_index_reset (serv);
 #ifdef USE_OPENSSL
 	if (serv->ctx)
 		_SSL_context_free (serv->ctx);
@@ -32,9 +32,12 @@ int is_server (server *serv);
 void server_fill_her_up (server *serv);
 void server_set_encoding (server *serv, char *new_encoding);
 void server_set_defaults (server *serv);
+GHashTable *server_casemap_table_new (server *serv, GDestroyNotify key_destroy,
+												GDestroyNotify value_destroy);
 char *server_get_network (server *serv, gboolean fallback);
 void server_set_name (server *serv, char *name);
 void server_free (server *serv);
+void server_inline (server *serv, char *line, gssize len);
 
 void server_away_save_message (server *serv, char *nick, char *msg);
 struct away_msg *server_away_find_message (server *serv, char *nick);
@@ -38,6 +38,8 @@
 #include "outbound.h"
 #include "hexchatc.h"
 #include "text.h"
+#include "logthread.h"
+#include "bench.h"
 #include "typedef.h"
 #ifdef USE_LIBCANBERRA
 #include <canberra.h>
@@ -93,65 +95,168 @@ scrollback_get_filename (session *sess)
 	return ret;
 }
 
+/* The scrollback is kept in two segments: "chan.txt", which is appended
+   to, and "chan.txt.1", the previous one. Once chan.txt holds
+   hex_text_max_lines lines it replaces chan.txt.1, so trimming the
+   history is a rename instead of a rewrite. Lines are collected in
+   sess->scrollbuf and handed to a log_file (see logthread.c) shortly
+   after the last one.
+
+   Replay reads the segments backwards from the end, so opening a tab
+   only costs one page of lines. sess->scrollreplay_seg/_pos remember
+   where the oldest replayed line started, and scrollback_load_older()
+   pages in more from there when the frontend scrolls to the top. */
+
+#define SCROLLBACK_FLUSH_SECONDS 2
+#define SCROLLBACK_BUFSIZE 8192
+#define SCROLLBACK_PAGE 100
+#define SCROLLBACK_CHUNK 8192
+
+/* sess->scrollreplay_seg */
+#define REPLAY_DONE 0
+#define REPLAY_CURRENT 1	/* sess->scrollfile */
+#define REPLAY_OLD 2			/* its ".1" segment */
+
+static GFile *
+scrollback_get_old_file (session *sess)
+{
+	GFile *file;
+	char *path, *old;
+
+	path = g_file_get_path (sess->scrollfile);
+	if (!path)
+		return NULL;
+
+	old = g_strconcat (path, ".1", NULL);
+	file = g_file_new_for_path (old);
+	g_free (old);
+	g_free (path);
+
+	return file;
+}
+
+static void
+scrollback_flush (session *sess)
+{
+	if (sess->scrollflush_tag)
+	{
+		fe_timeout_remove (sess->scrollflush_tag);
+		sess->scrollflush_tag = 0;
+	}
+
+	if (sess->scrollbuf && sess->scrollbuf->len)
+	{
+		if (sess->scrolllog)
+			log_file_write (sess->scrolllog, sess->scrollbuf->str, sess->scrollbuf->len);
+		g_string_truncate (sess->scrollbuf, 0);
+	}
+}
+
+static int
+scrollback_flush_cb (session *sess)
+{
+	sess->scrollflush_tag = 0;
+	scrollback_flush (sess);
+
+	return 0;
+}
+
+static void
+scrollback_close_stream (session *sess)
+{
+	scrollback_flush (sess);
+
+	if (sess->scrolllog)
+	{
+		log_file_close (sess->scrolllog);
+		sess->scrolllog = NULL;
+	}
+	if (sess->scrollbuf)
+	{
+		g_string_free (sess->scrollbuf, TRUE);
+		sess->scrollbuf = NULL;
+	}
+}
+
 void
 scrollback_close (session *sess)
 {
+	scrollback_close_stream (sess);
 	g_clear_object (&sess->scrollfile);
+	sess->scrollreplay_seg = REPLAY_DONE;
 }
 
-/* shrink the file to roughly prefs.hex_text_max_lines */
+static gboolean
+scrollback_open_stream (session *sess)
+{
+	char *path;
+
+	/* creates the folder too, users can delete it after it's created... */
+	path = g_file_get_path (sess->scrollfile);
+	if (!path)
+		return FALSE;
+
+	sess->scrolllog = log_file_open (path);
+	g_free (path);
+
+	return TRUE;
+}
+/* retire the current segment, the next write starts a fresh one */
 
 static void
-scrollback_shrink (session *sess)
+scrollback_rotate (session *sess)
 {
-	char *buf, *p;
-	gsize len;
-	gint offset, lines = 0;
-	const gint max_lines = MIN(prefs.hex_text_max_lines, SCROLLBACK_MAX);
+	char *path, *old;
 
-	if (!g_file_load_contents (sess->scrollfile, NULL, &buf, &len, NULL, NULL))
-		return;
+	scrollback_close_stream (sess);
 
-	/* count all lines */
-	p = buf;
-	while (p != buf + len)
+	path = g_file_get_path (sess->scrollfile);
+	if (path)
 	{
-		if (*p == '\n')
-			lines++;
-		p++;
+		old = g_strconcat (path, ".1", NULL);
+		log_file_rename (path, old);
+		g_free (old);
+		g_free (path);
 	}
 
-	offset = lines - max_lines;
+	sess->scrollwritten = 0;
+
+	/* the replay position moves along with the file it points into */
+	if (sess->scrollreplay_seg == REPLAY_CURRENT)
+		sess->scrollreplay_seg = REPLAY_OLD;
+	else
+		sess->scrollreplay_seg = REPLAY_DONE;
+}
+static int
+scrollback_count_lines (GFile *file)
+{
+	GInputStream *stream;
+	char buf[SCROLLBACK_CHUNK];
+	gssize len, i;
+	int lines = 0;
 
-	/* now just go back to where we want to start the file */
-	p = buf;
-	lines = 0;
-	while (p != buf + len)
+	stream = G_INPUT_STREAM (g_file_read (file, NULL, NULL));
+	if (!stream)
+		return 0;
+
+	while ((len = g_input_stream_read (stream, buf, sizeof (buf), NULL, NULL)) > 0)
 	{
-		if (*p == '\n')
+		for (i = 0; i < len; i++)
 		{
-			lines++;
-			if (lines == offset)
-			{
-				p++;
-				break;
-			}
+			if (buf[i] == '\n')
+				lines++;
 		}
-		p++;
 	}
 
-	if (g_file_replace_contents (sess->scrollfile, p, strlen(p), NULL, FALSE,
-							G_FILE_CREATE_PRIVATE, NULL, NULL, NULL))
-		sess->scrollwritten = lines;
-
-	g_free (buf);
+	g_object_unref (stream);
+	return lines;
 }
 
 static void
 scrollback_save (session *sess, char *text, time_t stamp)
 {
-	GOutputStream *ostream;
 	char *buf;
+	int len;
 
 	if (sess->type == SESS_SERVER && prefs.hex_gui_tab_server == 1)
 		return;
@@ -175,17 +280,23 @@ scrollback_save (session *sess, char *text, time_t stamp)
 		sess->scrollfile = g_file_new_for_path (buf);
 		g_free (buf);
 	}
-	else
+
+	/* replay doesn't read the whole file, so count it on the first write,
+	   once the log thread is done with anything queued for it */
+	if (sess->scrollwritten < 0)
 	{
-		/* Users can delete the folder after it's created... */
-		GFile *parent = g_file_get_parent (sess->scrollfile);
-		g_file_make_directory_with_parents (parent, NULL, NULL);
-		g_object_unref (parent);
+		log_thread_sync ();
+		sess->scrollwritten = scrollback_count_lines (sess->scrollfile);
 	}
 
-	ostream = G_OUTPUT_STREAM(g_file_append_to (sess->scrollfile, G_FILE_CREATE_PRIVATE, NULL, NULL));
-	if (!ostream)
+	if ((sess->scrollwritten >= prefs.hex_text_max_lines && prefs.hex_text_max_lines > 0) ||
+       sess->scrollwritten >= SCROLLBACK_MAX)
+		scrollback_rotate (sess);
+
+	if (!sess->scrolllog && !scrollback_open_stream (sess))
 		return;
+	if (!sess->scrollbuf)
+		sess->scrollbuf = g_string_sized_new (SCROLLBACK_BUFSIZE);
 
 	if (!stamp)
 		stamp = time(0);
@@ -194,170 +305,367 @@ scrollback_save (session *sess, char *text, time_t stamp)
 	else
 		buf = g_strdup_printf ("T %" G_GINT64_FORMAT " ", (gint64)stamp);
 
-	g_output_stream_write (ostream, buf, strlen (buf), NULL, NULL);
-	g_output_stream_write (ostream, text, strlen (text), NULL, NULL);
-	if (!g_str_has_suffix (text, "\n"))
-		g_output_stream_write (ostream, "\n", 1, NULL, NULL);
+	len = strlen (text);
+	g_string_append (sess->scrollbuf, buf);
+	g_string_append_len (sess->scrollbuf, text, len);
+	if (len == 0 || text[len - 1] != '\n')
+		g_string_append_c (sess->scrollbuf, '\n');
 
 	g_free (buf);
-	g_object_unref (ostream);
 
 	sess->scrollwritten++;
 
-	if ((sess->scrollwritten > prefs.hex_text_max_lines && prefs.hex_text_max_lines > 0) ||
-       sess->scrollwritten > SCROLLBACK_MAX)
-		scrollback_shrink (sess);
+	if (sess->scrollbuf->len >= SCROLLBACK_BUFSIZE)
+		scrollback_flush (sess);
+	else if (!sess->scrollflush_tag)
+		sess->scrollflush_tag = fe_timeout_add_seconds (SCROLLBACK_FLUSH_SECONDS,
+																		scrollback_flush_cb, sess);
 }
 
-void
+/* Collect the lines ending before *end into lines, newest first, until
+   it holds "want" of them. *end < 0 stands for the end of the file, and
+   is left at the offset where the oldest collected line starts. */
+
+static void
+scrollback_read_back (GFile *file, goffset *end, guint want, GPtrArray *lines)
+{
+	GFileInputStream *stream;
+	GByteArray *buf;
+	guint8 chunk[SCROLLBACK_CHUNK];
+	goffset pos;
+	gsize got, n, i;
+	char *line;
+
+	stream = g_file_read (file, NULL, NULL);
+	if (!stream)
+	{
+		*end = 0;
+		return;
+	}
+
+	pos = *end;
+	if (pos < 0)
+	{
+		g_seekable_seek (G_SEEKABLE (stream), 0, G_SEEK_END, NULL, NULL);
+		pos = g_seekable_tell (G_SEEKABLE (stream));
+	}
+
+	/* buf always holds the file from pos up to, but not including,
+	   the newline after the last line we haven't collected yet */
+	buf = g_byte_array_new ();
+	if (pos > 0 && g_seekable_seek (G_SEEKABLE (stream), pos - 1, G_SEEK_SET, NULL, NULL) &&
+		 g_input_stream_read_all (G_INPUT_STREAM (stream), chunk, 1, &got, NULL, NULL) &&
+		 got == 1 && chunk[0] == '\n')
+		pos--;
+	else if (pos == 0)
+	{
+		*end = 0;
+		want = 0;
+	}
+
+	while (lines->len < want)
+	{
+		i = buf->len;
+		while (i > 0 && buf->data[i - 1] != '\n')
+			i--;
+
+		if (i == 0 && pos > 0)
+		{
+			n = MIN (pos, SCROLLBACK_CHUNK);
+			if (!g_seekable_seek (G_SEEKABLE (stream), pos - n, G_SEEK_SET, NULL, NULL) ||
+				 !g_input_stream_read_all (G_INPUT_STREAM (stream), chunk, n, &got, NULL, NULL) ||
+				 got != n)
+			{
+				*end = 0;
+				break;
+			}
+			pos -= n;
+			g_byte_array_prepend (buf, chunk, n);
+			continue;
+		}
+
+		n = buf->len - i;
+		if (n > 0 && buf->data[buf->len - 1] == '\r')
+			n--;
+		line = g_strndup ((char *)buf->data + i, n);
+		g_ptr_array_add (lines, line);
+
+		*end = pos + i;
+		if (i == 0)
+			break;
+		g_byte_array_set_size (buf, i - 1);
+	}
+
+	g_byte_array_free (buf, TRUE);
+	g_object_unref (stream);
+}
+
+/* the next "want" lines before what was replayed so far, newest first */
+
+static GPtrArray *
+scrollback_read_older (session *sess, guint want)
+{
+	GPtrArray *lines;
+	GFile *file;
+
+	lines = g_ptr_array_new_with_free_func (g_free);
+
+	while (lines->len < want && sess->scrollreplay_seg != REPLAY_DONE)
+	{
+		if (sess->scrollreplay_seg == REPLAY_CURRENT)
+			file = g_object_ref (sess->scrollfile);
+		else
+			file = scrollback_get_old_file (sess);
+
+		if (file)
+		{
+			scrollback_read_back (file, &sess->scrollreplay_pos, want, lines);
+			g_object_unref (file);
+		}
+
+		if (!file || sess->scrollreplay_pos == 0)
+		{
+			if (sess->scrollreplay_seg == REPLAY_CURRENT)
+				sess->scrollreplay_seg = REPLAY_OLD;
+			else
+				sess->scrollreplay_seg = REPLAY_DONE;
+			sess->scrollreplay_pos = -1;
+		}
+	}
+
+	return lines;
+}
+
+/* FALSE if the frontend had no room left to prepend it */
+
+static gboolean
+scrollback_replay_line (session *sess, char *buf, gboolean prepend, time_t *last_stamp)
+{
+	char *text;
+	time_t stamp = 0;
+	gboolean ret;
+
+	if (!g_utf8_validate (buf, -1, NULL))
+	{
+		g_warning ("Invalid utf8 in scrollback file");
+		return TRUE;
+	}
+
+	/*
+	 * Some scrollback lines have three blanks after the timestamp and a newline
+	 * Some have only one blank and a newline
+	 * Some don't even have a timestamp
+	 * Some don't have any text at all
+	 */
+	if (buf[0] == 'T' && buf[1] == ' ')
+	{
+		if (sizeof (time_t) == 4)
+			stamp = strtoul (buf + 2, NULL, 10);
+		else
+			stamp = g_ascii_strtoull (buf + 2, NULL, 10); /* in case time_t is 64 bits */
+
+		if (G_UNLIKELY(stamp == 0))
+		{
+			g_warning ("Invalid timestamp in scrollback file");
+			return TRUE;
+		}
+
+		text = strchr (buf + 3, ' ');
+		if (text && text[1])
+		{
+			if (prefs.hex_text_stripcolor_replay)
+				text = strip_color (text + 1, -1, STRIP_COLOR);
+			else
+				text = g_strdup (text + 1);
+		}
+		else
+		{
+			text = g_strdup ("  ");
+		}
+	}
+	else
+	{
+		if (strlen (buf))
+			text = g_strdup (buf);
+		else
+			text = g_strdup ("  ");
+	}
+
+	if (prepend)
+	{
+		ret = fe_print_text_prepend (sess, text, stamp);
+	}
+	else
+	{
+		fe_print_text (sess, text, stamp, TRUE);
+		ret = TRUE;
+	}
+	g_free (text);
+
+	if (stamp && last_stamp)
+		*last_stamp = stamp;
+
+	return ret;
+}
+
+/* replay the last page of the scrollback, returns the number of lines */
+
+int
 scrollback_load (session *sess)
 {
-	GInputStream *stream;
-	GDataInputStream *istream;
+	GPtrArray *lines;
 	gchar *buf, *text;
-	gint lines = 0;
+	guint i;
 	time_t stamp = 0;
 
 	if (sess->text_scrollback == SET_DEFAULT)
 	{
 		if (!prefs.hex_text_replay)
-			return;
+			return 0;
 	}
 	else
 	{
 		if (sess->text_scrollback != SET_ON)
-			return;
+			return 0;
 	}
 
 	if (!sess->scrollfile)
 	{
 		if ((buf = scrollback_get_filename (sess)) == NULL)
-			return;
+			return 0;
 
 		sess->scrollfile = g_file_new_for_path (buf);
 		g_free (buf);
 	}
 
-	stream = G_INPUT_STREAM(g_file_read (sess->scrollfile, NULL, NULL));
-	if (!stream)
-		return;
+	/* anything still waiting to be written belongs in the replay */
+	scrollback_flush (sess);
+	log_thread_sync ();
 
-	istream = g_data_input_stream_new (stream);
-	/*
-	 * This is to avoid any issues moving between windows/unix
-	 * but the docs mention an invalid \r without a following \n
-	 * can lock up the program... (Our write() always adds \n)
-	 */
-	g_data_input_stream_set_newline_type (istream, G_DATA_STREAM_NEWLINE_TYPE_ANY);
-	g_object_unref (stream);
-
-	while (1)
-	{
-		GError *err = NULL;
-		gsize n_bytes;
+	sess->scrollwritten = -1;
+	sess->scrollreplay_seg = REPLAY_CURRENT;
+	sess->scrollreplay_pos = -1;
 
-		buf = g_data_input_stream_read_line_utf8 (istream, &n_bytes, NULL, &err);
+	lines = scrollback_read_older (sess, SCROLLBACK_PAGE);
+	for (i = lines->len; i > 0; i--)
+		scrollback_replay_line (sess, g_ptr_array_index (lines, i - 1), FALSE, &stamp);
 
-		if (!err && buf)
-		{
-			/*
-			 * Some scrollback lines have three blanks after the timestamp and a newline
-			 * Some have only one blank and a newline
-			 * Some don't even have a timestamp
-			 * Some don't have any text at all
-			 */
-			if (buf[0] == 'T' && buf[1] == ' ')
-			{
-				if (sizeof (time_t) == 4)
-					stamp = strtoul (buf + 2, NULL, 10);
-				else
-					stamp = g_ascii_strtoull (buf + 2, NULL, 10); /* in case time_t is 64 bits */
+	if (lines->len)
+	{
+		text = ctime (&stamp);
+		buf = g_strdup_printf ("\n*\t%s %s\n", _("Loaded log from"), text);
+		fe_print_text (sess, buf, 0, TRUE);
+		g_free (buf);
+		/*EMIT_SIGNAL (XP_TE_GENMSG, sess, "*", buf, NULL, NULL, NULL, 0);*/
+	}
 
-				if (G_UNLIKELY(stamp == 0))
-				{
-					g_warning ("Invalid timestamp in scrollback file");
-					continue;
-				}
+	i = lines->len;
+	g_ptr_array_free (lines, TRUE);
 
-				text = strchr (buf + 3, ' ');
-				if (text && text[1])
-				{
-					if (prefs.hex_text_stripcolor_replay)
-					{
-						text = strip_color (text + 1, -1, STRIP_COLOR);
-					}
+	return i;
+}
 
-					fe_print_text (sess, text, stamp, TRUE);
+/* Page older lines in above what the frontend already shows, for when
+   the user scrolls to the top. Returns the number of lines added. */
 
-					if (prefs.hex_text_stripcolor_replay)
-					{
-						g_free (text);
-					}
-				}
-				else
-				{
-					fe_print_text (sess, "  ", stamp, TRUE);
-				}
-			}
-			else
-			{
-				if (strlen (buf))
-					fe_print_text (sess, buf, 0, TRUE);
-				else
-					fe_print_text (sess, "  ", 0, TRUE);
-			}
-			lines++;
+int
+scrollback_load_older (session *sess)
+{
+	GPtrArray *lines;
+	guint i;
 
-			g_free (buf);
-		}
-		else if (err)
-		{
-			/* If its only an encoding error it may be specific to the line */
-			if (g_error_matches (err, G_CONVERT_ERROR, G_CONVERT_ERROR_ILLEGAL_SEQUENCE))
-			{
-				g_warning ("Invalid utf8 in scrollback file");
-				g_clear_error (&err);
-				continue;
-			}
+	if (sess->scrollreplay_seg == REPLAY_DONE)
+		return 0;
 
-			/* For general errors just give up */
-			g_clear_error (&err);
-			break;
-		}
-		else /* No new line */
+	lines = scrollback_read_older (sess, SCROLLBACK_PAGE);
+	for (i = 0; i < lines->len; i++)
+	{
+		if (!scrollback_replay_line (sess, g_ptr_array_index (lines, i), TRUE, NULL))
 		{
+			/* the frontend is full, nothing older will fit either */
+			sess->scrollreplay_seg = REPLAY_DONE;
 			break;
 		}
 	}
 
-	g_object_unref (istream);
+	g_ptr_array_free (lines, TRUE);
+
+	return i;
+}
 
-	sess->scrollwritten = lines;
+/* Log lines are collected in sess->logbuf and written out in one go,
+   either once LOG_BUFSIZE is reached or LOG_FLUSH_SECONDS after the
+   first of them. The log file name is only worked out again when the
+   time in hex_irc_logmask may have moved on, see log_next_check(). */
 
-	if (lines)
+#define LOG_BUFSIZE 4096
+#define LOG_FLUSH_SECONDS 1
+#define LOG_CHECK_SECONDS 60
+
+static void
+log_flush (session *sess)
+{
+	if (sess->logflush_tag)
 	{
-		text = ctime (&stamp);
-		buf = g_strdup_printf ("\n*\t%s %s\n", _("Loaded log from"), text);
-		fe_print_text (sess, buf, 0, TRUE);
-		g_free (buf);
-		/*EMIT_SIGNAL (XP_TE_GENMSG, sess, "*", buf, NULL, NULL, NULL, 0);*/
+		fe_timeout_remove (sess->logflush_tag);
+		sess->logflush_tag = 0;
+	}
+
+	if (sess->logbuf && sess->logbuf->len)
+	{
+		if (sess->logfile)
+			log_file_write (sess->logfile, sess->logbuf->str, sess->logbuf->len);
+		g_string_truncate (sess->logbuf, 0);
 	}
 }
 
+static int
+log_flush_cb (session *sess)
+{
+	sess->logflush_tag = 0;
+	log_flush (sess);
+
+	return 0;
+}
+
+/* queue text for sess->logfile, which must be open */
+
+void
+log_write_raw (session *sess, const char *text, gssize len)
+{
+	if (!sess->logbuf)
+		sess->logbuf = g_string_sized_new (LOG_BUFSIZE);
+
+	g_string_append_len (sess->logbuf, text, len);
+
+	if (sess->logbuf->len >= LOG_BUFSIZE)
+		log_flush (sess);
+	else if (!sess->logflush_tag)
+		sess->logflush_tag = fe_timeout_add_seconds (LOG_FLUSH_SECONDS, log_flush_cb, sess);
+}
+
 void
 log_close (session *sess)
 {
 	char obuf[512];
 	time_t currenttime;
 
-	if (sess->logfd != -1)
+	if (sess->logfile)
 	{
 		currenttime = time (NULL);
-		write (sess->logfd, obuf,
+		log_write_raw (sess, obuf,
 			 g_snprintf (obuf, sizeof (obuf) - 1, _("**** ENDING LOGGING AT %s\n"),
 						  ctime (&currenttime)));
-		close (sess->logfd);
-		sess->logfd = -1;
+		log_flush (sess);
+		log_file_close (sess->logfile);
+		sess->logfile = NULL;
+	}
+
+	g_clear_pointer (&sess->logpath, g_free);
+	if (sess->logbuf)
+	{
+		g_string_free (sess->logbuf, TRUE);
+		sess->logbuf = NULL;
 	}
 }
 
@@ -540,46 +848,124 @@ log_create_pathname (char *servname, char *channame, char *netname)
 	return g_strdup (fname);
 }
 
-static int
-log_open_file (char *servname, char *channame, char *netname)
+static char *
+log_session_pathname (session *sess)
+{
+	return log_create_pathname (sess->server->servername, sess->channel,
+										 server_get_network (sess->server, FALSE));
+}
+
+/* The earliest time log_create_pathname() might give another name: when
+   the smallest unit of time used in hex_irc_logmask rolls over. Look
+   again at least every LOG_CHECK_SECONDS anyway, in case the file was
+   moved away. */
+
+static time_t
+log_next_check (time_t now)
+{
+	struct tm tm;
+	time_t next;
+	char *p;
+	int unit = 0;	/* 1 day, 2 hour, 3 minute, 4 second */
+
+	for (p = prefs.hex_irc_logmask; *p; p++)
+	{
+		if (p[0] != '%' || !p[1])
+			continue;
+		p++;
+		/* E and O modifiers */
+		if ((*p == 'E' || *p == 'O') && p[1])
+			p++;
+
+		switch (*p)
+		{
+		case 'c': case 'n': case 's': case '%':	/* log_insert_vars() and escapes */
+			break;
+		case 'S': case 'T': case 'r': case 'X':
+			unit = MAX (unit, 4);
+			break;
+		case 'M': case 'R':
+			unit = MAX (unit, 3);
+			break;
+		case 'H': case 'I': case 'k': case 'l': case 'p': case 'P':
+			unit = MAX (unit, 2);
+			break;
+		default:
+			unit = MAX (unit, 1);
+		}
+	}
+
+	tm = *localtime (&now);
+	switch (unit)
+	{
+	case 4:
+		return now + 1;
+	case 3:
+		tm.tm_min++;
+		tm.tm_sec = 0;
+		break;
+	case 2:
+		tm.tm_hour++;
+		tm.tm_min = tm.tm_sec = 0;
+		break;
+	case 1:
+		tm.tm_mday++;
+		tm.tm_hour = tm.tm_min = tm.tm_sec = 0;
+		break;
+	default:
+		return now + LOG_CHECK_SECONDS;
+	}
+	tm.tm_isdst = -1;
+
+	next = mktime (&tm);
+	if (next == (time_t) -1 || next > now + LOG_CHECK_SECONDS)
+		return now + LOG_CHECK_SECONDS;
+	return next;
+}
+
+/* opened here rather than by log_file_open() so failure can be reported */
+
+static log_file *
+log_open_file (char *file)
 {
 	char buf[512];
 	int fd;
-	char *file;
+	log_file *lf;
 	time_t currenttime;
 
-	file = log_create_pathname (servname, channame, netname);
-	if (!file)
-		return -1;
-
 	fd = g_open (file, O_CREAT | O_APPEND | O_WRONLY | OFLAGS, 0644);
-	g_free (file);
-
 	if (fd == -1)
-		return -1;
+		return NULL;
+
+	lf = log_file_new (fd);
 	currenttime = time (NULL);
-	write (fd, buf,
+	log_file_write (lf, buf,
 			 g_snprintf (buf, sizeof (buf), _("**** BEGIN LOGGING AT %s\n"),
 						  ctime (&currenttime)));
 
-	return fd;
+	return lf;
 }
 
 static void
 log_open (session *sess)
 {
 	static gboolean log_error = FALSE;
+	char *file;
 
 	log_close (sess);
-	sess->logfd = log_open_file (sess->server->servername, sess->channel,
-										  server_get_network (sess->server, FALSE));
 
-	if (!log_error && sess->logfd == -1)
+	file = log_session_pathname (sess);
+	sess->logfile = log_open_file (file);
+	if (sess->logfile)
 	{
-		char *filename = log_create_pathname (sess->server->servername, sess->channel, server_get_network (sess->server, FALSE));
-		char *message = g_strdup_printf (_("* Can't open log file(s) for writing. Check the\npermissions on %s"), filename);
+		sess->logpath = file;
+		sess->logcheck = log_next_check (time (NULL));
+		return;
+	}
 
-		g_free (filename);
+	if (!log_error)
+	{
+		char *message = g_strdup_printf (_("* Can't open log file(s) for writing. Check the\npermissions on %s"), file);
 
 		fe_message (message, FE_MSG_WAIT | FE_MSG_ERROR);
 
@@ -587,6 +973,7 @@ log_open (session *sess)
 
 		log_error = TRUE;
 	}
+	g_free (file);
 }
 
 void
@@ -637,12 +1024,13 @@ get_stamp_str (char *fmt, time_t tim, char **ret)
 }
 
 static void
-log_write (session *sess, char *text, time_t ts)
+log_write (session *sess, char *text, const char *plain, time_t ts)
 {
-	char *temp;
+	char *temp = NULL;
 	char *stamp;
 	char *file;
 	int len;
+	time_t now;
 
 	if (sess->text_logging == SET_DEFAULT)
 	{
@@ -655,50 +1043,56 @@ log_write (session *sess, char *text, time_t ts)
 			return;
 	}
 
-	if (sess->logfd == -1)
+	if (!sess->logfile)
 	{
 		log_open (sess);
 	}
 
 	/* change to a different log file? */
-	file = log_create_pathname (sess->server->servername, sess->channel, server_get_network (sess->server, FALSE));
-	if (file)
+	now = time (NULL);
+	if (sess->logfile && now >= sess->logcheck)
 	{
-		if (g_access (file, F_OK) != 0)
+		file = log_session_pathname (sess);
+		if (strcmp (file, sess->logpath) != 0 || g_access (file, F_OK) != 0)
 		{
-			if (sess->logfd != -1)
-			{
-				close (sess->logfd);
-			}
+			log_flush (sess);
+			log_file_close (sess->logfile);
 
-			sess->logfd = log_open_file (sess->server->servername, sess->channel, server_get_network (sess->server, FALSE));
+			g_free (sess->logpath);
+			sess->logpath = file;
+			sess->logfile = log_open_file (file);
 		}
-
-		g_free (file);
+		else
+		{
+			g_free (file);
+		}
+		sess->logcheck = log_next_check (now);
 	}
 
-	if (sess->logfd == -1)
+	if (!sess->logfile)
 	{
 		return;
 	}
 
 	if (prefs.hex_stamp_log)
 	{
-		if (!ts) ts = time(0);
+		if (!ts) ts = now;
 		len = get_stamp_str (prefs.hex_stamp_log_format, ts, &stamp);
 		if (len)
 		{
-			write (sess->logfd, stamp, len);
+			log_write_raw (sess, stamp, len);
 			g_free (stamp);
 		}
 	}
 
-	temp = strip_color (text, -1, STRIP_ALL);
-	len = strlen (temp);
-	write (sess->logfd, temp, len);
+	/* display_event has it stripped already */
+	if (!plain)
+		plain = temp = strip_color (text, -1, STRIP_ALL);
+	len = strlen (plain);
+	log_write_raw (sess, plain, len);
 	/* lots of scripts/plugins print without a \n at the end */
-	if (temp[len - 1] != '\n')
-		write (sess->logfd, "\n", 1);	/* emulate what xtext would display */
+	if (plain[len - 1] != '\n')
+		log_write_raw (sess, "\n", 1);	/* emulate what xtext would display */
 	g_free (temp);
 }
 
@@ -793,15 +1187,72 @@ text_convert_invalid (const gchar* text, gssize len, GIConv converter, const gch
 	}
 }
 
+/* a word of 0x01 bytes and one of 0x80 bytes */
+#define WORD_ONES ((gsize) -1 / 0xFF)
+#define WORD_HIGHS (WORD_ONES * 0x80)
+
+/**
+ * Checks whether text (up to len bytes, or up to its NUL if len is -1) is
+ * valid UTF-8 without copying it. Runs of ASCII, which is most of what
+ * IRC carries, are checked a machine word at a time; the first non-ASCII
+ * or NUL byte hands the rest over to g_utf8_validate.
+ */
+gboolean
+text_validate_utf8 (const gchar *text, gssize len)
+{
+	const guchar *p = (const guchar *) text;
+	const guchar *end;
+	gsize word;
+
+	if (len < 0)
+		len = strlen (text);
+	end = p + len;
+
+	/* up to the first word boundary */
+	while (p < end && ((gsize) p & (sizeof (gsize) - 1)) && *p != 0 && *p < 0x80)
+		p++;
+
+	if (!((gsize) p & (sizeof (gsize) - 1)))
+	{
+		while (end - p >= (gssize) sizeof (gsize))
+		{
+			memcpy (&word, p, sizeof (word));
+			/* any byte >= 0x80, or any NUL byte */
+			if ((word & WORD_HIGHS) || ((word - WORD_ONES) & ~word & WORD_HIGHS))
+				break;
+			p += sizeof (gsize);
+		}
+	}
+
+	/* also fails on embedded NULs, as g_utf8_make_valid replaces those */
+	return g_utf8_validate ((const gchar *) p, end - p, NULL);
+}
+
 /**
  * Replaces any invalid UTF-8 in the given text with the unicode replacement character.
  */
 gchar *
 text_fixup_invalid_utf8 (const gchar* text, gssize len, gsize *len_out)
 {
+#if GLIB_CHECK_VERSION (2, 52, 0)
+	gchar *result;
+#else
+	static GIConv utf8_fixup_converter = NULL;
+#endif
+
+	/* usually there's nothing to fix, then a plain copy will do */
+	if (len < 0)
+		len = strlen (text);
+	if (text_validate_utf8 (text, len))
+	{
+		if (len_out)
+			*len_out = len;
+		return g_strndup (text, len);
+	}
+
 #if GLIB_CHECK_VERSION (2, 52, 0)
 G_GNUC_BEGIN_IGNORE_DEPRECATIONS
-	gchar *result = g_utf8_make_valid (text, len);
+	result = g_utf8_make_valid (text, len);
 G_GNUC_END_IGNORE_DEPRECATIONS
 	if (len_out)
 	{
@@ -809,7 +1260,6 @@ G_GNUC_END_IGNORE_DEPRECATIONS
 	}
 	return result;
 #else
-	static GIConv utf8_fixup_converter = NULL;
 	if (utf8_fixup_converter == NULL)
 	{
 		utf8_fixup_converter = g_iconv_open ("UTF-8", "UTF-8");
@@ -819,6 +1269,28 @@ G_GNUC_END_IGNORE_DEPRECATIONS
 #endif
 }
 
+/* text has to be valid utf8 that the frontend may write to. plain is the
+   same with all formatting stripped, or NULL */
+
+static void
+print_text (session *sess, char *text, const char *plain, time_t timestamp)
+{
+	BENCH_PUSH (BENCH_LOG);
+	log_write (sess, text, plain, timestamp);
+	BENCH_POP ();
+
+	BENCH_PUSH (BENCH_SCROLLBACK);
+	scrollback_save (sess, text, timestamp);
+	BENCH_POP ();
+
+	BENCH_PUSH (BENCH_FRONTEND);
+	fe_print_text (sess, text, timestamp, FALSE);
+	BENCH_POP ();
+
+	if (bench_latency)
+		bench_latency_note (text);
+}
+
 void
 PrintTextTimeStamp (session *sess, char *text, time_t timestamp)
 {
@@ -829,7 +1301,8 @@ PrintTextTimeStamp (session *sess, char *text, time_t timestamp)
 		sess = (session *) sess_list->data;
 	}
 
-	/* make sure it's valid utf8 */
+	/* make sure it's valid utf8; the copy is needed either way, the
+	   frontend may write to it */
 	if (text[0] == '\0')
 	{
 		text = g_strdup ("\n");
@@ -839,9 +1312,7 @@ PrintTextTimeStamp (session *sess, char *text, time_t timestamp)
 		text = text_fixup_invalid_utf8 (text, -1, NULL);
 	}
 
-	log_write (sess, text, timestamp);
-	scrollback_save (sess, text, timestamp);
-	fe_print_text (sess, text, timestamp, FALSE);
+	print_text (sess, text, NULL, timestamp);
 	g_free (text);
 }
 
@@ -939,6 +1410,56 @@ PrintTextTimeStampf (session *sess, time_t timestamp, const char *format, ...)
 char *pntevts_text[NUM_XP];
 char *pntevts[NUM_XP];
 
+/* pntevts[] compiled into a list of ops, so display_event neither decodes
+   the byte code nor strips the formatting off literal text per line */
+
+enum
+{
+	PEVT_OP_TEXT,
+	PEVT_OP_ARG,
+	PEVT_OP_TAB
+};
+
+struct pevt_op
+{
+	int type;		/* PEVT_OP_* */
+	int arg;			/* PEVT_OP_ARG: index into args[] */
+	int text;		/* PEVT_OP_TEXT: offset of the text in literals */
+	int len;
+	int plain;		/* ... and of it without formatting, -1 if a color code
+						   might run on into whatever follows */
+	int plain_len;
+};
+
+struct pevt_template
+{
+	int num_ops;
+	struct pevt_op *ops;
+	char *literals;
+};
+
+static struct pevt_template *pntevts_tmpl[NUM_XP];
+
+static void
+pevent_template_free (struct pevt_template *tmpl)
+{
+	if (!tmpl)
+		return;
+
+	g_free (tmpl->ops);
+	g_free (tmpl->literals);
+	g_free (tmpl);
+}
+
+/* pntevts[index] was replaced, compile it again on next use */
+
+void
+pevent_template_invalidate (int index)
+{
+	pevent_template_free (pntevts_tmpl[index]);
+	pntevts_tmpl[index] = NULL;
+}
+
 #define pevt_generic_none_help NULL
 
 static char * const pevt_genmsg_help[] = {
@@ -1308,7 +1829,7 @@ static char * const pevt_connect_help[] = {
 };
 
 static char * const pevt_sconnect_help[] = {
-	"PID"
+	N_("Server Name")
 };
 
 static char * const pevt_generic_nick_help[] = {
@@ -1534,6 +2055,7 @@ pevent_make_pntevts (void)
 
 	for (i = 0; i < NUM_XP; i++)
 	{
+		pevent_template_invalidate (i);
 		g_free (pntevts[i]);
 		if (pevt_build_string (pntevts_text[i], &(pntevts[i]), &m) != 0)
 		{
@@ -1713,45 +2235,54 @@ load_text_events ()
 	pevent_make_pntevts ();
 }
 
-/*
-	CL: format_event now handles filtering of arguments:
-	1) if prefs.hex_text_stripcolor_msg is set, filter all style control codes from arguments
-	2) always strip \010 (ATTR_HIDDEN) from arguments: it is only for use in the format string itself
-*/
-#define ARG_FLAG(argn) (1 << (argn))
-
-void
-format_event (session *sess, int index, char **args, char *o, gsize sizeofo, unsigned int stripcolor_args)
+static struct pevt_template *
+pevent_compile (int index)
 {
-	int len, ii, numargs;
-	gsize oi;
-	char *i, *ar, d, a, done_all = FALSE;
+	struct pevt_template *tmpl;
+	struct pevt_op op;
+	GArray *ops;
+	GString *literals;
+	const char *i = pntevts[index];
+	int ii = 0, len, numargs, state[2];
+	char d, a;
 
-	i = pntevts[index];
 	numargs = te[index].num_args & 0x7f;
+	ops = g_array_new (FALSE, FALSE, sizeof (struct pevt_op));
+	literals = g_string_new (NULL);
 
-	oi = ii = len = d = a = 0;
-	o[0] = 0;
-
-	if (i == NULL)
-		return;
-
-	while (done_all == FALSE)
+	/* the byte code always ends in a 2 (see pevt_build_string) */
+	while ((d = i[ii++]) != 2)
 	{
-		d = i[ii++];
+		memset (&op, 0, sizeof (op));
 		switch (d)
 		{
 		case 0:
 			memcpy (&len, &(i[ii]), sizeof (int));
 			ii += sizeof (int);
-			if (oi + len > sizeofo)
-			{
-				printf ("Overflow in display_event (%s)\n", i);
-				o[0] = 0;
-				return;
-			}
-			memcpy (&(o[oi]), &(i[ii]), len);
-			oi += len;
+
+			op.type = PEVT_OP_TEXT;
+			op.text = literals->len;
+			op.len = len;
+			g_string_append_len (literals, &(i[ii]), len);
+
+			/* the last byte of a color code depends on what follows it */
+			op.plain = literals->len;
+			g_string_set_size (literals, op.plain + len);
+			state[0] = state[1] = 0;
+			op.plain_len = 0;
+			if (len > 1)
+				op.plain_len = strip_color_step (&(i[ii]), len - 1, literals->str + op.plain,
+															STRIP_ALL, state);
+			if (state[0] && (isdigit ((unsigned char) i[ii + len - 1]) || i[ii + len - 1] == ','))
+				state[0] = -1;
+			else if (len > 0)
+				op.plain_len += strip_color_step (&(i[ii + len - 1]), 1,
+															 literals->str + op.plain + op.plain_len,
+															 STRIP_ALL, state);
+			g_string_truncate (literals, op.plain + op.plain_len);
+			if (state[0])
+				op.plain = -1;
+
 			ii += len;
 			break;
 		case 1:
@@ -1761,47 +2292,187 @@ format_event (session *sess, int index, char **args, char *o, gsize sizeofo, uns
 				fprintf (stderr,
 							"HexChat DEBUG: display_event: arg > numargs (%d %d %s)\n",
 							a, numargs, i);
-				break;
+				continue;
 			}
-			ar = args[(int) a + 1];
+			op.type = PEVT_OP_ARG;
+			op.arg = a + 1;
+			break;
+		case 3:
+			op.type = PEVT_OP_TAB;
+			break;
+		default:
+			continue;
+		}
+		g_array_append_val (ops, op);
+	}
+
+	tmpl = g_new0 (struct pevt_template, 1);
+	tmpl->num_ops = ops->len;
+	tmpl->ops = (struct pevt_op *) g_array_free (ops, FALSE);
+	tmpl->literals = g_string_free (literals, FALSE);
+
+	return tmpl;
+}
+
+/* strip what's been added to raw since the last call into plain. A trailing
+   digit or ',' waits for the next call, it may still be part of a color */
+
+static void
+pevent_strip_sync (GString *raw, GString *plain, gsize *done, int state[2],
+						 gboolean last)
+{
+	gsize end = raw->len;
+	gsize len;
+
+	if (!last && end > *done &&
+		 (isdigit ((unsigned char) raw->str[end - 1]) || raw->str[end - 1] == ','))
+		end--;
+	if (end <= *done)
+		return;
+
+	len = plain->len;
+	g_string_set_size (plain, len + (end - *done));
+	len += strip_color_step (raw->str + *done, end - *done, plain->str + len,
+									 STRIP_ALL, state);
+	g_string_truncate (plain, len);
+	*done = end;
+}
+
+#define ARG_FLAG(argn) (1 << (argn))
+
+/* formats event index into raw, and in the same go into plain, which is
+   raw with all formatting stripped (what log_write wants). raw ends up
+   empty if there's nothing to print */
+
+static void
+pevent_render (int index, char **args, unsigned int stripcolor_args,
+					GString *raw, GString *plain)
+{
+	struct pevt_template *tmpl;
+	struct pevt_op *op;
+	gsize done = 0, start;	/* done: bytes of raw already in plain */
+	int state[2] = { 0, 0 };
+	int n, len;
+	gboolean caught_up;
+	char *ar;
+
+	g_string_truncate (raw, 0);
+	g_string_truncate (plain, 0);
+
+	if (pntevts[index] == NULL)
+		return;
+
+	tmpl = pntevts_tmpl[index];
+	if (!tmpl)
+		tmpl = pntevts_tmpl[index] = pevent_compile (index);
+
+	for (n = 0; n < tmpl->num_ops; n++)
+	{
+		op = &tmpl->ops[n];
+		caught_up = (done == raw->len && !state[0]);
+
+		switch (op->type)
+		{
+		case PEVT_OP_TEXT:
+			g_string_append_len (raw, tmpl->literals + op->text, op->len);
+			if (caught_up && op->plain >= 0)
+			{
+				g_string_append_len (plain, tmpl->literals + op->plain, op->plain_len);
+				done = raw->len;
+			}
+			break;
+		case PEVT_OP_ARG:
+			ar = args[op->arg];
 			if (ar == NULL)
 			{
-				printf ("arg[%d] is NULL in print event\n", a + 1);
-			} else
+				printf ("arg[%d] is NULL in print event\n", op->arg);
+				break;
+			}
+			start = raw->len;
+			g_string_set_size (raw, start + strlen (ar));
+			if (stripcolor_args & ARG_FLAG(op->arg))
+			{
+				len = strip_color2 (ar, -1, raw->str + start, STRIP_ALL);
+				g_string_truncate (raw, start + len);
+				/* nothing left in it to strip */
+				if (caught_up)
+				{
+					g_string_append_len (plain, raw->str + start, len);
+					done = raw->len;
+				}
+			}
+			else
 			{
-				if (strlen (ar) > sizeofo - oi - 4)
-					ar[sizeofo - oi - 4] = 0;	/* Avoid buffer overflow */
-				if (stripcolor_args & ARG_FLAG(a + 1)) len = strip_color2 (ar, -1, &o[oi], STRIP_ALL);
-				else len = strip_hidden_attribute (ar, &o[oi]);
-				oi += len;
+				len = strip_hidden_attribute (ar, raw->str + start);
+				g_string_truncate (raw, start + len);
 			}
 			break;
-		case 2:
-			o[oi++] = '\n';
-			o[oi++] = 0;
-			done_all = TRUE;
-			continue;
-		case 3:
-			if (prefs.hex_text_indent)
-				o[oi++] = '\t';
-			else
-				o[oi++] = ' ';
+		case PEVT_OP_TAB:
+			g_string_append_c (raw, prefs.hex_text_indent ? '\t' : ' ');
+			if (caught_up)
+			{
+				g_string_append_c (plain, raw->str[done]);
+				done = raw->len;
+			}
 			break;
 		}
+
+		pevent_strip_sync (raw, plain, &done, state, FALSE);
+	}
+
+	g_string_append_c (raw, '\n');
+	pevent_strip_sync (raw, plain, &done, state, TRUE);
+
+	if (raw->str[0] == '\n')
+	{
+		g_string_truncate (raw, 0);
+		g_string_truncate (plain, 0);
 	}
-	o[oi] = 0;
-	if (*o == '\n')
-		o[0] = 0;
 }
 
 static void
 display_event (session *sess, int event, char **args, 
 					unsigned int stripcolor_args, time_t timestamp)
 {
-	char o[4096];
-	format_event (sess, event, args, o, sizeof (o), stripcolor_args);
-	if (o[0])
-		PrintTextTimeStamp (sess, o, timestamp);
+	static GString *raw_buf = NULL, *plain_buf = NULL;
+	static gboolean busy = FALSE;
+	GString *raw, *plain;
+
+	/* reuse one pair of buffers, unless printing gets back in here */
+	if (busy)
+	{
+		raw = g_string_sized_new (256);
+		plain = g_string_sized_new (256);
+	}
+	else
+	{
+		if (!raw_buf)
+		{
+			raw_buf = g_string_sized_new (512);
+			plain_buf = g_string_sized_new (512);
+		}
+		raw = raw_buf;
+		plain = plain_buf;
+		busy = TRUE;
+	}
+
+	pevent_render (event, args, stripcolor_args, raw, plain);
+	if (raw->len)
+	{
+		/* raw is ours, so the frontend may write to it without a copy */
+		if (text_validate_utf8 (raw->str, raw->len))
+			print_text (sess, raw->str, plain->str, timestamp);
+		else
+			PrintTextTimeStamp (sess, raw->str, timestamp);
+	}
+
+	if (raw == raw_buf)
+		busy = FALSE;
+	else
+	{
+		g_string_free (raw, TRUE);
+		g_string_free (plain, TRUE);
+	}
 }
 
 int
@@ -2016,9 +2687,9 @@ text_color_of (char *name)
 
 /* called by EMIT_SIGNAL macro */
 
-void
-text_emit (int index, session *sess, char *a, char *b, char *c, char *d,
-			  time_t timestamp)
+static void
+text_emit_real (int index, session *sess, char *a, char *b, char *c, char *d,
+					 time_t timestamp)
 {
 	char *word[PDIWORDS];
 	int i;
@@ -2117,6 +2788,15 @@ text_emit (int index, session *sess, char *a, char *b, char *c, char *d,
 	display_event (sess, index, word, stripcolor_args, timestamp);
 }
 
+void
+text_emit (int index, session *sess, char *a, char *b, char *c, char *d,
+			  time_t timestamp)
+{
+	BENCH_PUSH (BENCH_EMIT);
+	text_emit_real (index, sess, a, b, c, d, timestamp);
+	BENCH_POP ();
+}
+
 char *
 text_find_format_string (char *name)
 {
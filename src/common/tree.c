@@ -18,8 +18,10 @@
  */
 
 /*
-This is used for quick userlist insertion and lookup. It's not really
-a tree, but it could be :)
+This is used for quick userlist insertion and lookup. It is a B+tree
+where every node knows how many items are below it, so lookups,
+insertions and removals are O(log n) and still report the position
+(row number) of an item, which the frontends rely on.
 */
 
 #include <stdio.h>
@@ -28,158 +30,375 @@ a tree, but it could be :)
 
 #include "tree.h"
 
-#define ARRAY_GROW 32
+#define TREE_MAX 32					/* slots per node, split when full */
+#define TREE_MIN (TREE_MAX / 2)	/* fewer than this and it borrows or merges */
+
+typedef struct _tree_node tree_node;
+
+struct _tree_node
+{
+	int n;								/* slots in use */
+	int total;							/* items in this subtree */
+	int leaf;
+	void *slot[TREE_MAX];			/* leaf: the items, otherwise child nodes */
+	void *low[TREE_MAX];				/* smallest item below each child (not in leaves) */
+};
 
 struct _tree
 {
-	int elements;
-	int array_size;
-	void **array;
+	tree_node *root;
 	tree_cmp_func *cmp;
 	void *data;
 };
 
-tree *
-tree_new (tree_cmp_func *cmp, void *data)
+static tree_node *
+node_new (int leaf)
 {
-	tree *t = g_new0 (tree, 1);
-	t->cmp = cmp;
-	t->data = data;
-	return t;
+	tree_node *node = g_new (tree_node, 1);
+	node->n = 0;
+	node->total = 0;
+	node->leaf = leaf;
+	return node;
 }
 
-void
-tree_destroy (tree *t)
+static void
+node_free (tree_node *node)
 {
-	if (t)
+	int i;
+
+	if (!node->leaf)
 	{
-		g_free (t->array);
-		g_free (t);
+		for (i = 0; i < node->n; i++)
+			node_free (node->slot[i]);
 	}
+	g_free (node);
 }
 
+static void *
+node_first (tree_node *node)
+{
+	return node->leaf ? node->slot[0] : node->low[0];
+}
+
+/* number of items held by slot i */
 static int
-tree_find_insertion_pos (tree *t, void *key, int *done)
+node_weight (tree_node *node, int i)
 {
-	int c, u, l, idx;
+	return node->leaf ? 1 : ((tree_node *)node->slot[i])->total;
+}
 
-	if (t->elements < 1)
+static void
+node_insert_slot (tree_node *node, int i, void *slot, void *low)
+{
+	memmove (&node->slot[i + 1], &node->slot[i], (node->n - i) * sizeof (void *));
+	node->slot[i] = slot;
+	if (!node->leaf)
 	{
-		*done = 1;
-		t->array[0] = key;
-		t->elements++;
-		return 0;
+		memmove (&node->low[i + 1], &node->low[i], (node->n - i) * sizeof (void *));
+		node->low[i] = low;
 	}
+	node->n++;
+}
+
+static void *
+node_remove_slot (tree_node *node, int i)
+{
+	void *slot = node->slot[i];
+
+	node->n--;
+	memmove (&node->slot[i], &node->slot[i + 1], (node->n - i) * sizeof (void *));
+	if (!node->leaf)
+		memmove (&node->low[i], &node->low[i + 1], (node->n - i) * sizeof (void *));
+	return slot;
+}
+
+/* move "count" slots from the end of "src" to the start of "dst",
+   or from the start of "src" to the end of "dst" */
 
-	if (t->elements < 2)
+static void
+node_shift_right (tree_node *src, tree_node *dst, int count)
+{
+	int i, w = 0;
+
+	for (i = src->n - count; i < src->n; i++)
+		w += node_weight (src, i);
+
+	memmove (&dst->slot[count], &dst->slot[0], dst->n * sizeof (void *));
+	memcpy (&dst->slot[0], &src->slot[src->n - count], count * sizeof (void *));
+	if (!src->leaf)
 	{
-		*done = 1;
-		c = t->cmp (key, t->array[0], t->data);
-		if (c == 0)
-			return -1;
-		t->elements++;
-		if (c > 0)
+		memmove (&dst->low[count], &dst->low[0], dst->n * sizeof (void *));
+		memcpy (&dst->low[0], &src->low[src->n - count], count * sizeof (void *));
+	}
+	src->n -= count;
+	dst->n += count;
+	src->total -= w;
+	dst->total += w;
+}
+
+static void
+node_shift_left (tree_node *src, tree_node *dst, int count)
+{
+	int i, w = 0;
+
+	for (i = 0; i < count; i++)
+		w += node_weight (src, i);
+
+	memcpy (&dst->slot[dst->n], &src->slot[0], count * sizeof (void *));
+	memmove (&src->slot[0], &src->slot[count], (src->n - count) * sizeof (void *));
+	if (!src->leaf)
+	{
+		memcpy (&dst->low[dst->n], &src->low[0], count * sizeof (void *));
+		memmove (&src->low[0], &src->low[count], (src->n - count) * sizeof (void *));
+	}
+	src->n -= count;
+	dst->n += count;
+	src->total -= w;
+	dst->total += w;
+}
+
+/* insert "item" at position "pos" of this subtree. Returns the new right
+   half if the node had to be split, for the parent to adopt. */
+
+static tree_node *
+node_insert (tree_node *node, int pos, void *item)
+{
+	tree_node *child, *split;
+	int i;
+
+	if (node->leaf)
+	{
+		node_insert_slot (node, pos, item, NULL);
+	} else
+	{
+		/* an item between two children goes to the end of the left one */
+		for (i = 0; i < node->n - 1; i++)
 		{
-			t->array[1] = key;
-			return 1;
+			child = node->slot[i];
+			if (pos <= child->total)
+				break;
+			pos -= child->total;
 		}
-		t->array[1] = t->array[0];
-		t->array[0] = key;
-		return 0;
+		child = node->slot[i];
+
+		split = node_insert (child, pos, item);
+		node->low[i] = node_first (child);
+		if (split)
+			node_insert_slot (node, i + 1, split, node_first (split));
 	}
+	node->total++;
+
+	if (node->n < TREE_MAX)
+		return NULL;
 
-	*done = 0;
+	split = node_new (node->leaf);
+	node_shift_right (node, split, TREE_MAX / 2);
+	return split;
+}
 
-	c = t->cmp (key, t->array[0], t->data);
-	if (c < 0)
-		return 0;	/* prepend */
+/* child i has too few slots, borrow from a sibling or merge with one */
 
-	c = t->cmp (key, t->array[t->elements - 1], t->data);
-	if (c > 0)
-		return t->elements;	/* append */
+static void
+node_rebalance (tree_node *node, int i)
+{
+	tree_node *child = node->slot[i];
+	tree_node *left = i > 0 ? node->slot[i - 1] : NULL;
+	tree_node *right = i < node->n - 1 ? node->slot[i + 1] : NULL;
 
-	l = 0;
-	u = t->elements - 1;
-	while (1)
+	if (left && left->n > TREE_MIN)
 	{
-		idx = (l + u) / 2;
-		c = t->cmp (key, t->array[idx], t->data);
+		node_shift_right (left, child, 1);
+		node->low[i] = node_first (child);
+	}
+	else if (right && right->n > TREE_MIN)
+	{
+		node_shift_left (right, child, 1);
+		node->low[i] = node_first (child);
+		node->low[i + 1] = node_first (right);
+	}
+	else if (left)
+	{
+		node_shift_left (child, left, child->n);
+		node_remove_slot (node, i);
+		g_free (child);
+	}
+	else if (right)
+	{
+		node_shift_left (right, child, right->n);
+		node_remove_slot (node, i + 1);
+		g_free (right);
+		node->low[i] = node_first (child);
+	}
+	else if (child->n > 0)
+	{
+		/* an only child, happens below the root only */
+		node->low[i] = node_first (child);
+	}
+}
 
-		if (0 > c)
-			u = idx;
-		else if (0 < c && 0 > t->cmp (key, t->array[idx+1], t->data))
-			return idx + 1;
-		else if (c == 0)
-			return -1;
-		else
-			l = idx + 1;
+static void *
+node_remove (tree_node *node, int pos)
+{
+	tree_node *child;
+	void *item;
+	int i;
+
+	node->total--;
+
+	if (node->leaf)
+		return node_remove_slot (node, pos);
+
+	for (i = 0; i < node->n - 1; i++)
+	{
+		child = node->slot[i];
+		if (pos < child->total)
+			break;
+		pos -= child->total;
 	}
+	child = node->slot[i];
+
+	item = node_remove (child, pos);
+	if (child->n < TREE_MIN)
+		node_rebalance (node, i);
+	else
+		node->low[i] = node_first (child);
+
+	return item;
 }
 
-static void
-tree_insert_at_pos (tree *t, void *key, int pos)
+/* index of the last child whose smallest item is <= key, -1 if none */
+
+static int
+node_search_low (tree_node *node, const void *key, tree_cmp_func *cmp, void *data)
 {
-	int post_bytes;
+	int l = 0, u = node->n, idx;
 
-	/* append is easy */
-	if (pos != t->elements)
+	while (l < u)
 	{
-		post_bytes = (t->elements - pos) * sizeof (void *);
-		memmove (&t->array[pos + 1], &t->array[pos], post_bytes);
+		idx = (l + u) / 2;
+		if (cmp (key, node->low[idx], data) < 0)
+			u = idx;
+		else
+			l = idx + 1;
 	}
 
-	t->array[pos] = key;
-	t->elements++;
+	return l - 1;
 }
 
-static void *
-mybsearch (const void *key, void **array, size_t nmemb,
-			  int (*compar) (const void *, const void *, void *data), void *data, int *pos)
+/* position of the first item >= key, with *found set if it's equal */
+
+static int
+tree_lower_bound (tree *t, const void *key, tree_cmp_func *cmp, void *data, void **found)
 {
-	int l, u, idx;
-	int comparison;
+	tree_node *node = t->root;
+	int i, l, u, idx, c, pos = 0;
+
+	*found = NULL;
+
+	while (!node->leaf)
+	{
+		i = node_search_low (node, key, cmp, data);
+		if (i < 0)
+			return pos;		/* smaller than everything in here */
+		for (idx = 0; idx < i; idx++)
+			pos += ((tree_node *)node->slot[idx])->total;
+		node = node->slot[i];
+	}
 
 	l = 0;
-	u = nmemb;
+	u = node->n;
 	while (l < u)
 	{
 		idx = (l + u) / 2;
-		comparison = (*compar) (key, array[idx], data);
-		if (comparison < 0)
-			u = idx;
-		else if (comparison > 0)
+		c = cmp (key, node->slot[idx], data);
+		if (c > 0)
 			l = idx + 1;
 		else
-		{
-			*pos = idx;
-			return array[idx];
-		}
+			u = idx;
 	}
 
-	return NULL;
+	if (l < node->n && cmp (key, node->slot[l], data) == 0)
+		*found = node->slot[l];
+
+	return pos + l;
+}
+
+tree *
+tree_new (tree_cmp_func *cmp, void *data)
+{
+	tree *t = g_new0 (tree, 1);
+	t->root = node_new (1);
+	t->cmp = cmp;
+	t->data = data;
+	return t;
+}
+
+void
+tree_destroy (tree *t)
+{
+	if (t)
+	{
+		node_free (t->root);
+		g_free (t);
+	}
 }
 
 void *
 tree_find (tree *t, const void *key, tree_cmp_func *cmp, void *data, int *pos)
 {
-	if (!t || !t->array)
+	void *found;
+	int at;
+
+	if (!t)
+		return NULL;
+
+	at = tree_lower_bound (t, key, cmp, data, &found);
+	if (found)
+		*pos = at;
+	return found;
+}
+
+void *
+tree_nth (tree *t, int pos)
+{
+	tree_node *node = t->root;
+	tree_node *child;
+	int i;
+
+	if (pos < 0 || pos >= node->total)
 		return NULL;
 
-	return mybsearch (key, &t->array[0], t->elements, cmp, data, pos);
+	while (!node->leaf)
+	{
+		for (i = 0; i < node->n - 1; i++)
+		{
+			child = node->slot[i];
+			if (pos < child->total)
+				break;
+			pos -= child->total;
+		}
+		node = node->slot[i];
+	}
+
+	return node->slot[pos];
 }
 
 void *
 tree_remove_at_pos (tree *t, int pos)
 {
-	int post_bytes;
-	void *ret = t->array[pos];
+	tree_node *root;
+	void *ret;
+
+	ret = node_remove (t->root, pos);
 
-	t->elements--;
-	if (pos != t->elements)
+	/* the root lost all but one child, that child is the new root */
+	root = t->root;
+	if (!root->leaf && root->n == 1)
 	{
-		post_bytes = (t->elements - pos) * sizeof (void *);
-		memmove (&t->array[pos], &t->array[pos + 1], post_bytes);
+		t->root = root->slot[0];
+		g_free (root);
 	}
+
 	return ret;
 }
 
@@ -196,59 +415,78 @@ tree_remove (tree *t, void *key, int *pos)
 	return 1;
 }
 
+static int
+node_foreach (tree_node *node, tree_traverse_func *func, void *data)
+{
+	int i;
+
+	for (i = 0; i < node->n; i++)
+	{
+		if (node->leaf)
+		{
+			if (!func (node->slot[i], data))
+				return 0;
+		}
+		else if (!node_foreach (node->slot[i], func, data))
+			return 0;
+	}
+
+	return 1;
+}
+
 void
 tree_foreach (tree *t, tree_traverse_func *func, void *data)
 {
-	int j;
-
-	if (!t || !t->array)
+	if (!t)
 		return;
 
-	for (j = 0; j < t->elements; j++)
-	{
-		if (!func (t->array[j], data))
-			break;
-	}
+	node_foreach (t->root, func, data);
 }
 
 static void
-tree_grow (tree *t)
+tree_insert_at_pos (tree *t, void *key, int pos)
 {
-	if (t->array_size < t->elements + 1)
-	{
-		int new_size = t->array_size + ARRAY_GROW;
+	tree_node *split, *root;
 
-		t->array = realloc (t->array, sizeof (void *) * new_size);
-		t->array_size = new_size;
+	split = node_insert (t->root, pos, key);
+	if (split)
+	{
+		/* the root was split, grow a level */
+		root = node_new (0);
+		root->slot[0] = t->root;
+		root->low[0] = node_first (t->root);
+		root->slot[1] = split;
+		root->low[1] = node_first (split);
+		root->n = 2;
+		root->total = t->root->total + split->total;
+		t->root = root;
 	}
-
 }
 
 int
 tree_insert (tree *t, void *key)
 {
-	int pos, done;
+	void *found;
+	int pos;
 
 	if (!t)
 		return -1;
 
-	tree_grow (t);
-	pos = tree_find_insertion_pos (t, key, &done);
-	if (!done && pos != -1)
-		tree_insert_at_pos (t, key, pos);
+	pos = tree_lower_bound (t, key, t->cmp, t->data, &found);
+	if (found)
+		return -1;
 
+	tree_insert_at_pos (t, key, pos);
 	return pos;
 }
 
 void
 tree_append (tree *t, void *key)
 {
-	tree_grow (t);
-	tree_insert_at_pos (t, key, t->elements);
+	tree_insert_at_pos (t, key, t->root->total);
 }
 
 int tree_size (tree *t)
 {
-	return t->elements;
+	return t->root->total;
 }
-
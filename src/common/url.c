@@ -32,6 +32,10 @@
 
 void *url_tree = NULL;
 GTree *url_btree = NULL;
+static GPtrArray *url_pending = NULL;	/* grabbed URLs not yet shown by the fe */
+static int url_pending_tag = 0;
+static FILE *url_log = NULL;	/* url.log, open only inside url_check_line () */
+static gboolean url_has_scheme (const char *text);
 static gboolean regex_match (const GRegex *re, const char *word,
 							 int *start, int *end);
 static const GRegex *re_url (void);
@@ -57,9 +61,52 @@ url_free (char *url, void *data)
 	return TRUE;
 }
 
+static void
+url_pending_free (void)
+{
+	if (url_pending_tag)
+	{
+		fe_timeout_remove (url_pending_tag);
+		url_pending_tag = 0;
+	}
+	if (url_pending)
+	{
+		g_ptr_array_free (url_pending, TRUE);
+		url_pending = NULL;
+	}
+}
+
+/* hand the URLs grabbed since the last flush to the fe in one go */
+void
+url_flush (void)
+{
+	GPtrArray *pending = url_pending;
+
+	url_pending = NULL;
+	if (url_pending_tag)
+	{
+		fe_timeout_remove (url_pending_tag);
+		url_pending_tag = 0;
+	}
+	if (pending)
+	{
+		fe_url_add_list ((char **)pending->pdata, pending->len);
+		g_ptr_array_free (pending, TRUE);
+	}
+}
+
+static int
+url_flush_cb (void *unused)
+{
+	url_pending_tag = 0;
+	url_flush ();
+	return 0;
+}
+
 void
 url_clear (void)
 {
+	url_pending_free ();
 	tree_foreach (url_tree, (tree_traverse_func *)url_free, NULL);
 	tree_destroy (url_tree);
 	url_tree = NULL;
@@ -93,17 +140,15 @@ url_save_tree (const char *fname, const char *mode, gboolean fullpath)
 static void
 url_save_node (char* url)
 {
-	FILE *fd;
-
-	/* open <config>/url.log in append mode */
-	fd = hexchat_fopen_file ("url.log", "a", 0);
-	if (fd == NULL)
+	/* open <config>/url.log in append mode, once per line of text */
+	if (url_log == NULL)
+		url_log = hexchat_fopen_file ("url.log", "a", 0);
+	if (url_log == NULL)
 	{
 		return;
 	}
 
-	fprintf (fd, "%s\n", url);
-	fclose (fd);	
+	fprintf (url_log, "%s\n", url);
 }
 
 static int
@@ -180,7 +225,13 @@ url_add (char *urltext, int len)
 
 	tree_append (url_tree, data);
 	g_tree_insert (url_btree, data, GINT_TO_POINTER (tree_size (url_tree) - 1));
-	fe_url_add (data);
+
+	/* the tree may drop 'data' before the fe sees it, so queue a copy */
+	if (!url_pending)
+		url_pending = g_ptr_array_new_with_free_func (g_free);
+	g_ptr_array_add (url_pending, g_strdup (data));
+	if (!url_pending_tag)
+		url_pending_tag = fe_timeout_add (250, url_flush_cb, NULL);
 }
 
 /* check if a word is clickable. This is called on mouse motion events, so
@@ -333,6 +384,10 @@ url_check_line (char *buf)
 	char *po = buf;
 	size_t i;
 
+	/* url_add () would throw everything away */
+	if (!prefs.hex_url_grabber && !prefs.hex_url_logging)
+		return;
+
 	/* Skip over message prefix */
 	if (*po == ':')
 	{
@@ -362,6 +417,10 @@ url_check_line (char *buf)
 		return;
 	po++;
 
+	/* most lines have no URL at all, don't run the regex on those */
+	if (!url_has_scheme (po))
+		return;
+
 	g_regex_match(re_url(), po, 0, &gmi);
 	while (g_match_info_matches(gmi))
 	{
@@ -374,6 +433,12 @@ url_check_line (char *buf)
 		g_match_info_next(gmi, NULL);
 	}
 	g_match_info_free(gmi);
+
+	if (url_log)
+	{
+		fclose (url_log);
+		url_log = NULL;
+	}
 }
 
 int
@@ -539,6 +604,48 @@ struct
 	{ NULL,        "",  0}
 };
 
+/* Every match of re_url () starts with one of the schemes above and a
+   colon, and the regex isn't anchored, so a scheme only has to end right
+   before some ':' in the text.  This is cheap enough to run on every line. */
+static gboolean
+url_has_scheme (const char *text)
+{
+	static guchar min_len, max_len;
+	const char *colon, *start;
+	int i, len, slen;
+
+	if (!max_len)
+	{
+		min_len = 255;
+		for (i = 0; uri[i].scheme; i++)
+		{
+			slen = strlen (uri[i].scheme);
+			min_len = MIN (min_len, slen);
+			max_len = MAX (max_len, slen);
+		}
+	}
+
+	for (colon = strchr (text, ':'); colon; colon = strchr (colon + 1, ':'))
+	{
+		/* schemes are all alphanumeric, look at the run before the colon */
+		start = colon;
+		while (start > text && colon - start < max_len && g_ascii_isalnum (start[-1]))
+			start--;
+		len = colon - start;
+		if (len < min_len)
+			continue;
+
+		for (i = 0; uri[i].scheme; i++)
+		{
+			slen = strlen (uri[i].scheme);
+			if (slen <= len && g_ascii_strncasecmp (colon - slen, uri[i].scheme, slen) == 0)
+				return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
 static const GRegex *
 re_url_no_scheme (void)
 {
@@ -33,6 +33,7 @@ extern void *url_tree;
 #define WORD_PATH    -2
 
 void url_clear (void);
+void url_flush (void);
 void url_save_tree (const char *fname, const char *mode, gboolean fullpath);
 int url_last (int *, int *);
 int url_check_word (const char *word);
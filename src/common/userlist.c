@@ -25,6 +25,7 @@
 #include "fe.h"
 #include "notify.h"
 #include "tree.h"
+#include "server.h"
 #include "hexchatc.h"
 #include "util.h"
 
@@ -58,6 +59,128 @@ nick_cmp_alpha (struct User *user1, struct User *user2, server *serv)
 	return serv->p_cmp (user1->nick, user2->nick);
 }
 
+/* serv->user_index maps each nick to the sessions it is in, so that
+   QUIT, NICK and friends only have to visit those channels. */
+
+/* serv->account_index holds the account inbound_account last gave every
+   User of a nick. Anything else that may leave those Users disagreeing
+   drops the nick's entry, so a hit means there is nothing to update. */
+
+static void
+userlist_account_forget (server *serv, const char *nick)
+{
+	if (serv->account_index)
+		g_hash_table_remove (serv->account_index, nick);
+}
+
+static void
+userlist_index_add (session *sess, struct User *user)
+{
+	server *serv = sess->server;
+	GPtrArray *sessions;
+
+	userlist_account_forget (serv, user->nick);
+
+	if (!serv->user_index)
+		serv->user_index = server_casemap_table_new (serv, g_free,
+																	(GDestroyNotify) g_ptr_array_unref);
+
+	sessions = g_hash_table_lookup (serv->user_index, user->nick);
+	if (!sessions)
+	{
+		sessions = g_ptr_array_sized_new (1);
+		g_hash_table_insert (serv->user_index, g_strdup (user->nick), sessions);
+	}
+	g_ptr_array_add (sessions, sess);
+}
+
+static void
+userlist_index_remove (session *sess, struct User *user)
+{
+	server *serv = sess->server;
+	GPtrArray *sessions;
+
+	if (!serv->user_index)
+		return;
+
+	sessions = g_hash_table_lookup (serv->user_index, user->nick);
+	if (!sessions)
+		return;
+
+	userlist_account_forget (serv, user->nick);
+	g_ptr_array_remove_fast (sessions, sess);
+	if (sessions->len == 0)
+		g_hash_table_remove (serv->user_index, user->nick);
+}
+
+static int
+index_add_cb (struct User *user, session *sess)
+{
+	userlist_index_add (sess, user);
+	return TRUE;
+}
+
+/* call after serv->p_cmp changed */
+
+void
+userlist_index_rebuild (server *serv)
+{
+	GSList *list;
+	session *sess;
+
+	g_clear_pointer (&serv->user_index, g_hash_table_destroy);
+	g_clear_pointer (&serv->account_index, g_hash_table_destroy);
+
+	for (list = sess_list; list; list = list->next)
+	{
+		sess = list->data;
+		if (sess->server == serv)
+			tree_foreach (sess->usertree, (tree_traverse_func *)index_add_cb, sess);
+	}
+}
+
+/* returns the sessions "name" is in, free the list with g_slist_free() */
+
+/* Users still queued from a NAMES burst are not in serv->user_index
+   yet, so anything looking a nick up server-wide must flush them first
+   or it would miss those channels. */
+
+static void
+userlist_names_flush_server (server *serv)
+{
+	GSList *list;
+	session *sess;
+
+	for (list = sess_list; list && serv->names_pending; list = list->next)
+	{
+		sess = list->data;
+		if (sess->server == serv && sess->names_pending)
+			userlist_names_flush (sess);
+	}
+}
+
+GSList *
+userlist_find_sessions (server *serv, const char *name)
+{
+	GPtrArray *sessions;
+	GSList *list = NULL;
+	guint i;
+
+	if (serv->names_pending)
+		userlist_names_flush_server (serv);
+	if (!serv->user_index)
+		return NULL;
+
+	sessions = g_hash_table_lookup (serv->user_index, name);
+	if (!sessions)
+		return NULL;
+
+	for (i = 0; i < sessions->len; i++)
+		list = g_slist_prepend (list, g_ptr_array_index (sessions, i));
+
+	return list;
+}
+
 /*
  insert name in appropriate place in linked list. Returns row number or:
   -1: duplicate
@@ -101,6 +224,8 @@ userlist_set_account (struct session *sess, char *nick, char *account)
 	user = userlist_find (sess, nick);
 	if (user)
 	{
+		userlist_account_forget (sess->server, nick);
+
 		if (strcmp (account, "*") == 0)
 		{
 			g_clear_pointer (&user->account, g_free);
@@ -115,6 +240,42 @@ userlist_set_account (struct session *sess, char *nick, char *account)
 	}
 }
 
+/* set nick's account ("*" for none) in every session it's in. Usually
+   nothing changed since the last message, which costs one lookup */
+
+void
+userlist_set_account_global (server *serv, char *nick, char *account)
+{
+	GPtrArray *sessions;
+	const char *known;
+	guint i;
+
+	/* before the account_index check, it doesn't cover those yet */
+	if (serv->names_pending)
+		userlist_names_flush_server (serv);
+
+	if (serv->account_index)
+	{
+		known = g_hash_table_lookup (serv->account_index, nick);
+		if (known && strcmp (known, account) == 0)
+			return;
+	}
+
+	if (!serv->user_index)
+		return;
+	sessions = g_hash_table_lookup (serv->user_index, nick);
+	if (!sessions)
+		return;
+
+	for (i = 0; i < sessions->len; i++)
+		userlist_set_account (g_ptr_array_index (sessions, i), nick, account);
+
+	if (!serv->account_index)
+		serv->account_index = server_casemap_table_new (serv, g_free, NULL);
+	g_hash_table_insert (serv->account_index, g_strdup (nick),
+								(char *) g_intern_string (account));
+}
+
 int
 userlist_add_hostname (struct session *sess, char *nick, char *hostname,
 							  char *realname, char *servername, char *account, unsigned int away)
@@ -140,7 +301,10 @@ userlist_add_hostname (struct session *sess, char *nick, char *hostname,
 		if (!user->servername && servername)
 			user->servername = g_strdup (servername);
 		if (!user->account && account && strcmp (account, "0") != 0)
+		{
+			userlist_account_forget (sess->server, nick);
 			user->account = g_strdup (account);
+		}
 		if (away != 0xff)
 		{
 			if (user->away != away)
@@ -169,10 +333,25 @@ free_user (struct User *user, gpointer data)
 	return TRUE;
 }
 
+static int
+unindex_user (struct User *user, session *sess)
+{
+	userlist_index_remove (sess, user);
+	return free_user (user, NULL);
+}
+
 void
 userlist_free (session *sess)
 {
-	tree_foreach (sess->usertree, (tree_traverse_func *)free_user, NULL);
+	if (sess->names_pending)
+	{
+		g_ptr_array_foreach (sess->names_pending, (GFunc)free_user, NULL);
+		g_ptr_array_free (sess->names_pending, TRUE);
+		sess->names_pending = NULL;
+		sess->server->names_pending--;
+	}
+
+	tree_foreach (sess->usertree, (tree_traverse_func *)unindex_user, sess);
 	tree_destroy (sess->usertree);
 
 	sess->usertree = NULL;
@@ -203,6 +382,9 @@ userlist_find (struct session *sess, const char *name)
 {
 	int pos;
 
+	if (sess->names_pending)
+		userlist_names_flush (sess);
+
 	if (sess->usertree)
 		return tree_find (sess->usertree, name,
 								(tree_cmp_func *)find_cmp, sess->server, &pos);
@@ -213,21 +395,19 @@ userlist_find (struct session *sess, const char *name)
 struct User *
 userlist_find_global (struct server *serv, char *name)
 {
-	struct User *user;
-	session *sess;
-	GSList *list = sess_list;
-	while (list)
-	{
-		sess = (session *) list->data;
-		if (sess->server == serv)
-		{
-			user = userlist_find (sess, name);
-			if (user)
-				return user;
-		}
-		list = list->next;
-	}
-	return NULL;
+	GPtrArray *sessions;
+
+	if (serv->names_pending)
+		userlist_names_flush_server (serv);
+
+	if (!serv->user_index)
+		return NULL;
+
+	sessions = g_hash_table_lookup (serv->user_index, name);
+	if (!sessions)
+		return NULL;
+
+	return userlist_find (g_ptr_array_index (sessions, 0), name);
 }
 
 static void
@@ -312,9 +492,11 @@ userlist_change (struct session *sess, char *oldname, char *newname)
 	{
 		tree_remove (sess->usertree, user, &pos);
 		fe_userlist_remove (sess, user);
+		userlist_index_remove (sess, user);
 
 		safe_strcpy (user->nick, newname, NICKLEN);
 
+		userlist_index_add (sess, user);
 		tree_insert (sess->usertree, user);
 		fe_userlist_insert (sess, user, FALSE);
 
@@ -354,16 +536,17 @@ userlist_remove_user (struct session *sess, struct User *user)
 	if (user == sess->me)
 		sess->me = NULL;
 
+	userlist_index_remove (sess, user);
 	tree_remove (sess->usertree, user, &pos);
 	free_user (user, NULL);
 }
 
-void
-userlist_add (struct session *sess, char *name, char *hostname,
-				  char *account, char *realname, const message_tags_data *tags_data)
+static struct User *
+userlist_user_new (session *sess, char *name, char *hostname, char *account,
+						 char *realname, const message_tags_data *tags_data)
 {
 	struct User *user;
-	int row, prefix_chars;
+	int prefix_chars;
 	unsigned int acc;
 
 	acc = nick_access (sess->server, name, &prefix_chars);
@@ -394,37 +577,135 @@ userlist_add (struct session *sess, char *name, char *hostname,
 			user->realname = g_strdup (realname);
 	}
 
-	row = userlist_insertname (sess, user);
-
-	/* duplicate? some broken servers trigger this */
-	if (row == -1)
-	{
-		g_free (user->hostname);
-		g_free (user->account);
-		g_free (user->realname);
-		g_free (user);
-		return;
-	}
-
-	sess->total++;
-
 	/* most ircds don't support multiple modechars in front of the nickname
-      for /NAMES - though they should. */
+      for /NAMES - though they should. The session counts are bumped by
+      userlist_user_added(), once the user made it into the usertree. */
 	while (prefix_chars)
 	{
-		update_counts (sess, user, name[0], TRUE, 1);
+		update_counts (sess, user, name[0], TRUE, 0);
 		name++;
 		prefix_chars--;
 	}
 
+	return user;
+}
+
+/* account for a user that was just put into sess->usertree */
+
+static void
+userlist_user_added (session *sess, struct User *user)
+{
+	sess->total++;
+	userlist_index_add (sess, user);
+
+	sess->ops += user->op;
+	sess->hops += user->hop;
+	sess->voices += user->voice;
+
 	if (user->me)
 		sess->me = user;
+}
+
+static void
+userlist_insert_user (session *sess, struct User *user)
+{
+	/* duplicate? some broken servers trigger this */
+	if (userlist_insertname (sess, user) == -1)
+	{
+		free_user (user, NULL);
+		return;
+	}
 
+	userlist_user_added (sess, user);
 	fe_userlist_insert (sess, user, FALSE);
+}
+
+void
+userlist_add (struct session *sess, char *name, char *hostname,
+				  char *account, char *realname, const message_tags_data *tags_data)
+{
+	if (sess->names_pending)
+		userlist_names_flush (sess);
+
+	userlist_insert_user (sess, userlist_user_new (sess, name, hostname,
+																  account, realname, tags_data));
+
 	if(sess->end_of_names)
 		fe_userlist_numbers (sess);
 }
 
+/* Queue a user from a NAMES reply. Large channels send thousands of
+   these before the 366, so they are only sorted into the usertree and
+   handed to the frontend once, by userlist_names_flush(). */
+
+void
+userlist_names_add (session *sess, char *name, char *hostname,
+						  const message_tags_data *tags_data)
+{
+	if (!sess->names_pending)
+	{
+		sess->names_pending = g_ptr_array_new ();
+		sess->server->names_pending++;
+	}
+
+	g_ptr_array_add (sess->names_pending,
+						  userlist_user_new (sess, name, hostname, NULL, NULL, tags_data));
+}
+
+static gint
+names_sort_cmp (gconstpointer a, gconstpointer b, gpointer serv)
+{
+	return nick_cmp_alpha (*(struct User **)a, *(struct User **)b, serv);
+}
+
+void
+userlist_names_flush (session *sess)
+{
+	GPtrArray *pending = sess->names_pending;
+	struct User *user, *prev = NULL;
+	guint i, count = 0;
+
+	if (!pending)
+		return;
+	sess->names_pending = NULL;
+	sess->server->names_pending--;
+
+	/* someone is already in the list (a JOIN or lookup came in between
+	   two 353s), fall back to sorted inserts */
+	if (sess->usertree && tree_size (sess->usertree) > 0)
+	{
+		for (i = 0; i < pending->len; i++)
+			userlist_insert_user (sess, g_ptr_array_index (pending, i));
+		g_ptr_array_free (pending, TRUE);
+		return;
+	}
+
+	if (!sess->usertree)
+		sess->usertree = tree_new ((tree_cmp_func *)nick_cmp_alpha, sess->server);
+
+	g_ptr_array_sort_with_data (pending, names_sort_cmp, sess->server);
+
+	for (i = 0; i < pending->len; i++)
+	{
+		user = g_ptr_array_index (pending, i);
+
+		if (prev && nick_cmp_alpha (prev, user, sess->server) == 0)
+		{
+			free_user (user, NULL);
+			continue;
+		}
+
+		tree_append (sess->usertree, user);
+		userlist_user_added (sess, user);
+		pending->pdata[count++] = user;
+		prev = user;
+	}
+
+	if (count)
+		fe_userlist_insert_many (sess, (struct User **)pending->pdata, count);
+	g_ptr_array_free (pending, TRUE);
+}
+
 static int
 rehash_cb (struct User *user, session *sess)
 {
@@ -450,6 +731,9 @@ userlist_flat_list (session *sess)
 {
 	GSList *list = NULL;
 
+	if (sess->names_pending)
+		userlist_names_flush (sess);
+
 	tree_foreach (sess->usertree, (tree_traverse_func *)flat_cb, &list);
 	return g_slist_reverse (list);
 }
@@ -466,6 +750,9 @@ userlist_double_list(session *sess)
 {
 	GList *list = NULL;
 
+	if (sess->names_pending)
+		userlist_names_flush (sess);
+
 	tree_foreach (sess->usertree, (tree_traverse_func *)double_cb, &list);
 	return list;
 }
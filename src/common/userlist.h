@@ -48,12 +48,18 @@ int userlist_add_hostname (session *sess, char *nick,
 									char *servername, char *account, unsigned int away);
 void userlist_set_away (session *sess, char *nick, unsigned int away);
 void userlist_set_account (session *sess, char *nick, char *account);
+void userlist_set_account_global (server *serv, char *nick, char *account);
 struct User *userlist_find (session *sess, const char *name);
 struct User *userlist_find_global (server *serv, char *name);
+GSList *userlist_find_sessions (server *serv, const char *name);
+void userlist_index_rebuild (server *serv);
 void userlist_clear (session *sess);
 void userlist_free (session *sess);
 void userlist_add (session *sess, char *name, char *hostname, char *account,
 						 char *realname, const message_tags_data *tags_data);
+void userlist_names_add (session *sess, char *name, char *hostname,
+								const message_tags_data *tags_data);
+void userlist_names_flush (session *sess);
 int userlist_remove (session *sess, char *name);
 void userlist_remove_user (session *sess, struct User *user);
 int userlist_change (session *sess, char *oldname, char *newname);
@@ -198,7 +198,19 @@ strip_color (const char *text, int len, int flags)
 int
 strip_color2 (const char *src, int len, char *dst, int flags)
 {
-	int rcol = 0, bgcol = 0;
+	int state[2] = { 0, 0 };
+
+	return strip_color_step (src, len, dst, flags, state);
+}
+
+/* strip_color2 for text that comes in pieces: state (zeroed for the first
+   piece) carries a color code over to the next one. The byte after each
+   piece is still read, so don't end a piece on a ',' unless the text
+   really ends there. */
+int
+strip_color_step (const char *src, int len, char *dst, int flags, int state[2])
+{
+	int rcol = state[0], bgcol = state[1];
 	char *start = dst;
 
 	if (len == -1) len = strlen (src);
@@ -242,6 +254,8 @@ strip_color2 (const char *src, int len, char *dst, int flags)
 		src++;
 	}
 	*dst = 0;
+	state[0] = rcol;
+	state[1] = bgcol;
 
 	return (int) (dst - start);
 }
@@ -59,10 +59,10 @@ void util_exec (const char *cmd);
 #define STRIP_ALL 7
 gchar *strip_color (const char *text, int len, int flags);
 int strip_color2 (const char *src, int len, char *dst, int flags);
+int strip_color_step (const char *src, int len, char *dst, int flags, int state[2]);
 int strip_hidden_attribute (char *src, char *dst);
 char *errorstring (int err);
 int waitline (int sok, char *buf, int bufsize, int);
-#define waitline2(source,buf,size) waitline(serv->childread,buf,size,0)
 unsigned long make_ping_time (void);
 void move_file (char *src_dir, char *dst_dir, char *fname, int dccpermissions);
 int token_foreach (char *str, char sep, int (*callback) (char *str, void *ud), void *ud);
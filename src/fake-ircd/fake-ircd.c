@@ -0,0 +1,728 @@
+/* HexChat
+ * Copyright (C) 1998-2010 Peter Zelezny.
+ * Copyright (C) 2009-2013 Berke Viktor.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/* hexchat-fake-ircd: a stand-in IRC server to point a real HexChat at,
+   for load testing the connection level: send queue throttling, read
+   framing, TLS, CAP and SASL. Each network listens on its own port, from
+   --port up. Once registered a client is put into --channels channels of
+   --users users each, then the users talk at --rate messages a second,
+   every --split seconds a quarter of them split off and come back, and
+   with --playback every channel starts with that many old lines with
+   server-time tags, like a bouncer's.
+
+     hexchat-fake-ircd --networks 100 --channels 500 --rate 200 --split 60
+     HEXCHAT_BENCH_LATENCY=1 hexchat
+
+   then /server 127.0.0.1 6667 (up to 6766). Every message carries its
+   send time, HexChat prints a histogram of how long it took to reach
+   fe_print_text when it exits. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <signal.h>
+
+#include <gio/gio.h>
+#include <glib-unix.h>
+
+#define SERVER_NAME "fake.ircd.invalid"
+#define CAPS "server-time message-tags multi-prefix sasl"
+#define TICK_MS 10
+#define HEAL_SECONDS 5
+#define OUTQ_MAX (1024 * 1024)	/* stop talking to a client this far behind */
+
+static gint arg_networks = 1;
+static gint arg_port = 6667;
+static gint arg_channels = 10;
+static gint arg_users = 50;
+static gdouble arg_rate = 10;
+static gint arg_split = 0;
+static gint arg_playback = 0;
+static char *arg_cert = NULL;
+
+static const GOptionEntry gopt_entries[] =
+{
+ {"networks",	'n', 0, G_OPTION_ARG_INT,	&arg_networks, "Networks to simulate, one port each", "N"},
+ {"port",	'p', 0, G_OPTION_ARG_INT,	&arg_port, "Port of the first network", "PORT"},
+ {"channels",	'c', 0, G_OPTION_ARG_INT,	&arg_channels, "Channels every client is joined to", "N"},
+ {"users",	'u', 0, G_OPTION_ARG_INT,	&arg_users, "Users in each channel", "N"},
+ {"rate",	'r', 0, G_OPTION_ARG_DOUBLE,	&arg_rate, "Channel messages per second, per client", "N"},
+ {"split",	's', 0, G_OPTION_ARG_INT,	&arg_split, "Netsplit every this many seconds", "SECONDS"},
+ {"playback",	'b', 0, G_OPTION_ARG_INT,	&arg_playback, "Lines of bouncer playback per channel", "N"},
+ {"cert",	0, 0, G_OPTION_ARG_FILENAME,	&arg_cert, "Use TLS, with this PEM file holding certificate and key", "FILE"},
+ {NULL}
+};
+
+struct network
+{
+	int id;
+	GSocketService *service;
+	GList *clients;
+	guint64 sent;
+};
+
+struct client
+{
+	struct network *net;
+	GIOStream *stream;
+	GDataInputStream *in;
+	GOutputStream *out;
+	GCancellable *cancel;
+
+	GString *outq;				/* waiting to be written */
+	GString *writing;			/* being written */
+	gboolean read_pending;
+	gboolean write_pending;
+	gboolean closing;
+	gboolean quitting;		/* sent QUIT, close once the ERROR is out */
+
+	char *nick;
+	gboolean has_user;
+	gboolean cap_negotiating;
+	gboolean registered;
+	gboolean server_time;	/* server-time was ACKed */
+	gboolean sasl;				/* AUTHENTICATE PLAIN started */
+
+	gdouble credit;			/* messages owed by the rate */
+	int next_channel;
+};
+
+static struct network *networks;
+static GTlsCertificate *certificate;
+static GMainLoop *main_loop;
+
+/* users are numbered 0 .. pool-1. Channel c holds "--users" of them,
+   starting at c * 7, so the channels overlap like real ones do. */
+
+static int pool;
+static int split_start = -1;	/* first user of the split off quarter */
+
+static int
+channel_member (int c, int j)
+{
+	return (c * 7 + j) % pool;
+}
+
+static gboolean
+user_split (int u)
+{
+	return split_start != -1 && (u - split_start + pool) % pool < pool / 4;
+}
+
+/* === output === */
+
+static void client_write (struct client *cl);
+static void client_read (struct client *cl);
+
+static void
+client_free (struct client *cl)
+{
+	g_io_stream_close (cl->stream, NULL, NULL);
+	g_string_free (cl->outq, TRUE);
+	g_string_free (cl->writing, TRUE);
+	g_object_unref (cl->in);
+	g_object_unref (cl->stream);
+	g_object_unref (cl->cancel);
+	g_free (cl->nick);
+	g_free (cl);
+}
+
+/* free it once no async operation refers to it any more */
+
+static void
+client_close (struct client *cl)
+{
+	if (!cl->closing)
+	{
+		cl->closing = TRUE;
+		cl->net->clients = g_list_remove (cl->net->clients, cl);
+		g_cancellable_cancel (cl->cancel);
+	}
+
+	if (!cl->read_pending && !cl->write_pending)
+		client_free (cl);
+}
+
+static void
+client_write_cb (GObject *obj, GAsyncResult *result, gpointer user_data)
+{
+	struct client *cl = user_data;
+	GError *error = NULL;
+
+	cl->write_pending = FALSE;
+	if (!g_output_stream_write_all_finish (G_OUTPUT_STREAM (obj), result, NULL, &error))
+	{
+		g_error_free (error);
+		client_close (cl);
+		return;
+	}
+
+	if (cl->closing)
+	{
+		client_close (cl);
+		return;
+	}
+
+	g_string_truncate (cl->writing, 0);
+	client_write (cl);
+
+	if (cl->quitting && !cl->write_pending)
+		client_close (cl);
+}
+
+static void
+client_write (struct client *cl)
+{
+	GString *swap;
+
+	if (cl->write_pending || cl->closing || !cl->outq->len)
+		return;
+
+	swap = cl->writing;
+	cl->writing = cl->outq;
+	cl->outq = swap;
+
+	cl->write_pending = TRUE;
+	g_output_stream_write_all_async (cl->out, cl->writing->str, cl->writing->len,
+												G_PRIORITY_DEFAULT, cl->cancel, client_write_cb, cl);
+}
+
+static void
+client_send (struct client *cl, const char *format, ...) G_GNUC_PRINTF (2, 3);
+
+static void
+client_send (struct client *cl, const char *format, ...)
+{
+	va_list args;
+
+	va_start (args, format);
+	g_string_append_vprintf (cl->outq, format, args);
+	va_end (args);
+	g_string_append (cl->outq, "\r\n");
+
+	client_write (cl);
+}
+
+/* "@time=... " for a message sent "ago" seconds back, if the client
+   wants it */
+
+static void
+client_time_tag (struct client *cl, char *buf, int size, int ago)
+{
+	GDateTime *now, *then;
+	char *stamp;
+
+	buf[0] = 0;
+	if (!cl->server_time)
+		return;
+
+	now = g_date_time_new_now_utc ();
+	then = g_date_time_add_seconds (now, -ago);
+	stamp = g_date_time_format (then, "%Y-%m-%dT%H:%M:%S.000Z");
+	g_snprintf (buf, size, "@time=%s ", stamp);
+	g_free (stamp);
+	g_date_time_unref (then);
+	g_date_time_unref (now);
+}
+
+/* === what the users do === */
+
+static void
+send_privmsg (struct client *cl, const char *tag, int u, int c, const char *text)
+{
+	client_send (cl, "%s:user%d!~u%d@host-%d.fake.invalid PRIVMSG #chan%d :%s bench-sent=%" G_GINT64_FORMAT,
+					 tag, u, u, u % 997, c, text, g_get_monotonic_time ());
+	cl->net->sent++;
+}
+
+static void
+send_join (struct client *cl, int c)
+{
+	GString *names = g_string_sized_new (512);
+	char tag[64];
+	int j, u;
+
+	client_send (cl, ":%s!~%s@localhost JOIN #chan%d", cl->nick, cl->nick, c);
+	client_send (cl, ":" SERVER_NAME " 332 %s #chan%d :Channel %d of network %d",
+					 cl->nick, c, c, cl->net->id);
+
+	for (j = 0; j < arg_users; j++)
+	{
+		u = channel_member (c, j);
+		if (user_split (u))
+			continue;
+
+		if (names->len == 0)
+			g_string_printf (names, ":" SERVER_NAME " 353 %s = #chan%d :", cl->nick, c);
+		else
+			g_string_append_c (names, ' ');
+
+		if (u % 10 == 0)
+			g_string_append_c (names, '@');
+		else if (u % 5 == 0)
+			g_string_append_c (names, '+');
+		g_string_append_printf (names, "user%d", u);
+
+		if (names->len > 400)
+		{
+			client_send (cl, "%s", names->str);
+			g_string_truncate (names, 0);
+		}
+	}
+	if (names->len)
+		client_send (cl, "%s", names->str);
+	client_send (cl, ":" SERVER_NAME " 366 %s #chan%d :End of /NAMES list.", cl->nick, c);
+	g_string_free (names, TRUE);
+
+	/* what a bouncer would have buffered */
+	for (j = 0; j < arg_playback; j++)
+	{
+		client_time_tag (cl, tag, sizeof (tag), arg_playback - j);
+		send_privmsg (cl, tag, channel_member (c, j % arg_users), c, "playback");
+	}
+}
+
+static void
+client_register (struct client *cl)
+{
+	int c;
+
+	cl->registered = TRUE;
+
+	client_send (cl, ":" SERVER_NAME " 001 %s :Welcome to the Fake%d IRC Network %s",
+					 cl->nick, cl->net->id, cl->nick);
+	client_send (cl, ":" SERVER_NAME " 002 %s :Your host is " SERVER_NAME, cl->nick);
+	client_send (cl, ":" SERVER_NAME " 004 %s " SERVER_NAME " fake-1.0 iow bklmnopstv", cl->nick);
+	client_send (cl, ":" SERVER_NAME " 005 %s PREFIX=(ov)@+ CHANTYPES=# CHANMODES=b,k,l,imnpst "
+					 "CASEMAPPING=rfc1459 NICKLEN=30 NETWORK=Fake%d :are supported by this server",
+					 cl->nick, cl->net->id);
+	client_send (cl, ":" SERVER_NAME " 375 %s :- " SERVER_NAME " Message of the Day -", cl->nick);
+	client_send (cl, ":" SERVER_NAME " 372 %s :- Nothing here is real.", cl->nick);
+	client_send (cl, ":" SERVER_NAME " 376 %s :End of /MOTD command.", cl->nick);
+
+	for (c = 0; c < arg_channels; c++)
+		send_join (cl, c);
+}
+
+static void
+client_talk (struct client *cl)
+{
+	int c, u, tries;
+
+	cl->credit += arg_rate * TICK_MS / 1000.0;
+
+	/* don't pile up output for a client that isn't keeping up */
+	while (cl->credit >= 1 && cl->outq->len < OUTQ_MAX)
+	{
+		cl->credit -= 1;
+		c = cl->next_channel;
+		cl->next_channel = (c + 1) % arg_channels;
+
+		/* someone who isn't split off, if that's quick to find */
+		tries = 0;
+		do
+		{
+			u = channel_member (c, g_random_int_range (0, arg_users));
+		}
+		while (user_split (u) && ++tries < 8);
+
+		send_privmsg (cl, "", u, c, "the quick brown fox jumps over the lazy dog");
+	}
+
+	if (cl->credit > 1)
+		cl->credit = 1;
+}
+
+static void
+foreach_registered (void (*func) (struct client *cl))
+{
+	GList *list;
+	int i;
+
+	for (i = 0; i < arg_networks; i++)
+	{
+		for (list = networks[i].clients; list; list = list->next)
+		{
+			if (((struct client *) list->data)->registered)
+				func (list->data);
+		}
+	}
+}
+
+static gboolean
+tick_cb (gpointer unused)
+{
+	foreach_registered (client_talk);
+	return TRUE;
+}
+
+static void
+send_split (struct client *cl)
+{
+	int i, u;
+
+	for (i = 0; i < pool / 4; i++)
+	{
+		u = (split_start + i) % pool;
+		client_send (cl, ":user%d!~u%d@host-%d.fake.invalid QUIT :" SERVER_NAME " split.fake.invalid",
+						 u, u, u % 997);
+	}
+}
+
+static void
+send_heal (struct client *cl)
+{
+	int c, j, u;
+
+	for (c = 0; c < arg_channels; c++)
+	{
+		for (j = 0; j < arg_users; j++)
+		{
+			u = channel_member (c, j);
+			if (!user_split (u))
+				continue;
+
+			client_send (cl, ":user%d!~u%d@host-%d.fake.invalid JOIN #chan%d", u, u, u % 997, c);
+			if (u % 10 == 0)
+				client_send (cl, ":split.fake.invalid MODE #chan%d +o user%d", c, u);
+			else if (u % 5 == 0)
+				client_send (cl, ":split.fake.invalid MODE #chan%d +v user%d", c, u);
+		}
+	}
+}
+
+static gboolean
+heal_cb (gpointer unused)
+{
+	foreach_registered (send_heal);
+	split_start = -1;
+	return FALSE;
+}
+
+static gboolean
+split_cb (gpointer unused)
+{
+	if (split_start != -1)
+		return TRUE;
+
+	split_start = g_random_int_range (0, pool);
+	foreach_registered (send_split);
+	g_timeout_add_seconds (HEAL_SECONDS, heal_cb, NULL);
+	return TRUE;
+}
+
+/* === input === */
+
+static void
+client_cap (struct client *cl, char *sub, char *arg)
+{
+	const char *nick = cl->nick ? cl->nick : "*";
+	char **req;
+	char *name;
+	int i;
+	gboolean ok = TRUE;
+
+	if (!g_ascii_strcasecmp (sub, "LS"))
+	{
+		cl->cap_negotiating = TRUE;
+		client_send (cl, ":" SERVER_NAME " CAP %s LS :" CAPS, nick);
+	} else if (!g_ascii_strcasecmp (sub, "REQ"))
+	{
+		cl->cap_negotiating = TRUE;
+		req = g_strsplit (arg, " ", 0);
+		for (i = 0; req[i]; i++)
+		{
+			name = g_strdup_printf (" %s ", req[i]);
+			if (req[i][0] && !strstr (" " CAPS " ", name))
+				ok = FALSE;
+			g_free (name);
+		}
+		for (i = 0; ok && req[i]; i++)
+		{
+			if (!strcmp (req[i], "server-time"))
+				cl->server_time = TRUE;
+		}
+		g_strfreev (req);
+		client_send (cl, ":" SERVER_NAME " CAP %s %s :%s", nick, ok ? "ACK" : "NAK", arg);
+	} else if (!g_ascii_strcasecmp (sub, "END"))
+	{
+		cl->cap_negotiating = FALSE;
+	}
+}
+
+static void
+client_authenticate (struct client *cl, char *arg)
+{
+	const char *nick = cl->nick ? cl->nick : "*";
+
+	if (!cl->sasl)
+	{
+		if (!g_ascii_strcasecmp (arg, "PLAIN"))
+		{
+			cl->sasl = TRUE;
+			client_send (cl, "AUTHENTICATE +");
+		} else
+		{
+			client_send (cl, ":" SERVER_NAME " 908 %s PLAIN :are available SASL mechanisms", nick);
+			client_send (cl, ":" SERVER_NAME " 904 %s :SASL authentication failed", nick);
+		}
+		return;
+	}
+
+	cl->sasl = FALSE;
+	if (!strcmp (arg, "*"))
+	{
+		client_send (cl, ":" SERVER_NAME " 906 %s :SASL authentication aborted", nick);
+		return;
+	}
+
+	/* any password will do */
+	client_send (cl, ":" SERVER_NAME " 900 %s %s!~%s@localhost %s :You are now logged in as %s",
+					 nick, nick, nick, nick, nick);
+	client_send (cl, ":" SERVER_NAME " 903 %s :SASL authentication successful", nick);
+}
+
+static void
+client_line (struct client *cl, char *line)
+{
+	char *cmd, *arg, *trail;
+	char *old;
+
+	/* ignore any tags, we don't ACK anything that would send them */
+	if (line[0] == '@')
+	{
+		line = strchr (line, ' ');
+		if (!line)
+			return;
+		line++;
+	}
+
+	cmd = line;
+	arg = strchr (line, ' ');
+	if (arg)
+		*arg++ = 0;
+	else
+		arg = "";
+
+	/* just the trailing parameter, for commands where that's all we need */
+	trail = strstr (arg, " :");
+	trail = trail ? trail + 2 : (arg[0] == ':' ? arg + 1 : arg);
+
+	if (!g_ascii_strcasecmp (cmd, "PING"))
+	{
+		client_send (cl, ":" SERVER_NAME " PONG " SERVER_NAME " :%s", trail);
+	} else if (!g_ascii_strcasecmp (cmd, "CAP"))
+	{
+		old = strchr (arg, ' ');
+		if (old)
+			*old = 0;
+		client_cap (cl, arg, trail == arg ? "" : trail);
+	} else if (!g_ascii_strcasecmp (cmd, "AUTHENTICATE"))
+	{
+		client_authenticate (cl, arg);
+	} else if (!g_ascii_strcasecmp (cmd, "NICK"))
+	{
+		old = cl->nick;
+		cl->nick = g_strdup (trail);
+		if (cl->registered)
+			client_send (cl, ":%s!~%s@localhost NICK :%s", old, old, cl->nick);
+		g_free (old);
+	} else if (!g_ascii_strcasecmp (cmd, "USER"))
+	{
+		cl->has_user = TRUE;
+	} else if (!g_ascii_strcasecmp (cmd, "QUIT"))
+	{
+		client_send (cl, "ERROR :Closing Link: localhost (Quit: %s)", trail);
+		cl->registered = FALSE;
+		cl->quitting = TRUE;
+		return;
+	} else if (!cl->registered)
+	{
+		return;
+	} else if (!g_ascii_strcasecmp (cmd, "JOIN") && !strncmp (arg, "#chan", 5))
+	{
+		send_join (cl, atoi (arg + 5));
+	} else if (!g_ascii_strcasecmp (cmd, "PART"))
+	{
+		old = strchr (arg, ' ');
+		if (old)
+			*old = 0;
+		client_send (cl, ":%s!~%s@localhost PART %s", cl->nick, cl->nick, arg);
+	} else if (!g_ascii_strcasecmp (cmd, "MODE") && arg[0] == '#' && !strchr (arg, ' '))
+	{
+		client_send (cl, ":" SERVER_NAME " 324 %s %s +nt", cl->nick, arg);
+	} else if (!g_ascii_strcasecmp (cmd, "WHO"))
+	{
+		old = strchr (arg, ' ');
+		if (old)
+			*old = 0;
+		client_send (cl, ":" SERVER_NAME " 315 %s %s :End of /WHO list.", cl->nick, arg);
+	}
+
+	if (!cl->registered && !cl->quitting && cl->nick && cl->has_user && !cl->cap_negotiating)
+		client_register (cl);
+}
+
+static void
+client_read_cb (GObject *obj, GAsyncResult *result, gpointer user_data)
+{
+	struct client *cl = user_data;
+	char *line;
+
+	cl->read_pending = FALSE;
+	line = g_data_input_stream_read_line_finish (G_DATA_INPUT_STREAM (obj), result, NULL, NULL);
+	if (!line || cl->closing)
+	{
+		g_free (line);
+		client_close (cl);
+		return;
+	}
+
+	client_line (cl, line);
+	g_free (line);
+
+	if (!cl->quitting)
+		client_read (cl);
+	else if (!cl->write_pending)
+		client_close (cl);
+}
+
+static void
+client_read (struct client *cl)
+{
+	cl->read_pending = TRUE;
+	g_data_input_stream_read_line_async (cl->in, G_PRIORITY_DEFAULT, cl->cancel,
+													 client_read_cb, cl);
+}
+
+static gboolean
+incoming_cb (GSocketService *service, GSocketConnection *connection,
+				 GObject *source, gpointer user_data)
+{
+	struct network *net = user_data;
+	struct client *cl;
+	GIOStream *stream;
+	GError *error = NULL;
+
+	if (certificate)
+	{
+		stream = G_IO_STREAM (g_tls_server_connection_new (G_IO_STREAM (connection),
+																			certificate, &error));
+		if (!stream)
+		{
+			g_printerr ("TLS: %s\n", error->message);
+			g_error_free (error);
+			return TRUE;
+		}
+	} else
+	{
+		stream = g_object_ref (connection);
+	}
+
+	cl = g_new0 (struct client, 1);
+	cl->net = net;
+	cl->stream = stream;
+	cl->in = g_data_input_stream_new (g_io_stream_get_input_stream (stream));
+	g_data_input_stream_set_newline_type (cl->in, G_DATA_STREAM_NEWLINE_TYPE_ANY);
+	cl->out = g_io_stream_get_output_stream (stream);
+	cl->cancel = g_cancellable_new ();
+	cl->outq = g_string_sized_new (4096);
+	cl->writing = g_string_sized_new (4096);
+
+	net->clients = g_list_prepend (net->clients, cl);
+	client_read (cl);
+
+	return TRUE;
+}
+
+static gboolean
+quit_cb (gpointer unused)
+{
+	g_main_loop_quit (main_loop);
+	return FALSE;
+}
+
+int
+main (int argc, char *argv[])
+{
+	GOptionContext *context;
+	GError *error = NULL;
+	guint64 sent = 0;
+	int i;
+
+	context = g_option_context_new (NULL);
+	g_option_context_add_main_entries (context, gopt_entries, NULL);
+	if (!g_option_context_parse (context, &argc, &argv, &error))
+	{
+		g_printerr ("%s\n", error->message);
+		return 1;
+	}
+	g_option_context_free (context);
+
+	if (arg_networks < 1 || arg_channels < 1 || arg_users < 1 || arg_rate < 0)
+	{
+		g_printerr ("--networks, --channels and --users must be at least 1\n");
+		return 1;
+	}
+	pool = MAX (arg_users * 4, 4);
+
+	if (arg_cert)
+	{
+		certificate = g_tls_certificate_new_from_file (arg_cert, &error);
+		if (!certificate)
+		{
+			g_printerr ("%s: %s\n", arg_cert, error->message);
+			return 1;
+		}
+	}
+
+	networks = g_new0 (struct network, arg_networks);
+	for (i = 0; i < arg_networks; i++)
+	{
+		networks[i].id = i;
+		networks[i].service = g_socket_service_new ();
+		if (!g_socket_listener_add_inet_port (G_SOCKET_LISTENER (networks[i].service),
+														  arg_port + i, NULL, &error))
+		{
+			g_printerr ("port %d: %s\n", arg_port + i, error->message);
+			return 1;
+		}
+		g_signal_connect (networks[i].service, "incoming", G_CALLBACK (incoming_cb), &networks[i]);
+		g_socket_service_start (networks[i].service);
+	}
+
+	g_timeout_add (TICK_MS, tick_cb, NULL);
+	if (arg_split > 0)
+		g_timeout_add_seconds (arg_split, split_cb, NULL);
+	g_unix_signal_add (SIGINT, quit_cb, NULL);
+	g_unix_signal_add (SIGTERM, quit_cb, NULL);
+
+	g_print ("%d network(s) on ports %d-%d%s\n", arg_networks, arg_port,
+				arg_port + arg_networks - 1, certificate ? ", TLS" : "");
+
+	main_loop = g_main_loop_new (NULL, FALSE);
+	g_main_loop_run (main_loop);
+
+	for (i = 0; i < arg_networks; i++)
+		sent += networks[i].sent;
+	g_print ("%" G_GUINT64_FORMAT " messages sent\n", sent);
+
+	return 0;
+}
@@ -521,6 +521,13 @@ fe_print_text (struct session *sess, char *text, time_t stamp,
 		fe_set_tab_color (sess, FE_COLOR_NEW_DATA);
 }
 
+gboolean
+fe_print_text_prepend (struct session *sess, char *text, time_t stamp)
+{
+	return PrintTextRawPrepend (sess->res->buffer, (unsigned char *)text,
+										 prefs.hex_text_indent, stamp);
+}
+
 void
 fe_beep (session *sess)
 {
@@ -97,13 +97,14 @@ typedef struct restore_gui
 	void *tab;			/* (chan *) */
 
 	/* information stored when this tab isn't front-most */
-	GtkListStore *user_model;	/* for filling the GtkTreeView */
+	GtkTreeModel *user_model;	/* for filling the GtkTreeView */
 	void *buffer;		/* xtext_Buffer */
 	char *input_text;	/* input text buffer (while not-front tab) */
 	char *topic_text;	/* topic GtkEntry buffer */
 	char *key_text;
 	char *limit_text;
 	gfloat old_ul_value;	/* old userlist value (for adj) */
+	gdouble scroll_value;	/* xtext adj value last seen (see mg_xtext_scrolled_cb) */
 	gfloat lag_value;	/* lag-o-meter */
 	char *lag_text;	/* lag-o-meter text */
 	char *lag_tip;		/* lag-o-meter tooltip */
@@ -157,6 +158,7 @@ typedef struct session_gui
 	GtkWidget *menu_item[MENU_ID_NUM+1]; /* some items we may change state of */
 
 	void *chanview;	/* chanview.h */
+	struct session *sess;	/* toplevels only, tabs show current_tab */
 
 	int bartag;		/*connecting progressbar timeout */
 
@@ -2314,6 +2314,31 @@ mg_update_xtext (GtkWidget *wid)
 	gtk_xtext_refresh (xtext);
 }
 
+/* scrolled to the very top? page in older scrollback */
+
+static void
+mg_xtext_scrolled_cb (GtkAdjustment *adj, session_gui *gui)
+{
+	session *sess = gui->is_tab ? current_tab : gui->sess;
+	gdouble value = gtk_adjustment_get_value (adj);
+	gdouble last;
+
+	/* mid tab switch, the adj may still belong to the old buffer */
+	if (!sess || sess->res->buffer != GTK_XTEXT (gui->xtext)->buffer)
+		return;
+
+	last = sess->res->scroll_value;
+	sess->res->scroll_value = value;
+
+	/* only when the user moved up to it, not for short buffers,
+	   appends or showing a tab that was already at the top */
+	if (value > 0 || last <= 0 ||
+		 gtk_adjustment_get_upper (adj) <= gtk_adjustment_get_page_size (adj))
+		return;
+
+	scrollback_load_older (sess);
+}
+
 static void
 mg_create_textarea (session *sess, GtkWidget *box)
 {
@@ -2354,6 +2379,8 @@ mg_create_textarea (session *sess, GtkWidget *box)
 
 	gui->vscrollbar = gtk_vscrollbar_new (GTK_XTEXT (xtext)->adj);
 	gtk_box_pack_start (GTK_BOX (inbox), gui->vscrollbar, FALSE, TRUE, 0);
+	g_signal_connect (G_OBJECT (GTK_XTEXT (xtext)->adj), "value_changed",
+							G_CALLBACK (mg_xtext_scrolled_cb), gui);
 
 	gtk_drag_dest_set (gui->vscrollbar, 5, dnd_dest_targets, 2,
 							 GDK_ACTION_MOVE | GDK_ACTION_COPY | GDK_ACTION_LINK);
@@ -3512,6 +3539,7 @@ mg_changui_new (session *sess, restore_gui *res, int tab, int focus)
 	{
 		gui = g_new0 (session_gui, 1);
 		gui->is_tab = FALSE;
+		gui->sess = sess;
 		sess->gui = gui;
 		mg_create_topwindow (sess);
 		fe_set_title (sess);
@@ -61,11 +61,13 @@ xtext_get_stamp_str (time_t tim, char **ret)
 	return get_stamp_str (prefs.hex_stamp_text_format, tim, ret);
 }
 
-static void
-PrintTextLine (xtext_buffer *xtbuf, unsigned char *text, int len, int indent, time_t timet)
+static gboolean
+PrintTextLine (xtext_buffer *xtbuf, unsigned char *text, int len, int indent, time_t timet,
+					gboolean prepend)
 {
 	unsigned char *tab, *new_text;
 	int leftlen;
+	gboolean ret = TRUE;
 
 	if (len == 0)
 		len = 1;
@@ -85,21 +87,34 @@ PrintTextLine (xtext_buffer *xtbuf, unsigned char *text, int len, int indent, ti
 			memcpy (new_text, stamp, stamp_size);
 			g_free (stamp);
 			memcpy (new_text + stamp_size, text, len);
-			gtk_xtext_append (xtbuf, new_text, len + stamp_size, timet);
+			if (prepend)
+				ret = gtk_xtext_prepend (xtbuf, new_text, len + stamp_size, timet);
+			else
+				gtk_xtext_append (xtbuf, new_text, len + stamp_size, timet);
 			g_free (new_text);
-		} else
+		} else if (prepend)
+			ret = gtk_xtext_prepend (xtbuf, text, len, timet);
+		else
 			gtk_xtext_append (xtbuf, text, len, timet);
-		return;
+		return ret;
 	}
 
 	tab = strchr (text, '\t');
 	if (tab && tab < (text + len))
 	{
 		leftlen = tab - text;
-		gtk_xtext_append_indent (xtbuf,
-										 text, leftlen, tab + 1, len - (leftlen + 1), timet);
-	} else
+		if (prepend)
+			ret = gtk_xtext_prepend_indent (xtbuf,
+													  text, leftlen, tab + 1, len - (leftlen + 1), timet);
+		else
+			gtk_xtext_append_indent (xtbuf,
+											 text, leftlen, tab + 1, len - (leftlen + 1), timet);
+	} else if (prepend)
+		ret = gtk_xtext_prepend_indent (xtbuf, 0, 0, text, len, timet);
+	else
 		gtk_xtext_append_indent (xtbuf, 0, 0, text, len, timet);
+
+	return ret;
 }
 
 void
@@ -115,10 +130,10 @@ PrintTextRaw (void *xtbuf, unsigned char *text, int indent, time_t stamp)
 		switch (*text)
 		{
 		case 0:
-			PrintTextLine (xtbuf, last_text, len, indent, stamp);
+			PrintTextLine (xtbuf, last_text, len, indent, stamp, FALSE);
 			return;
 		case '\n':
-			PrintTextLine (xtbuf, last_text, len, indent, stamp);
+			PrintTextLine (xtbuf, last_text, len, indent, stamp, FALSE);
 			text++;
 			if (*text == 0)
 				return;
@@ -140,6 +155,16 @@ PrintTextRaw (void *xtbuf, unsigned char *text, int indent, time_t stamp)
 	}
 }
 
+/* a single line, above everything already in xtbuf */
+
+gboolean
+PrintTextRawPrepend (void *xtbuf, unsigned char *text, int indent, time_t stamp)
+{
+	int len = strcspn (text, "\n");
+
+	return PrintTextLine (xtbuf, text, len, indent, stamp, TRUE);
+}
+
 static void
 pevent_dialog_close (GtkWidget *wid, gpointer arg)
 {
@@ -192,6 +217,7 @@ pevent_edited (GtkCellRendererText *render, gchar *pathstr, gchar *new_text, gpo
 
 	pntevts_text[sig] = g_strdup (text);
 	pntevts[sig] = out;
+	pevent_template_invalidate (sig);
 
 	out = g_malloc (len + 2);
 	memcpy (out, text, len + 1);
@@ -21,6 +21,7 @@
 #define HEXCHAT_TEXTGUI_H
 
 void PrintTextRaw (void *xtbuf, unsigned char *text, int indent, time_t stamp);
+gboolean PrintTextRawPrepend (void *xtbuf, unsigned char *text, int indent, time_t stamp);
 void pevent_dialog_show (void);
 
 #endif
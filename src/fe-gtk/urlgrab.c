@@ -151,21 +151,32 @@ url_button_save (void)
 
 void
 fe_url_add (const char *urltext)
+{
+	fe_url_add_list ((char **)&urltext, 1);
+}
+
+void
+fe_url_add_list (char **urls, int count)
 {
 	GtkListStore *store;
 	GtkTreeIter iter;
 	gboolean valid;
+	int i;
 	
 	if (urlgrabberwindow)
 	{
 		store = GTK_LIST_STORE (g_object_get_data (G_OBJECT (urlgrabberwindow),
 		                                           "model"));
-		gtk_list_store_prepend (store, &iter);
-		gtk_list_store_set (store, &iter,
-		                    URL_COLUMN, urltext,
-		                    -1);
+		/* oldest first, so the newest ends up on top */
+		for (i = 0; i < count; i++)
+		{
+			gtk_list_store_prepend (store, &iter);
+			gtk_list_store_set (store, &iter,
+			                    URL_COLUMN, urls[i],
+			                    -1);
+		}
 
-		/* remove any overflow */
+		/* remove any overflow, once for the whole batch */
 		if (prefs.hex_url_grabber_limit > 0)
 		{
 			valid = gtk_tree_model_iter_nth_child (
@@ -177,9 +188,9 @@ fe_url_add (const char *urltext)
 }
 
 static int
-populate_cb (char *urltext, gpointer userdata)
+populate_cb (char *urltext, GPtrArray *urls)
 {
-	fe_url_add (urltext);
+	g_ptr_array_add (urls, urltext);
 	return TRUE;
 }
 
@@ -187,6 +198,7 @@ void
 url_opengui ()
 {
 	GtkWidget *vbox, *hbox, *view;
+	GPtrArray *urls;
 	char buf[128];
 
 	if (urlgrabberwindow)
@@ -195,6 +207,9 @@ url_opengui ()
 		return;
 	}
 
+	/* queued URLs are in url_tree already, don't list them twice */
+	url_flush ();
+
 	g_snprintf(buf, sizeof(buf), _("URL Grabber - %s"), _(DISPLAY_NAME));
 	urlgrabberwindow =
 		mg_create_generic_tab ("UrlGrabber", buf, FALSE, TRUE, url_closegui, NULL,
@@ -220,7 +235,12 @@ url_opengui ()
 	gtk_widget_show (urlgrabberwindow);
 
 	if (prefs.hex_url_grabber)
-		tree_foreach (url_tree, (tree_traverse_func *)populate_cb, NULL);
+	{
+		urls = g_ptr_array_new ();
+		tree_foreach (url_tree, (tree_traverse_func *)populate_cb, urls);
+		fe_url_add_list ((char **)urls->pdata, urls->len);
+		g_ptr_array_free (urls, TRUE);
+	}
 	else
 	{
 		gtk_list_store_clear (GTK_LIST_STORE (gtk_tree_view_get_model (GTK_TREE_VIEW (view))));
@@ -0,0 +1,421 @@
+/* HexChat
+ * Copyright (C) 1998-2010 Peter Zelezny.
+ * Copyright (C) 2009-2013 Berke Viktor.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/*
+A GtkTreeModel for the nick list, in the spirit of CustomList. Rows are
+the session's own struct Users: the model only orders pointers to them,
+so adding, removing or repainting a nick costs a tree search instead of
+a walk over a GtkListStore. An iter carries the User and its row number,
+and is good until the next insert or remove.
+*/
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "fe-gtk.h"
+
+#include "../common/hexchat.h"
+#include "../common/userlist.h"
+#include "../common/text.h"
+#include "../common/hexchatc.h"
+#include "palette.h"
+#include "userlistgui.h"
+#include "userlist-model.h"
+
+static void userlist_model_tree_model_init (GtkTreeModelIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (UserlistModel, userlist_model, G_TYPE_OBJECT,
+								 G_IMPLEMENT_INTERFACE (GTK_TYPE_TREE_MODEL,
+															  userlist_model_tree_model_init))
+
+/* the order of prefs.hex_gui_ulist_sort, as the GtkListStore sort funcs had it */
+
+static int
+userlist_model_cmp (const void *a, const void *b, void *data)
+{
+	UserlistModel *model = data;
+	struct User *user_a = (struct User *) a;
+	struct User *user_b = (struct User *) b;
+	server *serv = model->sess->server;
+	int seq_a, seq_b;
+
+	switch (model->sort)
+	{
+	case 0:
+		return nick_cmp_az_ops (serv, user_a, user_b);
+	case 1:
+		return nick_cmp_alpha (user_a, user_b, serv);
+	case 2:
+		return -nick_cmp_az_ops (serv, user_a, user_b);
+	case 3:
+		return -nick_cmp_alpha (user_a, user_b, serv);
+	}
+
+	/* unsorted, the higher arrival number comes first */
+	seq_a = GPOINTER_TO_INT (g_hash_table_lookup (model->arrival, user_a));
+	seq_b = GPOINTER_TO_INT (g_hash_table_lookup (model->arrival, user_b));
+	if (seq_a == seq_b)
+		return 0;
+	return seq_a > seq_b ? -1 : 1;
+}
+
+static void
+userlist_model_set_iter (UserlistModel *model, GtkTreeIter *iter,
+								 struct User *user, int pos)
+{
+	iter->stamp = model->stamp;
+	iter->user_data = user;
+	iter->user_data2 = GINT_TO_POINTER (pos);
+	iter->user_data3 = NULL;
+}
+
+static GtkTreePath *
+userlist_model_path (int pos)
+{
+	GtkTreePath *path = gtk_tree_path_new ();
+	gtk_tree_path_append_index (path, pos);
+	return path;
+}
+
+static GtkTreeModelFlags
+userlist_model_get_flags (GtkTreeModel *tree_model)
+{
+	return GTK_TREE_MODEL_LIST_ONLY;
+}
+
+static gint
+userlist_model_get_n_columns (GtkTreeModel *tree_model)
+{
+	return USERLIST_N_COLUMNS;
+}
+
+static GType
+userlist_model_get_column_type (GtkTreeModel *tree_model, gint index)
+{
+	switch (index)
+	{
+	case COL_PIX:
+		return GDK_TYPE_PIXBUF;
+	case COL_NICK:
+	case COL_HOST:
+		return G_TYPE_STRING;
+	case COL_USER:
+		return G_TYPE_POINTER;
+	case COL_GDKCOLOR:
+		return GDK_TYPE_COLOR;
+	}
+	return G_TYPE_INVALID;
+}
+
+static gboolean
+userlist_model_iter_nth_child (GtkTreeModel *tree_model, GtkTreeIter *iter,
+										 GtkTreeIter *parent, gint n)
+{
+	UserlistModel *model = USERLIST_MODEL (tree_model);
+	struct User *user;
+
+	if (parent)
+		return FALSE;
+
+	user = tree_nth (model->rows, n);
+	if (!user)
+		return FALSE;
+
+	userlist_model_set_iter (model, iter, user, n);
+	return TRUE;
+}
+
+static gboolean
+userlist_model_get_iter (GtkTreeModel *tree_model, GtkTreeIter *iter,
+								 GtkTreePath *path)
+{
+	return userlist_model_iter_nth_child (tree_model, iter, NULL,
+													  gtk_tree_path_get_indices (path)[0]);
+}
+
+static GtkTreePath *
+userlist_model_get_path (GtkTreeModel *tree_model, GtkTreeIter *iter)
+{
+	g_return_val_if_fail (iter->stamp == USERLIST_MODEL (tree_model)->stamp, NULL);
+
+	return userlist_model_path (GPOINTER_TO_INT (iter->user_data2));
+}
+
+static void
+userlist_model_get_value (GtkTreeModel *tree_model, GtkTreeIter *iter,
+								  gint column, GValue *value)
+{
+	UserlistModel *model = USERLIST_MODEL (tree_model);
+	struct User *user = iter->user_data;
+	int nick_color = 0;
+
+	g_value_init (value, userlist_model_get_column_type (tree_model, column));
+
+	switch (column)
+	{
+	case COL_PIX:
+		if (model->icons)
+			g_value_set_object (value, get_user_icon (model->sess->server, user));
+		break;
+
+	case COL_NICK:
+		if (model->icons || user->prefix[0] == '\0' || user->prefix[0] == ' ')
+			g_value_set_static_string (value, user->nick);
+		else
+			g_value_take_string (value, g_strdup_printf ("%c%s", user->prefix[0], user->nick));
+		break;
+
+	case COL_HOST:
+		g_value_set_static_string (value, user->hostname);
+		break;
+
+	case COL_USER:
+		g_value_set_pointer (value, user);
+		break;
+
+	case COL_GDKCOLOR:
+		if (prefs.hex_away_track && user->away)
+			nick_color = COL_AWAY;
+		else if (prefs.hex_gui_ulist_color)
+			nick_color = text_color_of (user->nick);
+		if (nick_color)
+			g_value_set_boxed (value, &colors[nick_color]);
+		break;
+	}
+}
+
+static gboolean
+userlist_model_iter_next (GtkTreeModel *tree_model, GtkTreeIter *iter)
+{
+	return userlist_model_iter_nth_child (tree_model, iter, NULL,
+													  GPOINTER_TO_INT (iter->user_data2) + 1);
+}
+
+static gboolean
+userlist_model_iter_children (GtkTreeModel *tree_model, GtkTreeIter *iter,
+										GtkTreeIter *parent)
+{
+	return userlist_model_iter_nth_child (tree_model, iter, parent, 0);
+}
+
+static gboolean
+userlist_model_iter_has_child (GtkTreeModel *tree_model, GtkTreeIter *iter)
+{
+	return FALSE;
+}
+
+static gint
+userlist_model_iter_n_children (GtkTreeModel *tree_model, GtkTreeIter *iter)
+{
+	if (iter)
+		return 0;
+
+	return tree_size (USERLIST_MODEL (tree_model)->rows);
+}
+
+static gboolean
+userlist_model_iter_parent (GtkTreeModel *tree_model, GtkTreeIter *iter,
+									 GtkTreeIter *child)
+{
+	return FALSE;
+}
+
+static void
+userlist_model_tree_model_init (GtkTreeModelIface *iface)
+{
+	iface->get_flags = userlist_model_get_flags;
+	iface->get_n_columns = userlist_model_get_n_columns;
+	iface->get_column_type = userlist_model_get_column_type;
+	iface->get_iter = userlist_model_get_iter;
+	iface->get_path = userlist_model_get_path;
+	iface->get_value = userlist_model_get_value;
+	iface->iter_next = userlist_model_iter_next;
+	iface->iter_children = userlist_model_iter_children;
+	iface->iter_has_child = userlist_model_iter_has_child;
+	iface->iter_n_children = userlist_model_iter_n_children;
+	iface->iter_nth_child = userlist_model_iter_nth_child;
+	iface->iter_parent = userlist_model_iter_parent;
+}
+
+static void
+userlist_model_init (UserlistModel *model)
+{
+	model->stamp = g_random_int ();
+}
+
+static void
+userlist_model_finalize (GObject *object)
+{
+	UserlistModel *model = USERLIST_MODEL (object);
+
+	tree_destroy (model->rows);
+	if (model->arrival)
+		g_hash_table_destroy (model->arrival);
+
+	G_OBJECT_CLASS (userlist_model_parent_class)->finalize (object);
+}
+
+static void
+userlist_model_class_init (UserlistModelClass *klass)
+{
+	G_OBJECT_CLASS (klass)->finalize = userlist_model_finalize;
+}
+
+UserlistModel *
+userlist_model_new (session *sess)
+{
+	UserlistModel *model = g_object_new (USERLIST_TYPE_MODEL, NULL);
+
+	model->sess = sess;
+	model->sort = prefs.hex_gui_ulist_sort;
+	model->icons = prefs.hex_gui_ulist_icons;
+	if (model->sort < 0 || model->sort > 3)
+		model->arrival = g_hash_table_new (g_direct_hash, g_direct_equal);
+	model->rows = tree_new (userlist_model_cmp, model);
+
+	return model;
+}
+
+static gboolean
+userlist_model_add (UserlistModel *model, struct User *user, GtkTreeIter *iter)
+{
+	GtkTreePath *path;
+	int pos;
+
+	pos = tree_insert (model->rows, user);
+	if (pos < 0)
+		return FALSE;	/* already in there */
+	model->stamp++;
+
+	userlist_model_set_iter (model, iter, user, pos);
+	path = userlist_model_path (pos);
+	gtk_tree_model_row_inserted (GTK_TREE_MODEL (model), path, iter);
+	gtk_tree_path_free (path);
+	return TRUE;
+}
+
+/* a new user, goes to the top when unsorted. FALSE if it was a duplicate */
+
+gboolean
+userlist_model_insert (UserlistModel *model, struct User *user, GtkTreeIter *iter)
+{
+	if (model->arrival)
+		g_hash_table_insert (model->arrival, user,
+									GINT_TO_POINTER (++model->arrival_head));
+
+	if (userlist_model_add (model, user, iter))
+		return TRUE;
+
+	if (model->arrival)
+		g_hash_table_remove (model->arrival, user);
+	return FALSE;
+}
+
+/* one of a NAMES reply, goes to the bottom when unsorted */
+
+void
+userlist_model_append (UserlistModel *model, struct User *user)
+{
+	GtkTreeIter iter;
+
+	if (model->arrival)
+		g_hash_table_insert (model->arrival, user,
+									GINT_TO_POINTER (--model->arrival_tail));
+
+	if (!userlist_model_add (model, user, &iter) && model->arrival)
+		g_hash_table_remove (model->arrival, user);
+}
+
+gboolean
+userlist_model_find (UserlistModel *model, struct User *user, GtkTreeIter *iter)
+{
+	struct User *found;
+	int pos;
+
+	found = tree_find (model->rows, user, userlist_model_cmp, model, &pos);
+	if (found != user)
+	{
+		/* the nick compare changed under us (CASEMAPPING), look the slow way */
+		for (pos = 0; (found = tree_nth (model->rows, pos)); pos++)
+		{
+			if (found == user)
+				break;
+		}
+		if (!found)
+			return FALSE;
+	}
+
+	userlist_model_set_iter (model, iter, user, pos);
+	return TRUE;
+}
+
+void
+userlist_model_remove (UserlistModel *model, GtkTreeIter *iter)
+{
+	GtkTreePath *path;
+	int pos = GPOINTER_TO_INT (iter->user_data2);
+
+	g_return_if_fail (iter->stamp == model->stamp);
+
+	tree_remove_at_pos (model->rows, pos);
+	if (model->arrival)
+		g_hash_table_remove (model->arrival, iter->user_data);
+	model->stamp++;
+
+	path = userlist_model_path (pos);
+	gtk_tree_model_row_deleted (GTK_TREE_MODEL (model), path);
+	gtk_tree_path_free (path);
+}
+
+/* the row's host or color changed, nothing that moves it */
+
+void
+userlist_model_changed (UserlistModel *model, GtkTreeIter *iter)
+{
+	GtkTreePath *path;
+
+	path = userlist_model_path (GPOINTER_TO_INT (iter->user_data2));
+	gtk_tree_model_row_changed (GTK_TREE_MODEL (model), path, iter);
+	gtk_tree_path_free (path);
+}
+
+void
+userlist_model_clear (UserlistModel *model)
+{
+	GtkTreePath *path;
+	int pos;
+
+	/* from the bottom up, so no other row has to be renumbered */
+	pos = tree_size (model->rows);
+	while (pos > 0)
+	{
+		pos--;
+		tree_remove_at_pos (model->rows, pos);
+		model->stamp++;
+
+		path = userlist_model_path (pos);
+		gtk_tree_model_row_deleted (GTK_TREE_MODEL (model), path);
+		gtk_tree_path_free (path);
+	}
+
+	if (model->arrival)
+		g_hash_table_remove_all (model->arrival);
+	model->arrival_head = 0;
+	model->arrival_tail = 0;
+}
@@ -0,0 +1,83 @@
+/* HexChat
+ * Copyright (C) 1998-2010 Peter Zelezny.
+ * Copyright (C) 2009-2013 Berke Viktor.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#ifndef HEXCHAT_USERLIST_MODEL_H
+#define HEXCHAT_USERLIST_MODEL_H
+
+#include <gtk/gtk.h>
+
+#include "../common/tree.h"
+
+GType userlist_model_get_type (void);
+
+#define USERLIST_TYPE_MODEL         (userlist_model_get_type ())
+#define USERLIST_MODEL(obj)         (G_TYPE_CHECK_INSTANCE_CAST ((obj), USERLIST_TYPE_MODEL, UserlistModel))
+#define USERLIST_IS_MODEL(obj)      (G_TYPE_CHECK_INSTANCE_TYPE ((obj), USERLIST_TYPE_MODEL))
+
+/* The data columns that we export via the tree model interface */
+
+enum
+{
+	COL_PIX=0,		/* GdkPixbuf * */
+	COL_NICK=1,		/* char * */
+	COL_HOST=2,		/* char * */
+	COL_USER=3,		/* struct User * */
+	COL_GDKCOLOR=4,	/* GdkColor * */
+	USERLIST_N_COLUMNS
+};
+
+typedef struct _UserlistModel UserlistModel;
+typedef struct _UserlistModelClass UserlistModelClass;
+
+/* UserlistModel: the nick list of one session. It holds nothing but
+ * pointers to the session's struct Users, kept in display order in a
+ * counted tree, so a row is found by comparing Users and its row
+ * number comes with it. Column values are worked out when asked for. */
+
+struct _UserlistModel
+{
+	GObject parent;
+
+	struct session *sess;
+	tree *rows;			/* struct User *, in display order */
+	int sort;			/* hex_gui_ulist_sort when created */
+	gboolean icons;	/* hex_gui_ulist_icons when created */
+
+	/* "Unsorted": newest first, NAMES replies appended at the end */
+	GHashTable *arrival;	/* struct User * -> arrival number */
+	int arrival_head;
+	int arrival_tail;
+
+	gint stamp;			/* changes whenever rows move, to expire iters */
+};
+
+struct _UserlistModelClass
+{
+	GObjectClass parent_class;
+};
+
+UserlistModel *userlist_model_new (struct session *sess);
+gboolean userlist_model_insert (UserlistModel *model, struct User *user, GtkTreeIter *iter);
+void userlist_model_append (UserlistModel *model, struct User *user);
+gboolean userlist_model_find (UserlistModel *model, struct User *user, GtkTreeIter *iter);
+void userlist_model_remove (UserlistModel *model, GtkTreeIter *iter);
+void userlist_model_changed (UserlistModel *model, GtkTreeIter *iter);
+void userlist_model_clear (UserlistModel *model);
+
+#endif
@@ -38,17 +38,9 @@
 #include "menu.h"
 #include "pixmaps.h"
 #include "userlistgui.h"
+#include "userlist-model.h"
 #include "fkeys.h"
 
-enum
-{
-	COL_PIX=0,		/* GdkPixbuf * */
-	COL_NICK=1,		/* char * */
-	COL_HOST=2,		/* char * */
-	COL_USER=3,		/* struct User * */
-	COL_GDKCOLOR=4	/* GdkColor * */
-};
-
 
 GdkPixbuf *
 get_user_icon (server *serv, struct User *user)
@@ -138,26 +130,21 @@ userlist_select (session *sess, char *name)
 	GtkTreeView *treeview = GTK_TREE_VIEW (sess->gui->user_tree);
 	GtkTreeModel *model = gtk_tree_view_get_model (treeview);
 	GtkTreeSelection *selection = gtk_tree_view_get_selection (treeview);
-	struct User *row_user;
+	struct User *user;
 
-	if (gtk_tree_model_get_iter_first (model, &iter))
+	if (model != sess->res->user_model)
+		return;
+
+	user = userlist_find (sess, name);
+	if (user && userlist_model_find (USERLIST_MODEL (model), user, &iter))
 	{
-		do
-		{
-			gtk_tree_model_get (model, &iter, COL_USER, &row_user, -1);
-			if (sess->server->p_cmp (row_user->nick, name) == 0)
-			{
-				if (gtk_tree_selection_iter_is_selected (selection, &iter))
-					gtk_tree_selection_unselect_iter (selection, &iter);
-				else
-					gtk_tree_selection_select_iter (selection, &iter);
+		if (gtk_tree_selection_iter_is_selected (selection, &iter))
+			gtk_tree_selection_unselect_iter (selection, &iter);
+		else
+			gtk_tree_selection_select_iter (selection, &iter);
 
-				/* and make sure it's visible */
-				scroll_to_iter (&iter, treeview, model);
-				return;
-			}
-		}
-		while (gtk_tree_model_iter_next (model, &iter));
+		/* and make sure it's visible */
+		scroll_to_iter (&iter, treeview, model);
 	}
 }
 
@@ -211,27 +198,27 @@ userlist_selection_list (GtkWidget *widget, int *num_ret)
 void
 fe_userlist_set_selected (struct session *sess)
 {
-	GtkListStore *store = sess->res->user_model;
+	GtkTreeModel *store = sess->res->user_model;
 	GtkTreeSelection *selection = gtk_tree_view_get_selection (GTK_TREE_VIEW (sess->gui->user_tree));
 	GtkTreeIter iter;
 	struct User *user;
 
 	/* if it's not front-most tab it doesn't own the GtkTreeView! */
-	if (store != (GtkListStore*) gtk_tree_view_get_model (GTK_TREE_VIEW (sess->gui->user_tree)))
+	if (store != gtk_tree_view_get_model (GTK_TREE_VIEW (sess->gui->user_tree)))
 		return;
 
-	if (gtk_tree_model_get_iter_first (GTK_TREE_MODEL (store), &iter))
+	if (gtk_tree_model_get_iter_first (store, &iter))
 	{
 		do
 		{
-			gtk_tree_model_get (GTK_TREE_MODEL (store), &iter, COL_USER, &user, -1);
+			gtk_tree_model_get (store, &iter, COL_USER, &user, -1);
 
 			if (gtk_tree_selection_iter_is_selected (selection, &iter))
 				user->selected = 1;
 			else
 				user->selected = 0;
 				
-		} while (gtk_tree_model_iter_next (GTK_TREE_MODEL (store), &iter));
+		} while (gtk_tree_model_iter_next (store, &iter));
 	}
 }
 
@@ -240,28 +227,17 @@ find_row (GtkTreeView *treeview, GtkTreeModel *model, struct User *user,
 			 int *selected)
 {
 	static GtkTreeIter iter;
-	struct User *row_user;
 
 	*selected = FALSE;
-	if (gtk_tree_model_get_iter_first (model, &iter))
+	if (!userlist_model_find (USERLIST_MODEL (model), user, &iter))
+		return NULL;
+
+	if (gtk_tree_view_get_model (treeview) == model)
 	{
-		do
-		{
-			gtk_tree_model_get (model, &iter, COL_USER, &row_user, -1);
-			if (row_user == user)
-			{
-				if (gtk_tree_view_get_model (treeview) == model)
-				{
-					if (gtk_tree_selection_iter_is_selected (gtk_tree_view_get_selection (treeview), &iter))
-						*selected = TRUE;
-				}
-				return &iter;
-			}
-		}
-		while (gtk_tree_model_iter_next (model, &iter));
+		if (gtk_tree_selection_iter_is_selected (gtk_tree_view_get_selection (treeview), &iter))
+			*selected = TRUE;
 	}
-
-	return NULL;
+	return &iter;
 }
 
 void
@@ -286,14 +262,14 @@ fe_userlist_remove (session *sess, struct User *user)
 	int sel;
 
 	iter = find_row (GTK_TREE_VIEW (sess->gui->user_tree),
-						  GTK_TREE_MODEL(sess->res->user_model), user, &sel);
+						  sess->res->user_model, user, &sel);
 	if (!iter)
 		return 0;
 
 /*	adj = gtk_tree_view_get_vadjustment (GTK_TREE_VIEW (sess->gui->user_tree));
 	val = adj->value;*/
 
-	gtk_list_store_remove (sess->res->user_model, iter);
+	userlist_model_remove (USERLIST_MODEL (sess->res->user_model), iter);
 
 	/* is it the front-most tab? */
 /*	if (gtk_tree_view_get_model (GTK_TREE_VIEW (sess->gui->user_tree))
@@ -311,71 +287,36 @@ fe_userlist_remove (session *sess, struct User *user)
 void
 fe_userlist_rehash (session *sess, struct User *user)
 {
-	GtkTreeIter *iter;
-	int sel;
-	int nick_color = 0;
+	GtkTreeIter iter;
 
-	iter = find_row (GTK_TREE_VIEW (sess->gui->user_tree),
-						  GTK_TREE_MODEL(sess->res->user_model), user, &sel);
-	if (!iter)
-		return;
+	/* host and color are read from the User, only tell the view */
+	if (userlist_model_find (USERLIST_MODEL (sess->res->user_model), user, &iter))
+		userlist_model_changed (USERLIST_MODEL (sess->res->user_model), &iter);
+}
 
-	if (prefs.hex_away_track && user->away)
-		nick_color = COL_AWAY;
-	else if (prefs.hex_gui_ulist_color)
-		nick_color = text_color_of(user->nick);
+/* is it me? */
 
-	gtk_list_store_set (GTK_LIST_STORE (sess->res->user_model), iter,
-							  COL_HOST, user->hostname,
-							  COL_GDKCOLOR, nick_color ? &colors[nick_color] : NULL,
-							  -1);
+static void
+userlist_check_me (session *sess, struct User *user)
+{
+	if (user->me && sess->gui->nick_box)
+	{
+		if (!sess->gui->is_tab || sess == current_tab)
+			mg_set_access_icon (sess->gui, USERLIST_MODEL (sess->res->user_model)->icons ?
+									  get_user_icon (sess->server, user) : NULL,
+									  sess->server->is_away);
+	}
 }
 
 void
 fe_userlist_insert (session *sess, struct User *newuser, gboolean sel)
 {
-	GtkTreeModel *model = GTK_TREE_MODEL(sess->res->user_model);
-	GdkPixbuf *pix = get_user_icon (sess->server, newuser);
+	GtkTreeModel *model = sess->res->user_model;
 	GtkTreeIter iter;
-	char *nick;
-	int nick_color = 0;
-
-	if (prefs.hex_away_track && newuser->away)
-		nick_color = COL_AWAY;
-	else if (prefs.hex_gui_ulist_color)
-		nick_color = text_color_of(newuser->nick);
-
-	nick = newuser->nick;
-	if (!prefs.hex_gui_ulist_icons)
-	{
-		nick = g_malloc (strlen (newuser->nick) + 2);
-		nick[0] = newuser->prefix[0];
-		if (nick[0] == '\0' || nick[0] == ' ')
-			strcpy (nick, newuser->nick);
-		else
-			strcpy (nick + 1, newuser->nick);
-		pix = NULL;
-	}
-
-	gtk_list_store_insert_with_values (GTK_LIST_STORE (model), &iter, 0,
-									COL_PIX, pix,
-									COL_NICK, nick,
-									COL_HOST, newuser->hostname,
-									COL_USER, newuser,
-									COL_GDKCOLOR, nick_color ? &colors[nick_color] : NULL,
-								  -1);
-
-	if (!prefs.hex_gui_ulist_icons)
-	{
-		g_free (nick);
-	}
 
-	/* is it me? */
-	if (newuser->me && sess->gui->nick_box)
-	{
-		if (!sess->gui->is_tab || sess == current_tab)
-			mg_set_access_icon (sess->gui, pix, sess->server->is_away);
-	}
+	if (!userlist_model_insert (USERLIST_MODEL (model), newuser, &iter))
+		return;
+	userlist_check_me (sess, newuser);
 
 	/* is it the front-most tab? */
 	if (gtk_tree_view_get_model (GTK_TREE_VIEW (sess->gui->user_tree))
@@ -387,10 +328,35 @@ fe_userlist_insert (session *sess, struct User *newuser, gboolean sel)
 	}
 }
 
+/* a whole NAMES reply at once, detached from the view so it
+   doesn't have to follow every single row */
+
+void
+fe_userlist_insert_many (session *sess, struct User **users, int count)
+{
+	GtkTreeModel *model = sess->res->user_model;
+	GtkTreeView *view = GTK_TREE_VIEW (sess->gui->user_tree);
+	gboolean shown;
+	int i;
+
+	shown = (gtk_tree_view_get_model (view) == model);
+	if (shown)
+		gtk_tree_view_set_model (view, NULL);
+
+	for (i = 0; i < count; i++)
+	{
+		userlist_model_append (USERLIST_MODEL (model), users[i]);
+		userlist_check_me (sess, users[i]);
+	}
+
+	if (shown)
+		gtk_tree_view_set_model (view, model);
+}
+
 void
 fe_userlist_clear (session *sess)
 {
-	gtk_list_store_clear (sess->res->user_model);
+	userlist_model_clear (USERLIST_MODEL (sess->res->user_model));
 }
 
 static void
@@ -445,67 +411,10 @@ userlist_dnd_leave (GtkTreeView *widget, GdkDragContext *context, guint ttime)
 	return TRUE;
 }
 
-static int
-userlist_alpha_cmp (GtkTreeModel *model, GtkTreeIter *iter_a, GtkTreeIter *iter_b, gpointer userdata)
-{
-	struct User *user_a, *user_b;
-
-	gtk_tree_model_get (model, iter_a, COL_USER, &user_a, -1);
-	gtk_tree_model_get (model, iter_b, COL_USER, &user_b, -1);
-
-	return nick_cmp_alpha (user_a, user_b, ((session*)userdata)->server);
-}
-
-static int
-userlist_ops_cmp (GtkTreeModel *model, GtkTreeIter *iter_a, GtkTreeIter *iter_b, gpointer userdata)
-{
-	struct User *user_a, *user_b;
-
-	gtk_tree_model_get (model, iter_a, COL_USER, &user_a, -1);
-	gtk_tree_model_get (model, iter_b, COL_USER, &user_b, -1);
-
-	return nick_cmp_az_ops (((session*)userdata)->server, user_a, user_b);
-}
-
-GtkListStore *
+GtkTreeModel *
 userlist_create_model (session *sess)
 {
-	GtkListStore *store;
-	GtkTreeIterCompareFunc cmp_func;
-	GtkSortType sort_type;
-
-	store = gtk_list_store_new (5, GDK_TYPE_PIXBUF, G_TYPE_STRING, G_TYPE_STRING,
-										G_TYPE_POINTER, GDK_TYPE_COLOR);
-
-	switch (prefs.hex_gui_ulist_sort)
-	{
-	case 0:
-		cmp_func = userlist_ops_cmp;
-		sort_type = GTK_SORT_ASCENDING;
-		break;
-	case 1:
-		cmp_func = userlist_alpha_cmp;
-		sort_type = GTK_SORT_ASCENDING;
-		break;
-	case 2:
-		cmp_func = userlist_ops_cmp;
-		sort_type = GTK_SORT_DESCENDING;
-		break;
-	case 3:
-		cmp_func = userlist_alpha_cmp;
-		sort_type = GTK_SORT_DESCENDING;
-		break;
-	default:
-		/* No sorting */
-		gtk_tree_sortable_set_default_sort_func (GTK_TREE_SORTABLE(store), NULL, NULL, NULL);
-		return store;
-	}
-
-	gtk_tree_sortable_set_default_sort_func (GTK_TREE_SORTABLE(store), cmp_func, sess, NULL);
-	gtk_tree_sortable_set_sort_column_id (GTK_TREE_SORTABLE(store),
-						GTK_TREE_SORTABLE_DEFAULT_SORT_COLUMN_ID, sort_type);
-
-	return store;
+	return GTK_TREE_MODEL (userlist_model_new (sess));
 }
 
 static void
@@ -710,7 +619,7 @@ void
 userlist_show (session *sess)
 {
 	gtk_tree_view_set_model (GTK_TREE_VIEW (sess->gui->user_tree),
-									 GTK_TREE_MODEL(sess->res->user_model));
+									 sess->res->user_model);
 }
 
 void
@@ -722,32 +631,23 @@ fe_uselect (session *sess, char *word[], int do_clear, int scroll_to)
 	GtkTreeView *treeview = GTK_TREE_VIEW (sess->gui->user_tree);
 	GtkTreeModel *model = gtk_tree_view_get_model (treeview);
 	GtkTreeSelection *selection = gtk_tree_view_get_selection (treeview);
-	struct User *row_user;
+	struct User *user;
 
-	if (gtk_tree_model_get_iter_first (model, &iter))
-	{
-		if (do_clear)
-			gtk_tree_selection_unselect_all (selection);
+	if (model != sess->res->user_model)
+		return;
 
-		do
-		{
-			if (*word[0])
-			{
-				gtk_tree_model_get (model, &iter, COL_USER, &row_user, -1);
-				thisname = 0;
-				while ( *(name = word[thisname++]) )
-				{
-					if (sess->server->p_cmp (row_user->nick, name) == 0)
-					{
-						gtk_tree_selection_select_iter (selection, &iter);
-						if (scroll_to)
-							scroll_to_iter (&iter, treeview, model);
-						break;
-					}
-				}
-			}
+	if (do_clear)
+		gtk_tree_selection_unselect_all (selection);
 
+	thisname = 0;
+	while ( *(name = word[thisname++]) )
+	{
+		user = userlist_find (sess, name);
+		if (user && userlist_model_find (USERLIST_MODEL (model), user, &iter))
+		{
+			gtk_tree_selection_select_iter (selection, &iter);
+			if (scroll_to)
+				scroll_to_iter (&iter, treeview, model);
 		}
-		while (gtk_tree_model_iter_next (model, &iter));
 	}
 }
@@ -60,10 +60,26 @@
 
 static GtkWidgetClass *parent_class = NULL;
 
+/* textentries and their text are carved out of chunks owned by the
+   buffer; a chunk is freed once the last entry in it is */
+#define XTEXT_CHUNK_SIZE 65536
+#define XTEXT_ALIGN(n) (((n) + 7) & ~7)
+
+typedef struct xtext_chunk
+{
+	int size;
+	int used;
+	int live;			/* entries not freed yet */
+} xtext_chunk;
+
+/* wrap points that fit in the textentry itself */
+#define XTEXT_SUBLINES_INLINE 4
+
 struct textentry
 {
 	struct textentry *next;
 	struct textentry *prev;
+	xtext_chunk *chunk;
 	unsigned char *str;
 	time_t stamp;
 	gint16 str_width;
@@ -73,13 +89,25 @@ struct textentry
 	gint16 indent;
 	gint16 left_len;
 	GSList *slp;
-	GSList *sublines;
+	gint16 *sublines;	/* end offset of each wrap, 'lines' of them */
+	gint16 subline_buf[XTEXT_SUBLINES_INLINE];
+	int line;		/* first line, see gtk_xtext_line_of */
+	int seq;			/* sequence number, see XTEXT_INDEX */
+	gint16 lines;
 	guchar tag;
-	guchar pad1;
+	guchar pending;	/* XTEXT_UNMEASURED or XTEXT_UNWRAPPED */
 	guchar pad2;	/* 32-bit align : 44 bytes total */
 	GList *marks;	/* List of found strings */
 };
 
+/* values for ent->pending; entries of buffers that aren't shown are
+   measured and wrapped only once they are about to be drawn */
+enum
+{
+	XTEXT_UNWRAPPED = 1,		/* sublines and lines are estimates */
+	XTEXT_UNMEASURED			/* str_width and slp too */
+};
+
 enum
 {
 	WORD_CLICK,
@@ -105,6 +133,7 @@ static void gtk_xtext_calc_lines (xtext_buffer *buf, int);
 static gboolean gtk_xtext_is_selecting (GtkXText *xtext);
 static char *gtk_xtext_selection_get_text (GtkXText *xtext, int *len_ret);
 static textentry *gtk_xtext_nth (GtkXText *xtext, int line, int *subline);
+static int gtk_xtext_subline_end (textentry *ent, int n);
 static void gtk_xtext_adjustment_changed (GtkAdjustment * adj,
 														GtkXText * xtext);
 static void gtk_xtext_scroll_adjustments (GtkXText *xtext, GtkAdjustment *hadj,
@@ -129,6 +158,9 @@ static gboolean gtk_xtext_check_ent_visibility (GtkXText * xtext, textentry *fin
 static int gtk_xtext_render_page_timeout (GtkXText * xtext);
 static int gtk_xtext_search_offset (xtext_buffer *buf, textentry *ent, unsigned int off);
 static GList * gtk_xtext_search_textentry (xtext_buffer *, textentry *);
+static void gtk_xtext_search_index_add (xtext_buffer *buf, textentry *ent, int seq, gboolean front);
+static void gtk_xtext_search_index_sweep (xtext_buffer *buf);
+static void gtk_xtext_search_index_free (xtext_buffer *buf);
 static void gtk_xtext_search_textentry_add (xtext_buffer *, textentry *, GList *, gboolean);
 static void gtk_xtext_search_textentry_del (xtext_buffer *, textentry *);
 static void gtk_xtext_search_textentry_fini (gpointer, gpointer);
@@ -148,6 +180,30 @@ static char * gtk_xtext_get_word (GtkXText * xtext, int x, int y, textentry ** r
 static PangoAttrList *attr_lists[4];
 static int fontwidths[4][128];
 
+/* widths of everything past ASCII, measured on first use and kept in
+   pages of 256 codepoints until the font changes */
+#define WIDTH_PAGE_SHIFT 8
+#define WIDTH_PAGE_SIZE (1 << WIDTH_PAGE_SHIFT)
+#define WIDTH_PAGES ((0x10FFFF >> WIDTH_PAGE_SHIFT) + 1)
+#define WIDTH_UNKNOWN G_MAXUINT16
+static guint16 **widthpages[4];
+
+static void
+xtext_widths_clear (void)
+{
+	int i, j;
+
+	for (i = 0; i < 4; i++)
+	{
+		if (!widthpages[i])
+			continue;
+		for (j = 0; j < WIDTH_PAGES; j++)
+			g_free (widthpages[i][j]);
+		g_free (widthpages[i]);
+		widthpages[i] = NULL;
+	}
+}
+
 static PangoAttribute *
 xtext_pango_attr (PangoAttribute *attr)
 {
@@ -202,6 +258,8 @@ xtext_pango_init (GtkXText *xtext)
 		}
 	}
 	xtext->space_width = fontwidths[0][' '];
+
+	xtext_widths_clear ();
 }
 
 static void
@@ -291,6 +349,44 @@ backend_font_open (GtkXText *xtext, char *name)
 	pango_font_metrics_unref (metrics);
 }
 
+/* width of the single character at 'str', from the cache if possible */
+
+static int
+backend_get_char_width (GtkXText *xtext, guchar *str, int mbl, int emphasis)
+{
+	gunichar c;
+	guint16 *page;
+	int width;
+
+	c = g_utf8_get_char_validated (str, mbl);
+	if (c < 0x110000)
+	{
+		if (!widthpages[emphasis])
+			widthpages[emphasis] = g_new0 (guint16 *, WIDTH_PAGES);
+		page = widthpages[emphasis][c >> WIDTH_PAGE_SHIFT];
+		if (!page)
+		{
+			page = g_new (guint16, WIDTH_PAGE_SIZE);
+			memset (page, 0xff, WIDTH_PAGE_SIZE * sizeof (guint16));
+			widthpages[emphasis][c >> WIDTH_PAGE_SHIFT] = page;
+		}
+		if (page[c & (WIDTH_PAGE_SIZE - 1)] != WIDTH_UNKNOWN)
+			return page[c & (WIDTH_PAGE_SIZE - 1)];
+	}
+	else
+	{
+		page = NULL;	/* invalid UTF-8, let pango deal with it every time */
+	}
+
+	pango_layout_set_attributes (xtext->layout, attr_lists[emphasis]);
+	pango_layout_set_text (xtext->layout, str, mbl);
+	pango_layout_get_pixel_size (xtext->layout, &width, NULL);
+
+	if (page)
+		page[c & (WIDTH_PAGE_SIZE - 1)] = MIN (width, WIDTH_UNKNOWN - 1);
+	return width;
+}
+
 static int
 backend_get_text_width_emph (GtkXText *xtext, guchar *str, int len, int emphasis)
 {
@@ -306,17 +402,13 @@ backend_get_text_width_emph (GtkXText *xtext, guchar *str, int len, int emphasis
 	emphasis &= (EMPH_ITAL | EMPH_BOLD);
 
 	width = 0;
-	pango_layout_set_attributes (xtext->layout, attr_lists[emphasis]);
 	while (len > 0)
 	{
 		mbl = charlen(str);
 		if (*str < 128)
 			deltaw = fontwidths[emphasis][*str];
 		else
-		{
-			pango_layout_set_text (xtext->layout, str, mbl);
-			pango_layout_get_pixel_size (xtext->layout, &deltaw, NULL);
-		}
+			deltaw = backend_get_char_width (xtext, str, mbl, emphasis);
 		width += deltaw;
 		str += mbl;
 		len -= mbl;
@@ -828,7 +920,7 @@ find_x (GtkXText *xtext, textentry *ent, int x, int subline, int indent)
 	/* Skip to the first chunk of stuff for the subline */
 	if (subline > 0)
 	{
-		suboff = GPOINTER_TO_INT (g_slist_nth_data (ent->sublines, subline - 1));
+		suboff = gtk_xtext_subline_end (ent, subline - 1);
 		for (list = ent->slp; list; list = g_slist_next (list))
 		{
 			meta = list->data;
@@ -1015,7 +1107,7 @@ gtk_xtext_draw_marker (GtkXText * xtext, textentry * ent, int y)
 	}
 	else if (xtext->buffer->marker_pos == ent->next && ent->next != NULL)
 	{
-		render_y = y + xtext->font->descent + xtext->fontsize * g_slist_length (ent->sublines);
+		render_y = y + xtext->font->descent + xtext->fontsize * ent->lines;
 	}
 	else return;
 
@@ -3276,7 +3368,7 @@ gtk_xtext_find_subline (GtkXText *xtext, textentry *ent, int line)
 
 	if (line > 0)
 	{
-		rlen = GPOINTER_TO_UINT (g_slist_nth_data (ent->sublines, line - 1));
+		rlen = gtk_xtext_subline_end (ent, line - 1);
 		if (rlen == 0)
 			rlen = ent->str_len;
 	}
@@ -3374,9 +3466,9 @@ gtk_xtext_render_line (GtkXText * xtext, textentry * ent, int line,
 	do
 	{
 		if (entline > 0)
-			len = GPOINTER_TO_INT (g_slist_nth_data (ent->sublines, entline)) - GPOINTER_TO_INT (g_slist_nth_data (ent->sublines, entline - 1));
+			len = gtk_xtext_subline_end (ent, entline) - gtk_xtext_subline_end (ent, entline - 1);
 		else
-			len = GPOINTER_TO_INT (g_slist_nth_data (ent->sublines, entline));
+			len = gtk_xtext_subline_end (ent, entline);
 
 		entline++;
 
@@ -3388,7 +3480,7 @@ gtk_xtext_render_line (GtkXText * xtext, textentry * ent, int line,
 			{
 				/* small optimization */
 				gtk_xtext_draw_marker (xtext, ent, y - xtext->fontsize * (taken + start_subline + 1));
-				return g_slist_length (ent->sublines) - subline;
+				return ent->lines - subline;
 			}
 		} else
 		{
@@ -3469,7 +3561,9 @@ gtk_xtext_recalc_widths (xtext_buffer *buf, int do_str_width)
 	{
 		if (do_str_width)
 		{
-			ent->str_width = gtk_xtext_text_width_ent (buf->xtext, ent);
+			if (!ent->pending)
+				buf->pending_ents++;
+			ent->pending = XTEXT_UNMEASURED;
 		}
 		if (ent->left_len != -1)
 		{
@@ -3570,42 +3664,326 @@ gtk_xtext_save (GtkXText * xtext, int fh)
 	}
 }
 
+/* end offset of wrap number 'n' of 'ent', 0 if it has no such wrap */
+
+static int
+gtk_xtext_subline_end (textentry *ent, int n)
+{
+	if (ent->pending || n < 0 || n >= ent->lines)
+		return 0;
+	return ent->sublines[n];
+}
+
+static void
+gtk_xtext_subline_add (textentry *ent, int n, int end)
+{
+	if (n == XTEXT_SUBLINES_INLINE)
+	{
+		ent->sublines = g_new (gint16, n * 2);
+		memcpy (ent->sublines, ent->subline_buf, sizeof (ent->subline_buf));
+	}
+	else if (n > XTEXT_SUBLINES_INLINE && (n & (n - 1)) == 0)
+	{
+		ent->sublines = g_renew (gint16, ent->sublines, n * 2);
+	}
+	ent->sublines[n] = end;
+}
+
+static void
+gtk_xtext_sublines_free (textentry *ent)
+{
+	if (ent->sublines != ent->subline_buf)
+		g_free (ent->sublines);
+	ent->sublines = ent->subline_buf;
+}
+
 /* count how many lines 'ent' will take (with wraps) */
 
 static int
 gtk_xtext_lines_taken (xtext_buffer *buf, textentry * ent)
 {
 	unsigned char *str;
-	int indent, len;
+	int indent, len, lines;
 	int win_width;
 
-	g_slist_free (ent->sublines);
-	ent->sublines = NULL;
+	gtk_xtext_sublines_free (ent);
 	win_width = buf->window_width - MARGIN;
 
 	if (win_width >= ent->indent + ent->str_width)
 	{
-		ent->sublines = g_slist_append (ent->sublines, GINT_TO_POINTER (ent->str_len));
+		ent->sublines[0] = ent->str_len;
+		ent->lines = 1;
 		return 1;
 	}
 
 	indent = ent->indent;
 	str = ent->str;
+	lines = 0;
 
 	do
 	{
 		len = find_next_wrap (buf->xtext, ent, str, win_width, indent);
-		ent->sublines = g_slist_append (ent->sublines, GINT_TO_POINTER (str + len - ent->str));
+		gtk_xtext_subline_add (ent, lines++, str + len - ent->str);
 		indent = buf->indent;
 		str += len;
 	}
 	while (str < ent->str + ent->str_len);
 
-	return g_slist_length (ent->sublines);
+	ent->lines = lines;
+	return lines;
+}
+
+/* The entries are also kept in a ring of pointers, in list order, so a
+   line number can be found by binary search over ent->line instead of
+   walking the list. Slot n holds the entry with sequence number
+   ent_base + n, which is what the search index refers to entries by. */
+
+#define XTEXT_INDEX(buf, n) \
+	((buf)->ent_index[((buf)->ent_index_head + (n)) & ((buf)->ent_index_size - 1)])
+
+static void
+gtk_xtext_index_push (xtext_buffer *buf, textentry *ent, gboolean front)
+{
+	textentry **index;
+	int i, size;
+
+	if (buf->ent_count == buf->ent_index_size)
+	{
+		size = buf->ent_index_size ? buf->ent_index_size * 2 : 64;
+		index = g_new (textentry *, size);
+		for (i = 0; i < buf->ent_count; i++)
+			index[i] = XTEXT_INDEX (buf, i);
+		g_free (buf->ent_index);
+		buf->ent_index = index;
+		buf->ent_index_size = size;
+		buf->ent_index_head = 0;
+	}
+
+	if (front)
+	{
+		buf->ent_index_head = (buf->ent_index_head - 1) & (buf->ent_index_size - 1);
+		buf->ent_index[buf->ent_index_head] = ent;
+		buf->ent_base--;
+		ent->seq = buf->ent_base;
+	}
+	else
+	{
+		XTEXT_INDEX (buf, buf->ent_count) = ent;
+		ent->seq = buf->ent_base + buf->ent_count;
+	}
+	buf->ent_count++;
+}
+
+static void
+gtk_xtext_index_pop (xtext_buffer *buf, gboolean front)
+{
+	if (front)
+	{
+		buf->ent_index_head = (buf->ent_index_head + 1) & (buf->ent_index_size - 1);
+		buf->ent_base++;
+	}
+	buf->ent_count--;
+}
+
+static void
+gtk_xtext_index_clear (xtext_buffer *buf)
+{
+	g_free (buf->ent_index);
+	buf->ent_index = NULL;
+	buf->ent_index_size = 0;
+	buf->ent_index_head = 0;
+	buf->ent_count = 0;
+	buf->ent_base = 0;
+	buf->line_shift = 0;
+}
+
+/* number every entry from 0 again; needed after rewrapping, and now and
+   then to keep ent->line from overflowing in long-lived buffers */
+
+static void
+gtk_xtext_renumber (xtext_buffer *buf)
+{
+	textentry *ent;
+	int line = 0;
+
+	for (ent = buf->text_first; ent; ent = ent->next)
+	{
+		ent->line = line;
+		line += ent->lines;
+	}
+	buf->line_shift = 0;
+}
+
+/* When settling a page changes how many lines it takes, the entries
+   below it aren't renumbered right away: line_shift says how far off
+   their ent->line is. These read and write the real numbers. */
+
+static int
+gtk_xtext_line_of (xtext_buffer *buf, textentry *ent)
+{
+	if (buf->line_shift && ent->seq >= buf->line_shift_seq)
+		return ent->line + buf->line_shift;
+	return ent->line;
+}
+
+static void
+gtk_xtext_set_line (xtext_buffer *buf, textentry *ent, int line)
+{
+	if (buf->line_shift && ent->seq >= buf->line_shift_seq)
+		line -= buf->line_shift;
+	ent->line = line;
+}
+
+/* add 'delta' to ent->line of the entries numbered from..to-1 */
+
+static void
+gtk_xtext_shift_lines (xtext_buffer *buf, int from, int to, int delta)
+{
+	int seq;
+
+	from = MAX (from, buf->ent_base);
+	to = MIN (to, buf->ent_base + buf->ent_count);
+	for (seq = from; seq < to; seq++)
+		XTEXT_INDEX (buf, seq - buf->ent_base)->line += delta;
+}
+
+/* line number of 'ent' within its buffer */
+
+static int
+gtk_xtext_ent_line (xtext_buffer *buf, textentry *ent)
+{
+	return gtk_xtext_line_of (buf, ent) - gtk_xtext_line_of (buf, buf->text_first);
+}
+
+/* leave 'ent' for later and guess how many lines it will take */
+
+static void
+gtk_xtext_defer_ent (xtext_buffer *buf, textentry *ent)
+{
+	int win_width, width, sub_width, lines;
+
+	if (!ent->pending)
+	{
+		ent->pending = XTEXT_UNWRAPPED;
+		buf->pending_ents++;
+	}
+	gtk_xtext_sublines_free (ent);
+
+	if (ent->pending == XTEXT_UNMEASURED)
+		width = ent->str_len * buf->xtext->space_width;
+	else
+		width = ent->str_width;
+
+	win_width = buf->window_width - MARGIN;
+	sub_width = win_width - buf->indent;
+	if (sub_width <= 0 || win_width >= ent->indent + width)
+		lines = 1;
+	else
+		lines = 1 + (ent->indent + width - win_width + sub_width - 1) / sub_width;
+
+	/* every line holds at least one character */
+	ent->lines = MIN (lines, MAX (ent->str_len, 1));
+}
+
+/* measure and wrap 'ent' for real; the caller renumbers */
+
+static void
+gtk_xtext_settle_ent (xtext_buffer *buf, textentry *ent)
+{
+	if (ent->pending == XTEXT_UNMEASURED)
+		ent->str_width = gtk_xtext_text_width_ent (buf->xtext, ent);
+	ent->pending = 0;
+	buf->pending_ents--;
+	gtk_xtext_lines_taken (buf, ent);
+}
+
+/* wrap 'ent' now if its buffer is shown, otherwise only estimate */
+
+static int
+gtk_xtext_wrap_ent (xtext_buffer *buf, textentry *ent)
+{
+	if (buf->xtext->buffer != buf)
+		gtk_xtext_defer_ent (buf, ent);
+	else if (ent->pending)
+		gtk_xtext_settle_ent (buf, ent);
+	else
+		gtk_xtext_lines_taken (buf, ent);
+	return ent->lines;
+}
+
+/* wrap the pending entries on the page about to be drawn, moving the
+   view to keep the bottom in place if it was scrolled down. Returns
+   TRUE if line numbers changed. */
+
+static gboolean
+gtk_xtext_settle_page (GtkXText *xtext)
+{
+	xtext_buffer *buf = xtext->buffer;
+	GtkAdjustment *adj = xtext->adj;
+	textentry *ent, *first, *last, *next;
+	int lines, subline, next_line;
+	gboolean changed = FALSE;
+
+	while (buf->pending_ents > 0)
+	{
+		ent = gtk_xtext_nth (xtext, adj->value, &subline);
+		if (ent == NULL)
+			break;
+
+		first = last = NULL;
+		lines = adj->page_size + subline + 1;
+		for (; ent && lines > 0; ent = ent->next)
+		{
+			if (ent->pending)
+			{
+				gtk_xtext_settle_ent (buf, ent);
+				if (!first)
+					first = ent;
+			}
+			lines -= ent->lines;
+			last = ent;
+		}
+		if (!first)
+			break;
+
+		next = last->next;
+		next_line = next ? gtk_xtext_line_of (buf, next) : 0;
+
+		/* give the page real numbers, the rest moves by the difference */
+		if (!buf->line_shift)
+			buf->line_shift_seq = last->seq + 1;
+		gtk_xtext_shift_lines (buf, buf->line_shift_seq, last->seq + 1, buf->line_shift);
+		buf->line_shift_seq = MAX (buf->line_shift_seq, last->seq + 1);
+
+		for (ent = first->next; ent != next; ent = ent->next)
+			ent->line = ent->prev->line + ent->prev->lines;
+
+		if (next)
+		{
+			/* those between here and the old mark join the shifted ones */
+			gtk_xtext_shift_lines (buf, next->seq, buf->line_shift_seq, -buf->line_shift);
+			buf->line_shift += last->line + last->lines - next_line;
+			buf->line_shift_seq = next->seq;
+		}
+		buf->num_lines = gtk_xtext_ent_line (buf, buf->text_last) + buf->text_last->lines;
+		buf->pagetop_ent = NULL;
+
+		gtk_xtext_adjustment_set (buf, FALSE);
+		if (buf->scrollbar_down)
+		{
+			adj->value = adj->upper - adj->page_size;
+			if (adj->value < 0)
+				adj->value = 0;
+		}
+		changed = TRUE;
+	}
+
+	return changed;
 }
 
 /* Calculate number of actual lines (with wraps), to set adj->lower. *
- * This should only be called when the window resizes.               */
+ * This should only be called when the window resizes. Buffers that  *
+ * aren't shown only get estimates, see gtk_xtext_settle_page.       */
 
 static void
 gtk_xtext_calc_lines (xtext_buffer *buf, int fire_signal)
@@ -3623,10 +4001,12 @@ gtk_xtext_calc_lines (xtext_buffer *buf, int fire_signal)
 		return;
 
 	lines = 0;
+	buf->line_shift = 0;
 	ent = buf->text_first;
 	while (ent)
 	{
-		lines += gtk_xtext_lines_taken (buf, ent);
+		ent->line = lines;
+		lines += gtk_xtext_wrap_ent (buf, ent);
 		ent = ent->next;
 	}
 
@@ -3635,63 +4015,44 @@ gtk_xtext_calc_lines (xtext_buffer *buf, int fire_signal)
 	gtk_xtext_adjustment_set (buf, fire_signal);
 }
 
-/* find the n-th line in the linked list, this includes wrap calculations */
+/* find the n-th line in the buffer, this includes wrap calculations */
 
 static textentry *
 gtk_xtext_nth (GtkXText *xtext, int line, int *subline)
 {
-	int lines = 0;
+	xtext_buffer *buf = xtext->buffer;
 	textentry *ent;
+	int low, high, mid;
 
-	ent = xtext->buffer->text_first;
+	if (buf->text_first == NULL)
+		return NULL;
 
-	/* -- optimization -- try to make a short-cut using the pagetop ent */
-	if (xtext->buffer->pagetop_ent)
+	/* anything above the buffer belongs to the first entry */
+	if (line < 0)
 	{
-		if (line == xtext->buffer->pagetop_line)
-		{
-			*subline = xtext->buffer->pagetop_subline;
-			return xtext->buffer->pagetop_ent;
-		}
-		if (line > xtext->buffer->pagetop_line)
-		{
-			/* lets start from the pagetop instead of the absolute beginning */
-			ent = xtext->buffer->pagetop_ent;
-			lines = xtext->buffer->pagetop_line - xtext->buffer->pagetop_subline;
-		}
-		else if (line > xtext->buffer->pagetop_line - line)
-		{
-			/* move backwards from pagetop */
-			ent = xtext->buffer->pagetop_ent;
-			lines = xtext->buffer->pagetop_line - xtext->buffer->pagetop_subline;
-			while (1)
-			{
-				if (lines <= line)
-				{
-					*subline = line - lines;
-					return ent;
-				}
-				ent = ent->prev;
-				if (!ent)
-					break;
-				lines -= g_slist_length (ent->sublines);
-			}
-			return NULL;
-		}
+		*subline = line;
+		return buf->text_first;
 	}
-	/* -- end of optimization -- */
 
-	while (ent)
+	line += gtk_xtext_line_of (buf, buf->text_first);
+	if (line >= gtk_xtext_line_of (buf, buf->text_last) + buf->text_last->lines)
+		return NULL;
+
+	/* last entry starting at or before 'line' */
+	low = 0;
+	high = buf->ent_count - 1;
+	while (low < high)
 	{
-		lines += g_slist_length (ent->sublines);
-		if (lines > line)
-		{
-			*subline = g_slist_length (ent->sublines) - (lines - line);
-			return ent;
-		}
-		ent = ent->next;
+		mid = low + (high - low + 1) / 2;
+		if (gtk_xtext_line_of (buf, XTEXT_INDEX (buf, mid)) <= line)
+			low = mid;
+		else
+			high = mid - 1;
 	}
-	return NULL;
+
+	ent = XTEXT_INDEX (buf, low);
+	*subline = line - gtk_xtext_line_of (buf, ent);
+	return ent;
 }
 
 /* render enta (or an inclusive range enta->entb) */
@@ -3699,12 +4060,13 @@ gtk_xtext_nth (GtkXText *xtext, int line, int *subline)
 static int
 gtk_xtext_render_ents (GtkXText * xtext, textentry * enta, textentry * entb)
 {
-	textentry *ent, *orig_ent, *tmp_ent;
+	textentry *ent, *orig_ent;
 	int line;
 	int lines_max;
 	int width;
 	int height;
 	int subline;
+	int top;
 	int drawing = FALSE;
 
 	if (xtext->buffer->indent < MARGIN)
@@ -3729,18 +4091,10 @@ gtk_xtext_render_ents (GtkXText * xtext, textentry * enta, textentry * entb)
 	/* check if enta is before the start of this page */
 	if (entb)
 	{
-		tmp_ent = orig_ent;
-		while (tmp_ent)
-		{
-			if (tmp_ent == enta)
-				break;
-			if (tmp_ent == entb)
-			{
-				drawing = TRUE;
-				break;
-			}
-			tmp_ent = tmp_ent->next;
-		}
+		top = gtk_xtext_line_of (xtext->buffer, orig_ent);
+		if (gtk_xtext_line_of (xtext->buffer, enta) < top &&
+			 gtk_xtext_line_of (xtext->buffer, entb) >= top)
+			drawing = TRUE;
 	}
 
 	ent = orig_ent;
@@ -3763,7 +4117,7 @@ gtk_xtext_render_ents (GtkXText * xtext, textentry * enta, textentry * entb)
 				line -= subline;
 				subline = 0;
 			}
-			line += g_slist_length (ent->sublines);
+			line += ent->lines;
 		}
 
 		if (ent == entb)
@@ -3804,6 +4158,12 @@ gtk_xtext_render_page (GtkXText * xtext)
 	if (width < 34 || height < xtext->fontsize || width < xtext->buffer->indent + 32)
 		return;
 
+	if (gtk_xtext_settle_page (xtext))
+	{
+		gtk_adjustment_changed (xtext->adj);
+		startline = xtext->adj->value;
+	}
+
 	xtext->pixel_offset = (xtext->adj->value - startline) * xtext->fontsize;
 
 	subline = line = 0;
@@ -3928,10 +4288,10 @@ gtk_xtext_kill_ent (xtext_buffer *buffer, textentry *ent)
 		gtk_xtext_search_textentry_del (buffer, ent);
 	}
 
-	g_slist_free_full (ent->slp, g_free);
-	g_slist_free (ent->sublines);
+	if (ent->pending)
+		buffer->pending_ents--;
 
-	g_free (ent);
+	gtk_xtext_ent_free (buffer, ent);
 	return visible;
 }
 
@@ -3945,20 +4305,23 @@ gtk_xtext_remove_top (xtext_buffer *buffer)
 	ent = buffer->text_first;
 	if (!ent)
 		return;
-	buffer->num_lines -= g_slist_length (ent->sublines);
-	buffer->pagetop_line -= g_slist_length (ent->sublines);
-	buffer->last_pixel_pos -= (g_slist_length (ent->sublines) * buffer->xtext->fontsize);
+	buffer->num_lines -= ent->lines;
+	buffer->pagetop_line -= ent->lines;
+	buffer->last_pixel_pos -= (ent->lines * buffer->xtext->fontsize);
 	buffer->text_first = ent->next;
 	if (buffer->text_first)
 		buffer->text_first->prev = NULL;
 	else
 		buffer->text_last = NULL;
+	gtk_xtext_index_pop (buffer, TRUE);
+	if (buffer->search_index)
+		gtk_xtext_search_index_sweep (buffer);
 
-	buffer->old_value -= g_slist_length (ent->sublines);
+	buffer->old_value -= ent->lines;
 	if (buffer->xtext->buffer == buffer)	/* is it the current buffer? */
 	{
-		buffer->xtext->adj->value -= g_slist_length (ent->sublines);
-		buffer->xtext->select_start_adj -= g_slist_length (ent->sublines);
+		buffer->xtext->adj->value -= ent->lines;
+		buffer->xtext->select_start_adj -= ent->lines;
 	}
 
 	if (gtk_xtext_kill_ent (buffer, ent))
@@ -3988,12 +4351,15 @@ gtk_xtext_remove_bottom (xtext_buffer *buffer)
 	ent = buffer->text_last;
 	if (!ent)
 		return;
-	buffer->num_lines -= g_slist_length (ent->sublines);
+	buffer->num_lines -= ent->lines;
 	buffer->text_last = ent->prev;
 	if (buffer->text_last)
 		buffer->text_last->next = NULL;
 	else
 		buffer->text_first = NULL;
+	gtk_xtext_index_pop (buffer, FALSE);
+	/* sequence numbers get reused from here, start the index over */
+	gtk_xtext_search_index_free (buffer);
 
 	if (gtk_xtext_kill_ent (buffer, ent))
 	{
@@ -4066,10 +4432,13 @@ gtk_xtext_clear (xtext_buffer *buf, int lines)
 		while (buf->text_first)
 		{
 			next = buf->text_first->next;
-			g_free (buf->text_first);
+			gtk_xtext_ent_free (buf, buf->text_first);
 			buf->text_first = next;
 		}
 		buf->text_last = NULL;
+		buf->pending_ents = 0;
+		gtk_xtext_index_clear (buf);
+		gtk_xtext_search_index_free (buf);
 	}
 
 	if (buf->xtext->buffer == buf)
@@ -4101,28 +4470,18 @@ gtk_xtext_check_ent_visibility (GtkXText * xtext, textentry *find_ent, int add)
 	height = gdk_window_get_height (gtk_widget_get_window (GTK_WIDGET (xtext)));
 
 	ent = buf->pagetop_ent;
+	if (ent == NULL || gtk_xtext_line_of (buf, find_ent) < gtk_xtext_line_of (buf, ent))
+	{
+		return FALSE;
+	}
 	/* If top line not completely displayed return FALSE */
 	if (ent == find_ent && buf->pagetop_subline > 0)
 	{
 		return FALSE;
 	}
-	/* Loop through line positions looking for find_ent */
+	/* find_ent must end before the last line that fits */
 	lines = ((height + xtext->pixel_offset) / xtext->fontsize) + buf->pagetop_subline + add;
-	while (ent)	
-	{
-		lines -= g_slist_length (ent->sublines);
-		if (lines <= 0)
-		{
-			return FALSE;
-		}
-		if (ent == find_ent)
-		{
-			return TRUE;
-		}
-		ent = ent->next;
-	}
-
-	return FALSE;
+	return gtk_xtext_ent_line (buf, find_ent) + find_ent->lines - gtk_xtext_ent_line (buf, ent) < lines;
 }
 
 void
@@ -4246,6 +4605,217 @@ gtk_xtext_search_textentry (xtext_buffer *buf, textentry *ent)
 	return gl;
 }
 
+/* The search index maps every trigram of the casefolded text of a
+   buffer to the sorted sequence numbers of the entries containing it.
+   It's built the first time a buffer is searched and then kept up to
+   date, so a plain-text search only has to look at entries that have
+   all the trigrams of the needle. Entries trimmed off the top leave
+   their numbers behind, these are swept out now and then. */
+
+#define TRIGRAM(s) (((guint) (guchar) (s)[0] << 16) | ((guint) (guchar) (s)[1] << 8) | (guchar) (s)[2])
+
+static gchar *
+gtk_xtext_search_index_text (xtext_buffer *buf, textentry *ent)
+{
+	gchar *str;
+	gint lstr;
+
+	str = gtk_xtext_strip_color (ent->str, ent->str_len, buf->xtext->scratch_buffer,
+										  &lstr, NULL, !buf->xtext->ignore_hidden);
+	return g_utf8_casefold (str, lstr);
+}
+
+/* position of the first sequence number >= 'seq' in 'seqs' */
+static guint
+gtk_xtext_search_index_find (GArray *seqs, int seq)
+{
+	guint low = 0, high = seqs->len, mid;
+
+	while (low < high)
+	{
+		mid = (low + high) / 2;
+		if (g_array_index (seqs, int, mid) < seq)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return low;
+}
+
+static void
+gtk_xtext_search_index_add (xtext_buffer *buf, textentry *ent, int seq, gboolean front)
+{
+	GArray *seqs;
+	gchar *text;
+	guint key, dead;
+	int i, len;
+
+	text = gtk_xtext_search_index_text (buf, ent);
+	len = strlen (text);
+
+	for (i = 0; i + 3 <= len; i++)
+	{
+		key = TRIGRAM (text + i);
+		seqs = g_hash_table_lookup (buf->search_index, GUINT_TO_POINTER (key));
+		if (seqs == NULL)
+		{
+			seqs = g_array_new (FALSE, FALSE, sizeof (int));
+			g_hash_table_insert (buf->search_index, GUINT_TO_POINTER (key), seqs);
+		}
+
+		if (front)
+		{
+			/* anything below 'seq' is gone, keep the array sorted */
+			dead = gtk_xtext_search_index_find (seqs, seq);
+			if (dead)
+				g_array_remove_range (seqs, 0, dead);
+			if (seqs->len == 0 || g_array_index (seqs, int, 0) != seq)
+				g_array_prepend_val (seqs, seq);
+		}
+		else if (seqs->len == 0 || g_array_index (seqs, int, seqs->len - 1) != seq)
+		{
+			g_array_append_val (seqs, seq);
+		}
+	}
+
+	g_free (text);
+}
+
+static void
+gtk_xtext_search_index_free (xtext_buffer *buf)
+{
+	if (buf->search_index)
+	{
+		g_hash_table_destroy (buf->search_index);
+		buf->search_index = NULL;
+	}
+}
+
+static void
+gtk_xtext_search_index_build (xtext_buffer *buf)
+{
+	textentry *ent;
+	int seq;
+
+	gtk_xtext_search_index_free (buf);
+	buf->search_index = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+															 NULL, (GDestroyNotify) g_array_unref);
+	buf->search_index_hidden = buf->xtext->ignore_hidden;
+	buf->search_index_swept = buf->ent_base;
+
+	for (ent = buf->text_first, seq = buf->ent_base; ent; ent = ent->next, seq++)
+		gtk_xtext_search_index_add (buf, ent, seq, FALSE);
+}
+
+/* drop the numbers of trimmed entries once there are about as many of
+   them as there are entries */
+static void
+gtk_xtext_search_index_sweep (xtext_buffer *buf)
+{
+	GHashTableIter iter;
+	gpointer value;
+	GArray *seqs;
+	textentry *ent;
+	guint dead;
+	int seq;
+
+	if (buf->ent_base - buf->search_index_swept < MAX (buf->ent_count, 1024))
+		return;
+
+	/* keep the numbers from overflowing in long-lived buffers */
+	if (buf->ent_base > G_MAXINT / 2)
+	{
+		gtk_xtext_search_index_free (buf);
+		gtk_xtext_renumber (buf);	/* line_shift goes by sequence number */
+		for (ent = buf->text_first, seq = 0; ent; ent = ent->next, seq++)
+			ent->seq = seq;
+		buf->ent_base = 0;
+		return;
+	}
+
+	g_hash_table_iter_init (&iter, buf->search_index);
+	while (g_hash_table_iter_next (&iter, NULL, &value))
+	{
+		seqs = value;
+		dead = gtk_xtext_search_index_find (seqs, buf->ent_base);
+		if (dead == seqs->len)
+			g_hash_table_iter_remove (&iter);
+		else if (dead)
+			g_array_remove_range (seqs, 0, dead);
+	}
+	buf->search_index_swept = buf->ent_base;
+}
+
+/* Entries of 'area' that might match the plain-text search set up in
+   'buf', in buffer order. Returns NULL if the index can't help, and
+   every entry has to be looked at. */
+static GPtrArray *
+gtk_xtext_search_candidates (xtext_buffer *buf, xtext_buffer *area)
+{
+	GPtrArray *found;
+	GArray *seqs, *shortest;
+	GArray **lists;
+	gchar *needle;
+	guint i, pos;
+	int j, len, nlists, seq;
+
+	if ((buf->search_flags & regexp) || buf->search_nee == NULL)
+		return NULL;
+	/* the index only matches what gtk_xtext_search_textentry sees */
+	if (buf->xtext->ignore_hidden != area->xtext->ignore_hidden)
+		return NULL;
+
+	/* the index is casefolded, the needle already is unless case matters */
+	if (buf->search_flags & case_match)
+		needle = g_utf8_casefold (buf->search_nee, buf->search_lnee);
+	else
+		needle = g_strdup (buf->search_nee);
+	len = strlen (needle);
+	if (len < 3)
+	{
+		g_free (needle);
+		return NULL;
+	}
+
+	if (area->search_index == NULL || area->search_index_hidden != area->xtext->ignore_hidden)
+		gtk_xtext_search_index_build (area);
+
+	found = g_ptr_array_new ();
+	lists = g_new (GArray *, len - 2);
+	shortest = NULL;
+	nlists = 0;
+	for (j = 0; j + 3 <= len; j++)
+	{
+		seqs = g_hash_table_lookup (area->search_index, GUINT_TO_POINTER (TRIGRAM (needle + j)));
+		if (seqs == NULL)
+			goto done;		/* no entry has this trigram */
+		if (shortest == NULL || seqs->len < shortest->len)
+			shortest = seqs;
+		lists[nlists++] = seqs;
+	}
+
+	for (i = gtk_xtext_search_index_find (shortest, area->ent_base); i < shortest->len; i++)
+	{
+		seq = g_array_index (shortest, int, i);
+		if (seq >= area->ent_base + area->ent_count)
+			break;
+
+		for (j = 0; j < nlists; j++)
+		{
+			pos = gtk_xtext_search_index_find (lists[j], seq);
+			if (pos == lists[j]->len || g_array_index (lists[j], int, pos) != seq)
+				break;
+		}
+		if (j == nlists)
+			g_ptr_array_add (found, XTEXT_INDEX (area, seq - area->ent_base));
+	}
+
+done:
+	g_free (lists);
+	g_free (needle);
+	return found;
+}
+
 /* Add a list of found search results to an entry, maybe NULL */
 static void
 gtk_xtext_search_textentry_add (xtext_buffer *buf, textentry *ent, GList *gl, gboolean pre)
@@ -4367,7 +4937,9 @@ gtk_xtext_search (GtkXText * xtext, const gchar *text, gtk_xtext_search_flags fl
 {
 	textentry *ent = NULL;
 	xtext_buffer *buf = xtext->buffer;
+	GPtrArray *cands;
 	GList *gl;
+	guint i;
 
 	if (buf->text_first == NULL)
 	{
@@ -4412,12 +4984,25 @@ gtk_xtext_search (GtkXText * xtext, const gchar *text, gtk_xtext_search_flags fl
 			{
 				return NULL;
 			}
-			for (ent = buf->text_first; ent; ent = ent->next)
+			cands = gtk_xtext_search_candidates (buf, buf);
+			if (cands)
 			{
-				GList *gl;
-
-				gl = gtk_xtext_search_textentry (buf, ent);
-				gtk_xtext_search_textentry_add (buf, ent, gl, TRUE);
+				for (i = 0; i < cands->len; i++)
+				{
+					ent = g_ptr_array_index (cands, i);
+					gl = gtk_xtext_search_textentry (buf, ent);
+					gtk_xtext_search_textentry_add (buf, ent, gl, TRUE);
+				}
+				g_ptr_array_free (cands, TRUE);
+				ent = NULL;
+			}
+			else
+			{
+				for (ent = buf->text_first; ent; ent = ent->next)
+				{
+					gl = gtk_xtext_search_textentry (buf, ent);
+					gtk_xtext_search_textentry_add (buf, ent, gl, TRUE);
+				}
 			}
 			buf->search_found = g_list_reverse (buf->search_found);
 		}
@@ -4494,18 +5079,14 @@ gtk_xtext_search (GtkXText * xtext, const gchar *text, gtk_xtext_search_flags fl
 		float value;
 
 		buf->pagetop_ent = NULL;
-		for (value = 0, ent = buf->text_first;
-			  ent && ent != buf->hintsearch; ent = ent->next)
-		{
-			value += g_slist_length (ent->sublines);
-		}
+		value = ent? gtk_xtext_ent_line (buf, ent): buf->num_lines;
 		if (value > adj->upper - adj->page_size)
 		{
 			value = adj->upper - adj->page_size;
 		}
 		else if ((flags & backward)  && ent)
 		{
-			value -= adj->page_size - g_slist_length (ent->sublines);
+			value -= adj->page_size - ent->lines;
 			if (value < 0)
 			{
 				value = 0;
@@ -4556,10 +5137,61 @@ gtk_xtext_render_page_timeout (GtkXText * xtext)
 	return 0;
 }
 
-/* append a textentry to our linked list */
+/* room for a textentry followed by 'len' bytes of text */
+
+static textentry *
+gtk_xtext_ent_alloc (xtext_buffer *buf, int len)
+{
+	xtext_chunk *chunk = buf->chunk;
+	textentry *ent;
+	int size, chunk_size;
+
+	size = XTEXT_ALIGN (sizeof (textentry) + len);
+	if (chunk == NULL || chunk->used + size > chunk->size)
+	{
+		/* the old chunk goes when its last entry does */
+		if (chunk && chunk->live == 0)
+			g_free (chunk);
+
+		chunk_size = MAX (XTEXT_CHUNK_SIZE, XTEXT_ALIGN (sizeof (xtext_chunk)) + size);
+		chunk = g_malloc (chunk_size);
+		chunk->size = chunk_size;
+		chunk->used = XTEXT_ALIGN (sizeof (xtext_chunk));
+		chunk->live = 0;
+		buf->chunk = chunk;
+	}
+
+	ent = (textentry *) ((char *) chunk + chunk->used);
+	chunk->used += size;
+	chunk->live++;
+
+	ent->chunk = chunk;
+	ent->str = (unsigned char *) ent + sizeof (textentry);
+	ent->slp = NULL;
+	ent->sublines = ent->subline_buf;
+	ent->pending = 0;
+	return ent;
+}
 
 static void
-gtk_xtext_append_entry (xtext_buffer *buf, textentry * ent, time_t stamp)
+gtk_xtext_ent_free (xtext_buffer *buf, textentry *ent)
+{
+	xtext_chunk *chunk = ent->chunk;
+
+	g_slist_free_full (ent->slp, g_free);
+	gtk_xtext_sublines_free (ent);
+
+	if (--chunk->live == 0)
+	{
+		if (chunk == buf->chunk)
+			chunk->used = XTEXT_ALIGN (sizeof (xtext_chunk));	/* start over */
+		else
+			g_free (chunk);
+	}
+}
+
+static void
+gtk_xtext_init_entry (xtext_buffer *buf, textentry *ent, time_t stamp)
 {
 	int i;
 
@@ -4576,14 +5208,53 @@ gtk_xtext_append_entry (xtext_buffer *buf, textentry * ent, time_t stamp)
 	if (stamp == 0)
 		ent->stamp = time (0);
 	ent->slp = NULL;
-	ent->str_width = gtk_xtext_text_width_ent (buf->xtext, ent);
+	ent->pending = 0;
+	if (buf->xtext->buffer == buf)
+	{
+		ent->str_width = gtk_xtext_text_width_ent (buf->xtext, ent);
+	}
+	else
+	{
+		/* measured when first drawn */
+		ent->str_width = 0;
+		ent->pending = XTEXT_UNMEASURED;
+		buf->pending_ents++;
+	}
 	ent->mark_start = -1;
 	ent->mark_end = -1;
 	ent->next = NULL;
+	ent->prev = NULL;
 	ent->marks = NULL;
+	ent->sublines = ent->subline_buf;
 
 	if (ent->indent < MARGIN)
 		ent->indent = MARGIN;	  /* 2 pixels is the left margin */
+}
+
+static void
+gtk_xtext_queue_render (xtext_buffer *buf)
+{
+	if (!buf->xtext->add_io_tag)
+	{
+		/* remove scrolling events */
+		if (buf->xtext->io_tag)
+		{
+			g_source_remove (buf->xtext->io_tag);
+			buf->xtext->io_tag = 0;
+		}
+		buf->xtext->add_io_tag = g_timeout_add (REFRESH_TIMEOUT * 2,
+														(GSourceFunc)
+														gtk_xtext_render_page_timeout,
+														buf->xtext);
+	}
+}
+
+/* append a textentry to our linked list */
+
+static void
+gtk_xtext_append_entry (xtext_buffer *buf, textentry * ent, time_t stamp)
+{
+	gtk_xtext_init_entry (buf, ent, stamp);
 
 	/* append to our linked list */
 	if (buf->text_last)
@@ -4592,9 +5263,14 @@ gtk_xtext_append_entry (xtext_buffer *buf, textentry * ent, time_t stamp)
 		buf->text_first = ent;
 	ent->prev = buf->text_last;
 	buf->text_last = ent;
+	gtk_xtext_index_push (buf, ent, FALSE);
+	if (buf->search_index)
+		gtk_xtext_search_index_add (buf, ent, buf->ent_base + buf->ent_count - 1, FALSE);
 
-	ent->sublines = NULL;
-	buf->num_lines += gtk_xtext_lines_taken (buf, ent);
+	buf->num_lines += gtk_xtext_wrap_ent (buf, ent);
+	gtk_xtext_set_line (buf, ent, ent->prev ? gtk_xtext_line_of (buf, ent->prev) + ent->prev->lines : 0);
+	if (ent->line > G_MAXINT / 2)
+		gtk_xtext_renumber (buf);
 
 	if ((buf->marker_pos == NULL || buf->marker_seen) && (buf->xtext->buffer != buf || 
 		!gtk_window_has_toplevel_focus (GTK_WINDOW (gtk_widget_get_toplevel (GTK_WIDGET (buf->xtext))))))
@@ -4616,19 +5292,7 @@ gtk_xtext_append_entry (xtext_buffer *buf, textentry * ent, time_t stamp)
 		if ((buf->num_lines - 1) <= buf->xtext->adj->page_size)
 			dontscroll (buf);
 
-		if (!buf->xtext->add_io_tag)
-		{
-			/* remove scrolling events */
-			if (buf->xtext->io_tag)
-			{
-				g_source_remove (buf->xtext->io_tag);
-				buf->xtext->io_tag = 0;
-			}
-			buf->xtext->add_io_tag = g_timeout_add (REFRESH_TIMEOUT * 2,
-															(GSourceFunc)
-															gtk_xtext_render_page_timeout,
-															buf->xtext);
-		}
+		gtk_xtext_queue_render (buf);
 	}
 	if (buf->scrollbar_down)
 	{
@@ -4645,13 +5309,58 @@ gtk_xtext_append_entry (xtext_buffer *buf, textentry * ent, time_t stamp)
 	}
 }
 
-/* the main two public functions */
+/* put a textentry above everything else, for older lines paged in from
+   the scrollback. The view keeps showing what it showed before. */
 
-void
-gtk_xtext_append_indent (xtext_buffer *buf,
-								 unsigned char *left_text, int left_len,
-								 unsigned char *right_text, int right_len,
-								 time_t stamp)
+static gboolean
+gtk_xtext_prepend_entry (xtext_buffer *buf, textentry * ent, time_t stamp)
+{
+	int lines;
+
+	/* older lines never push out newer ones */
+	if (buf->xtext->max_lines > 2 && buf->num_lines >= buf->xtext->max_lines)
+	{
+		gtk_xtext_ent_free (buf, ent);
+		return FALSE;
+	}
+
+	gtk_xtext_init_entry (buf, ent, stamp);
+
+	ent->next = buf->text_first;
+	if (buf->text_first)
+		buf->text_first->prev = ent;
+	else
+		buf->text_last = ent;
+	buf->text_first = ent;
+	gtk_xtext_index_push (buf, ent, TRUE);
+	if (buf->search_index)
+		gtk_xtext_search_index_add (buf, ent, buf->ent_base, TRUE);
+
+	lines = gtk_xtext_wrap_ent (buf, ent);
+	gtk_xtext_set_line (buf, ent, ent->next ? gtk_xtext_line_of (buf, ent->next) - lines : 0);
+	if (ent->line < G_MININT / 2)
+		gtk_xtext_renumber (buf);
+	buf->num_lines += lines;
+	buf->pagetop_line += lines;
+	if (buf->old_value >= 0)		/* -1 until first shown */
+		buf->old_value += lines;
+	dontscroll (buf);
+
+	if (buf->xtext->buffer == buf)	/* is it the current buffer? */
+	{
+		buf->xtext->adj->value += lines;
+		buf->xtext->select_start_adj += lines;
+		buf->xtext->force_render = TRUE;
+		gtk_xtext_queue_render (buf);
+	}
+
+	return TRUE;
+}
+
+static textentry *
+gtk_xtext_new_indent_entry (xtext_buffer *buf,
+									 unsigned char *left_text, int left_len,
+									 unsigned char *right_text, int right_len)
 {
 	textentry *ent;
 	unsigned char *str;
@@ -4671,8 +5380,8 @@ gtk_xtext_append_indent (xtext_buffer *buf,
 	if (right_text[right_len-1] == '\n')
 		right_len--;
 
-	ent = g_malloc (left_len + right_len + 2 + sizeof (textentry));
-	str = (unsigned char *) ent + sizeof (textentry);
+	ent = gtk_xtext_ent_alloc (buf, left_len + right_len + 2);
+	str = ent->str;
 
 	if (left_len)
 		memcpy (str, left_text, left_len);
@@ -4716,11 +5425,11 @@ gtk_xtext_append_indent (xtext_buffer *buf,
 		buf->xtext->force_render = TRUE;
 	}
 
-	gtk_xtext_append_entry (buf, ent, stamp);
+	return ent;
 }
 
-void
-gtk_xtext_append (xtext_buffer *buf, unsigned char *text, int len, time_t stamp)
+static textentry *
+gtk_xtext_new_entry (xtext_buffer *buf, unsigned char *text, int len)
 {
 	textentry *ent;
 	gboolean truncate = FALSE;
@@ -4737,8 +5446,7 @@ gtk_xtext_append (xtext_buffer *buf, unsigned char *text, int len, time_t stamp)
 		truncate = TRUE;
 	}
 
-	ent = g_malloc (len + 1 + sizeof (textentry));
-	ent->str = (unsigned char *) ent + sizeof (textentry);
+	ent = gtk_xtext_ent_alloc (buf, len + 1);
 	ent->str_len = len;
 	if (len)
 	{
@@ -4756,7 +5464,43 @@ gtk_xtext_append (xtext_buffer *buf, unsigned char *text, int len, time_t stamp)
 	ent->indent = 0;
 	ent->left_len = -1;
 
-	gtk_xtext_append_entry (buf, ent, stamp);
+	return ent;
+}
+
+/* the main two public functions */
+
+void
+gtk_xtext_append_indent (xtext_buffer *buf,
+								 unsigned char *left_text, int left_len,
+								 unsigned char *right_text, int right_len,
+								 time_t stamp)
+{
+	gtk_xtext_append_entry (buf, gtk_xtext_new_indent_entry (buf, left_text, left_len,
+																				right_text, right_len), stamp);
+}
+
+void
+gtk_xtext_append (xtext_buffer *buf, unsigned char *text, int len, time_t stamp)
+{
+	gtk_xtext_append_entry (buf, gtk_xtext_new_entry (buf, text, len), stamp);
+}
+
+/* same as above, but at the top. FALSE if the buffer is already full */
+
+gboolean
+gtk_xtext_prepend_indent (xtext_buffer *buf,
+								  unsigned char *left_text, int left_len,
+								  unsigned char *right_text, int right_len,
+								  time_t stamp)
+{
+	return gtk_xtext_prepend_entry (buf, gtk_xtext_new_indent_entry (buf, left_text, left_len,
+																						  right_text, right_len), stamp);
+}
+
+gboolean
+gtk_xtext_prepend (xtext_buffer *buf, unsigned char *text, int len, time_t stamp)
+{
+	return gtk_xtext_prepend_entry (buf, gtk_xtext_new_entry (buf, text, len), stamp);
 }
 
 gboolean
@@ -4766,41 +5510,58 @@ gtk_xtext_is_empty (xtext_buffer *buf)
 }
 
 
+/* copy 'ent' to 'out' if it matches the search set up there */
+
+static gboolean
+gtk_xtext_lastlog_ent (xtext_buffer *out, xtext_buffer *search_area, textentry *ent)
+{
+	GList *gl;
+
+	gl = gtk_xtext_search_textentry (out, ent);
+	if (gl == NULL)
+		return FALSE;
+
+	/* copy the text over */
+	if (search_area->xtext->auto_indent)
+	{
+		gtk_xtext_append_indent (out, ent->str, ent->left_len,
+										 ent->str + ent->left_len + 1,
+										 ent->str_len - ent->left_len - 1, 0);
+	}
+	else
+	{
+		gtk_xtext_append (out, ent->str, ent->str_len, 0);
+	}
+
+	if (out->text_last)
+	{
+		out->text_last->stamp = ent->stamp;
+		gtk_xtext_search_textentry_add (out, out->text_last, gl, TRUE);
+	}
+	return TRUE;
+}
+
 int
 gtk_xtext_lastlog (xtext_buffer *out, xtext_buffer *search_area)
 {
 	textentry *ent;
+	GPtrArray *cands;
 	int matches;
-	GList *gl;
+	guint i;
 
-	ent = search_area->text_first;
 	matches = 0;
 
-	while (ent)
+	cands = gtk_xtext_search_candidates (out, search_area);
+	if (cands)
 	{
-		gl = gtk_xtext_search_textentry (out, ent);
-		if (gl)
-		{
-			matches++;
-			/* copy the text over */
-			if (search_area->xtext->auto_indent)
-			{
-				gtk_xtext_append_indent (out, ent->str, ent->left_len,
-												 ent->str + ent->left_len + 1,
-												 ent->str_len - ent->left_len - 1, 0);
-			}
-			else
-			{
-				gtk_xtext_append (out, ent->str, ent->str_len, 0);
-			}
-
-			if (out->text_last)
-			{
-				out->text_last->stamp = ent->stamp;
-				gtk_xtext_search_textentry_add (out, out->text_last, gl, TRUE);
-			}
-		}
-		ent = ent->next;
+		for (i = 0; i < cands->len; i++)
+			matches += gtk_xtext_lastlog_ent (out, search_area, g_ptr_array_index (cands, i));
+		g_ptr_array_free (cands, TRUE);
+	}
+	else
+	{
+		for (ent = search_area->text_first; ent; ent = ent->next)
+			matches += gtk_xtext_lastlog_ent (out, search_area, ent);
 	}
 	out->search_found = g_list_reverse (out->search_found);
 
@@ -4897,9 +5658,8 @@ gtk_xtext_reset_marker_pos (GtkXText *xtext)
 int
 gtk_xtext_moveto_marker_pos (GtkXText *xtext)
 {
-	gdouble value = 0;
+	gdouble value;
 	xtext_buffer *buf = xtext->buffer;
-	textentry *ent = buf->text_first;
 	GtkAdjustment *adj = xtext->adj;
 
 	if (buf->marker_pos == NULL)
@@ -4907,13 +5667,7 @@ gtk_xtext_moveto_marker_pos (GtkXText *xtext)
 
 	if (gtk_xtext_check_ent_visibility (xtext, buf->marker_pos, 1) == FALSE)
 	{
-		while (ent)
-		{
-			if (ent == buf->marker_pos)
-				break;
-			value += g_slist_length (ent->sublines);
-			ent = ent->next;
-		}
+		value = gtk_xtext_ent_line (buf, buf->marker_pos);
 		if (value >= adj->value && value < adj->value + adj->page_size)
 			return MARKER_IS_SET;
 		value -= adj->page_size / 2;
@@ -4937,6 +5691,7 @@ void
 gtk_xtext_buffer_show (GtkXText *xtext, xtext_buffer *buf, int render)
 {
 	int w, h;
+	gboolean resized;
 
 	buf->xtext = xtext;
 
@@ -4970,6 +5725,17 @@ gtk_xtext_buffer_show (GtkXText *xtext, xtext_buffer *buf, int render)
 		gtk_xtext_recalc_widths (buf, TRUE);
 	}
 
+	/* did the window change size since this buffer was last shown? Done
+	   before switching so only estimates are made; the page that gets
+	   drawn is wrapped by gtk_xtext_render_page. */
+	resized = render && buf->window_width != w;
+	if (resized)
+	{
+		buf->window_width = w;
+		buf->window_height = h;
+		gtk_xtext_calc_lines (buf, FALSE);
+	}
+
 	/* now change to the new buffer */
 	xtext->buffer = buf;
 	dontscroll (buf);	/* force scrolling off */
@@ -4997,12 +5763,9 @@ gtk_xtext_buffer_show (GtkXText *xtext, xtext_buffer *buf, int render)
 
 	if (render)
 	{
-		/* did the window change size since this buffer was last shown? */
-		if (buf->window_width != w)
+		if (resized)
 		{
-			buf->window_width = w;
-			buf->window_height = h;
-			gtk_xtext_calc_lines (buf, FALSE);
+			gtk_xtext_adjustment_set (buf, FALSE);
 			if (buf->scrollbar_down)
 				gtk_adjustment_set_value (xtext->adj, xtext->adj->upper -
 												  xtext->adj->page_size);
@@ -5055,9 +5818,12 @@ gtk_xtext_buffer_free (xtext_buffer *buf)
 	while (ent)
 	{
 		next = ent->next;
-		g_free (ent);
+		gtk_xtext_ent_free (buf, ent);
 		ent = next;
 	}
+	g_free (buf->chunk);
+	g_free (buf->ent_index);
+	gtk_xtext_search_index_free (buf);
 
 	g_free (buf);
 }
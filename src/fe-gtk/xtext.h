@@ -84,6 +84,13 @@ typedef struct {
 	textentry *text_first;
 	textentry *text_last;
 
+	struct xtext_chunk *chunk;	/* where new entries are allocated */
+	textentry **ent_index;		/* ring of all entries, in list order */
+	int ent_index_size;			/* slots allocated, a power of two */
+	int ent_index_head;			/* slot holding text_first */
+	int ent_count;
+	int ent_base;					/* sequence number of text_first */
+
 	textentry *last_ent_start;	  /* this basically describes the last rendered */
 	textentry *last_ent_end;	  /* selection. */
 	int last_offset_start;
@@ -96,6 +103,9 @@ typedef struct {
 	textentry *pagetop_ent;			/* what's at xtext->adj->value */
 
 	int num_lines;
+	int pending_ents;				/* entries not wrapped yet, see gtk_xtext_settle_page */
+	int line_shift;				/* still to be added to ent->line ... */
+	int line_shift_seq;			/* ... of entries from this sequence number on */
 	int indent;						  /* position of separator (pixels) from left */
 
 	textentry *marker_pos;
@@ -119,6 +129,9 @@ typedef struct {
 	offsets_t curdata;		/* current offset info, from *curmark */
 	GRegex *search_re;		/* Compiled regular expression */
 	textentry *hintsearch;	/* textentry found for last search */
+	GHashTable *search_index;	/* trigram -> entry sequence numbers */
+	int search_index_swept;	/* ent_base when last swept */
+	unsigned int search_index_hidden:1;	/* ignore_hidden it was built with */
 } xtext_buffer;
 
 struct _GtkXText
@@ -175,8 +188,6 @@ struct _GtkXText
 	int hilight_start;
 	int hilight_end;
 
-	guint16 fontwidth[128];	  /* each char's width, only the ASCII ones */
-
 	struct pangofont
 	{
 		PangoFontDescription *font;
@@ -258,6 +269,11 @@ void gtk_xtext_append_indent (xtext_buffer *buf,
 										unsigned char *left_text, int left_len,
 										unsigned char *right_text, int right_len,
 										time_t stamp);
+gboolean gtk_xtext_prepend (xtext_buffer *buf, unsigned char *text, int len, time_t stamp);
+gboolean gtk_xtext_prepend_indent (xtext_buffer *buf,
+											  unsigned char *left_text, int left_len,
+											  unsigned char *right_text, int right_len,
+											  time_t stamp);
 int gtk_xtext_set_font (GtkXText *xtext, char *name);
 void gtk_xtext_set_background (GtkXText * xtext, GdkPixmap * pixmap);
 void gtk_xtext_set_palette (GtkXText * xtext, GdkColor palette[]);
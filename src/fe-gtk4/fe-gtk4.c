@@ -4467,6 +4467,13 @@ fe_print_text (struct session *sess, char *text, time_t stamp,
 	}
 }
 
+gboolean
+fe_print_text_prepend (struct session *sess, char *text, time_t stamp)
+{
+	/* No scroll-back paging in this frontend yet */
+	return FALSE;
+}
+
 void
 fe_text_clear (struct session *sess, int lines)
 {
@@ -5026,6 +5033,51 @@ fe_userlist_insert (struct session *sess, struct User *newuser, gboolean sel)
 	g_object_unref (item);
 }
 
+/* the core's nick list order, for sorting the batch by access first */
+static gint
+user_access_cmp (gconstpointer a, gconstpointer b, gpointer serv)
+{
+	return nick_cmp_az_ops (serv, *(struct User **)a, *(struct User **)b);
+}
+
+void
+fe_userlist_insert_many (struct session *sess, struct User **users, int count)
+{
+	session_gui *gui;
+	GPtrArray *items, *sorted;
+	int i;
+
+	if (!sess || !sess->gui || !users)
+		return;
+
+	gui = sess->gui;
+
+	if (!gui->userlist_store)
+		return;
+
+	/* Only an empty store can take the whole batch in one splice */
+	if (g_list_model_get_n_items (G_LIST_MODEL (gui->userlist_store)) > 0)
+	{
+		for (i = 0; i < count; i++)
+			fe_userlist_insert (sess, users[i], FALSE);
+		return;
+	}
+
+	/* the core hands them over sorted by nick alone */
+	sorted = g_ptr_array_sized_new (count);
+	for (i = 0; i < count; i++)
+		g_ptr_array_add (sorted, users[i]);
+	g_ptr_array_sort_with_data (sorted, user_access_cmp, sess->server);
+
+	items = g_ptr_array_new_full (count, g_object_unref);
+	for (i = 0; i < count; i++)
+		g_ptr_array_add (items, user_item_new (g_ptr_array_index (sorted, i)));
+	g_ptr_array_free (sorted, TRUE);
+
+	g_list_store_splice (gui->userlist_store, 0, 0, items->pdata, items->len);
+	g_ptr_array_unref (items);
+}
+
 int
 fe_userlist_remove (struct session *sess, struct User *user)
 {
@@ -5836,6 +5888,15 @@ fe_url_add (const char *text)
 	/* TODO: Add URL to URL grabber */
 }
 
+void
+fe_url_add_list (char **urls, int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+		fe_url_add (urls[i]);
+}
+
 char *
 fe_menu_add (menu_entry *me)
 {
@@ -36,6 +36,9 @@
 #include "../common/util.h"
 #include "../common/fe.h"
 #include "fe-text.h"
+#ifdef HEXCHAT_BENCH
+#include "replay.h"
+#endif
 
 
 static int done = FALSE;		  /* finished ? */
@@ -378,6 +381,9 @@ fe_args (int argc, char *argv[])
 
 	context = g_option_context_new (NULL);
 	g_option_context_add_main_entries (context, gopt_entries, GETTEXT_PACKAGE);
+#ifdef HEXCHAT_BENCH
+	g_option_context_add_main_entries (context, replay_entries, NULL);
+#endif
 	g_option_context_parse (context, &argc, &argv, &error);
 
 	if (error)
@@ -421,7 +427,11 @@ fe_args (int argc, char *argv[])
 		g_free (arg_cfgdir);
 	}
 
+#ifdef HEXCHAT_BENCH
+	return replay_args ();
+#else
 	return -1;
+#endif
 }
 
 void
@@ -442,6 +452,11 @@ fe_main (void)
 
 	main_loop = g_main_loop_new(NULL, FALSE);
 
+#ifdef HEXCHAT_BENCH
+	replay_main ();
+	return;
+#endif
+
 	/* Keyboard Entry Setup */
 	keyboard_input = g_io_channel_unix_new(STDIN_FILENO);
 
@@ -555,10 +570,19 @@ void
 fe_progressbar_end (struct server *serv)
 {
 }
+gboolean
+fe_print_text_prepend (struct session *sess, char *text, time_t stamp)
+{
+	return FALSE;
+}
 void
 fe_userlist_insert (struct session *sess, struct User *newuser, gboolean sel)
 {
 }
+void
+fe_userlist_insert_many (struct session *sess, struct User **users, int count)
+{
+}
 int
 fe_userlist_remove (struct session *sess, struct User *user)
 {
@@ -609,6 +633,10 @@ fe_url_add (const char *text)
 {
 }
 void
+fe_url_add_list (char **urls, int count)
+{
+}
+void
 fe_pluginlist_update (void)
 {
 }
@@ -0,0 +1,480 @@
+/* HexChat
+ * Copyright (C) 1998-2010 Peter Zelezny.
+ * Copyright (C) 2009-2013 Berke Viktor.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/* The replay benchmark. A replay file holds raw lines as a server sends
+   them, one per line, e.g. recorded with the raw log. They're all read
+   into memory first and then fed to server_inline() one by one, as if
+   they had just arrived on a connected server, so nothing but HexChat's
+   own inbound path gets timed:
+
+     hexchat-bench -d /tmp/benchcfg --generate flood --lines 200000 > flood.irc
+     hexchat-bench -d /tmp/benchcfg --replay flood.irc > /dev/null
+
+   The report goes to stderr, the text the frontend would have shown to
+   stdout. */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#ifdef __GLIBC__
+#include <pthread.h>
+#endif
+
+#include "../common/hexchat.h"
+#include "../common/hexchatc.h"
+#include "../common/server.h"
+#include "../common/util.h"
+#include "../common/bench.h"
+#include "replay.h"
+
+static char *arg_replay = NULL;
+static char *arg_generate = NULL;
+static gint arg_lines = 100000;
+static gint arg_repeat = 1;
+static gint arg_logging = 0;
+
+const GOptionEntry replay_entries[] =
+{
+ {"replay",	'r', 0, G_OPTION_ARG_FILENAME,	&arg_replay, "Replay a file of raw lines received from a server", "FILE"},
+ {"repeat",	0, 0, G_OPTION_ARG_INT,	&arg_repeat, "Replay the file this many times", "N"},
+ {"logging",	0, 0, G_OPTION_ARG_NONE,	&arg_logging, "Log every window to disk while replaying", NULL},
+ {"generate",	'g', 0, G_OPTION_ARG_STRING,	&arg_generate, "Write synthetic traffic to stdout: flood, names or netsplit", "KIND"},
+ {"lines",	0, 0, G_OPTION_ARG_INT,	&arg_lines, "About how many lines to generate", "N"},
+ {NULL}
+};
+
+/* === counting allocations === */
+
+/* glibc lets us put our own malloc in front of its own. Only the main
+   thread is counted, the log writer and GResolver threads would just
+   muddle the per-stage numbers. */
+
+static volatile int count_allocs = FALSE;
+
+#ifdef __GLIBC__
+#define REPLAY_COUNT_ALLOCS
+
+extern void *__libc_malloc (size_t size);
+extern void *__libc_calloc (size_t nmemb, size_t size);
+extern void *__libc_realloc (void *ptr, size_t size);
+
+static pthread_t main_thread;
+
+static void
+replay_note_alloc (void)
+{
+	if (count_allocs && pthread_equal (pthread_self (), main_thread))
+		bench_count_alloc ();
+}
+
+void *
+malloc (size_t size)
+{
+	replay_note_alloc ();
+	return __libc_malloc (size);
+}
+
+void *
+calloc (size_t nmemb, size_t size)
+{
+	replay_note_alloc ();
+	return __libc_calloc (nmemb, size);
+}
+
+void *
+realloc (void *ptr, size_t size)
+{
+	replay_note_alloc ();
+	return __libc_realloc (ptr, size);
+}
+#endif
+
+/* === generators === */
+
+#define GEN_SERVER ":irc.bench.invalid"
+#define GEN_NICK "bench"
+#define GEN_CHANNEL_USERS 50
+
+static void
+gen_welcome (void)
+{
+	printf (GEN_SERVER " 001 " GEN_NICK " :Welcome to the Bench IRC Network " GEN_NICK "\n");
+	printf (GEN_SERVER " 005 " GEN_NICK " PREFIX=(ov)@+ CHANTYPES=# CHANMODES=b,k,l,imnpst "
+			  "CASEMAPPING=rfc1459 NICKLEN=30 NETWORK=Bench :are supported by this server\n");
+	printf (GEN_SERVER " 375 " GEN_NICK " :- irc.bench.invalid Message of the Day -\n");
+	printf (GEN_SERVER " 376 " GEN_NICK " :End of /MOTD command.\n");
+}
+
+static void
+gen_user (char *buf, int size, int i)
+{
+	g_snprintf (buf, size, "user%d!~u%d@host-%d.bench.invalid", i, i, i % 997);
+}
+
+/* join "chan" and name "users" users in it, returns the lines written */
+
+static int
+gen_join (const char *chan, int first, int users)
+{
+	GString *names = g_string_sized_new (512);
+	int i, lines = 2;
+
+	printf (":" GEN_NICK "!~bench@localhost JOIN %s\n", chan);
+	printf (GEN_SERVER " 332 " GEN_NICK " %s :Benchmark channel, see https://hexchat.github.io/\n", chan);
+
+	for (i = 0; i < users; i++)
+	{
+		if (names->len == 0)
+			g_string_printf (names, GEN_SERVER " 353 " GEN_NICK " = %s :", chan);
+		else
+			g_string_append_c (names, ' ');
+
+		if (i % 10 == 0)
+			g_string_append_c (names, '@');
+		else if (i % 5 == 0)
+			g_string_append_c (names, '+');
+		g_string_append_printf (names, "user%d", first + i);
+
+		if (names->len > 400 || i == users - 1)
+		{
+			printf ("%s\n", names->str);
+			g_string_truncate (names, 0);
+			lines++;
+		}
+	}
+
+	printf (GEN_SERVER " 366 " GEN_NICK " %s :End of /NAMES list.\n", chan);
+	g_string_free (names, TRUE);
+	return lines + 1;
+}
+
+static void
+gen_flood (int lines)
+{
+	static const char * const texts[] =
+	{
+		"hello everyone",
+		"has anyone tried the new build yet? it crashes on startup for me",
+		"\002bold\002 and \0034colored\003 and \037underlined\037 text",
+		"see https://example.invalid/some/long/path?with=query&and=more for the details",
+		"ok",
+		"I think " GEN_NICK " knows how that works",
+		"lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod tempor",
+	};
+	char user[128];
+	int i, n = 0;
+
+	n += gen_join ("#bench", 0, GEN_CHANNEL_USERS);
+
+	for (i = 0; n < lines; i++, n++)
+	{
+		gen_user (user, sizeof (user), i % GEN_CHANNEL_USERS);
+
+		if (i % 100 == 99)
+			printf (":%s PRIVMSG " GEN_NICK " :private message %d\n", user, i);
+		else if (i % 20 == 19)
+			printf (":%s PRIVMSG #bench :\001ACTION waves %d\001\n", user, i);
+		else
+			printf (":%s PRIVMSG #bench :%s\n", user, texts[i % G_N_ELEMENTS (texts)]);
+	}
+}
+
+static void
+gen_names (int lines)
+{
+	char chan[32];
+	int c, n = 0;
+
+	/* big channels, around 40 users fit in one 353 line */
+	for (c = 0; n < lines; c++)
+	{
+		g_snprintf (chan, sizeof (chan), "#names%d", c);
+		n += gen_join (chan, c * 10000, CLAMP ((lines - n) * 40, 1, 10000));
+	}
+}
+
+static void
+gen_netsplit (int lines)
+{
+	char user[128];
+	int users = MAX (GEN_CHANNEL_USERS, lines * 10 / 22);	/* a quit, a join and some modes each */
+	int i;
+
+	gen_join ("#bench", 0, users);
+
+	/* everyone on the other side of the split leaves... */
+	for (i = 1; i < users; i++)
+	{
+		gen_user (user, sizeof (user), i);
+		printf (":%s QUIT :*.bench.invalid split.bench.invalid\n", user);
+	}
+
+	/* ...and comes back in when it heals */
+	for (i = 1; i < users; i++)
+	{
+		gen_user (user, sizeof (user), i);
+		printf (":%s JOIN #bench\n", user);
+		if (i % 10 == 0)
+			printf (":split.bench.invalid MODE #bench +o user%d\n", i);
+		else if (i % 5 == 0)
+			printf (":split.bench.invalid MODE #bench +v user%d\n", i);
+	}
+}
+
+static int
+replay_generate (const char *kind, int lines)
+{
+	if (strcmp (kind, "flood") && strcmp (kind, "names") && strcmp (kind, "netsplit"))
+	{
+		fprintf (stderr, "Unknown traffic \"%s\", use flood, names or netsplit\n", kind);
+		return 1;
+	}
+
+	gen_welcome ();
+
+	if (!strcmp (kind, "flood"))
+		gen_flood (lines);
+	else if (!strcmp (kind, "names"))
+		gen_names (lines);
+	else
+		gen_netsplit (lines);
+
+	return 0;
+}
+
+/* === replaying === */
+
+struct replay_line
+{
+	char *text;
+	int len;
+};
+
+/* split the file into lines in place, the same way server_read does */
+
+static GArray *
+replay_split (char *data, gsize size)
+{
+	GArray *lines = g_array_new (FALSE, FALSE, sizeof (struct replay_line));
+	struct replay_line line;
+	char *end = data + size;
+	char *eol;
+
+	while (data < end)
+	{
+		eol = memchr (data, '\n', end - data);
+		if (!eol)
+			eol = end;
+		*eol = 0;
+
+		line.text = data;
+		line.len = eol - data;
+		if (line.len && data[line.len - 1] == '\r')
+			data[--line.len] = 0;
+		if (line.len)
+			g_array_append_val (lines, line);
+
+		data = eol + 1;
+	}
+
+	return lines;
+}
+
+/* make "serv" look connected. Whatever HexChat sends back goes into a
+   socketpair and is thrown away. */
+
+static int
+replay_connect (server *serv)
+{
+	int fds[2];
+
+	if (socketpair (AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+		return -1;
+	fcntl (fds[0], F_SETFL, O_NONBLOCK);
+	fcntl (fds[1], F_SETFL, O_NONBLOCK);
+
+	serv->sok = fds[0];
+	serv->connected = TRUE;
+	safe_strcpy (serv->hostname, "irc.bench.invalid", sizeof (serv->hostname));
+	safe_strcpy (serv->servername, "irc.bench.invalid", sizeof (serv->servername));
+
+	return fds[1];
+}
+
+static gint64 idle_ns;
+
+/* let the main loop run, and empty the socket. Left out of the results. */
+
+static void
+replay_idle (int peer)
+{
+	gint64 start = bench_now ();
+	gboolean enabled = bench_enabled;
+	int counting = count_allocs;
+	char buf[4096];
+
+	bench_enabled = FALSE;
+	count_allocs = FALSE;
+
+	while (read (peer, buf, sizeof (buf)) > 0)
+		;
+	while (g_main_context_iteration (NULL, FALSE))
+		;
+
+	bench_enabled = enabled;
+	count_allocs = counting;
+	idle_ns += bench_now () - start;
+}
+
+static void
+replay_report (guint64 lines, gint64 elapsed)
+{
+	gint64 staged = 0;
+	guint64 allocs = bench_other_allocs;
+	int i;
+
+	for (i = 0; i < BENCH_NUM_STAGES; i++)
+	{
+		staged += bench_stats[i].ns;
+		allocs += bench_stats[i].allocs;
+	}
+	if (elapsed < 1)
+		elapsed = 1;
+
+	fprintf (stderr, "\n%" G_GUINT64_FORMAT " lines in %.3f s, %.0f lines/sec\n\n",
+				lines, elapsed / 1e9, lines / (elapsed / 1e9));
+	fprintf (stderr, "%-12s %10s %7s %12s %10s %12s\n",
+				"stage", "ms", "%", "calls", "ns/call", "allocs");
+
+	for (i = 0; i < BENCH_NUM_STAGES; i++)
+	{
+		fprintf (stderr, "%-12s %10.1f %6.1f%% %12" G_GUINT64_FORMAT " %10.0f %12" G_GUINT64_FORMAT "\n",
+					bench_stage_name (i),
+					bench_stats[i].ns / 1e6,
+					100.0 * bench_stats[i].ns / elapsed,
+					bench_stats[i].calls,
+					bench_stats[i].calls ? (double) bench_stats[i].ns / bench_stats[i].calls : 0.0,
+					bench_stats[i].allocs);
+	}
+	fprintf (stderr, "%-12s %10.1f %6.1f%% %12s %10s %12" G_GUINT64_FORMAT "\n",
+				"other", (elapsed - staged) / 1e6, 100.0 * (elapsed - staged) / elapsed,
+				"", "", bench_other_allocs);
+
+#ifdef REPLAY_COUNT_ALLOCS
+	fprintf (stderr, "\n%" G_GUINT64_FORMAT " allocations, %.1f per line\n",
+				allocs, lines ? (double) allocs / lines : 0.0);
+#else
+	fprintf (stderr, "\nallocations are only counted with glibc\n");
+#endif
+}
+
+int
+replay_args (void)
+{
+	if (arg_generate)
+		return replay_generate (arg_generate, arg_lines);
+
+	if (!arg_replay)
+	{
+		fprintf (stderr, "Nothing to do, give --replay FILE or --generate KIND\n");
+		return 1;
+	}
+
+	/* the replay is the only server */
+	arg_dont_autoconnect = TRUE;
+	return -1;
+}
+
+void
+replay_main (void)
+{
+	GError *error = NULL;
+	GArray *lines;
+	struct replay_line *line;
+	session *sess;
+	server *serv;
+	char *data;
+	gsize size;
+	gint64 start;
+	guint i;
+	int r, peer;
+
+	if (!g_file_get_contents (arg_replay, &data, &size, &error))
+	{
+		fprintf (stderr, "%s\n", error->message);
+		g_error_free (error);
+		return;
+	}
+	lines = replay_split (data, size);
+
+	if (sess_list)
+		sess = sess_list->data;
+	else
+		sess = new_ircwindow (NULL, NULL, SESS_SERVER, 0);
+	serv = sess->server;
+
+	peer = replay_connect (serv);
+	if (peer == -1)
+	{
+		perror ("socketpair");
+		return;
+	}
+
+	if (arg_logging)
+		prefs.hex_irc_logging = 1;
+
+	/* let startup (plugins loading and so on) finish first */
+	replay_idle (peer);
+
+#ifdef REPLAY_COUNT_ALLOCS
+	main_thread = pthread_self ();
+#endif
+	bench_reset ();
+	idle_ns = 0;
+	count_allocs = TRUE;
+	bench_enabled = TRUE;
+	start = bench_now ();
+
+	for (r = 0; r < arg_repeat; r++)
+	{
+		for (i = 0; i < lines->len; i++)
+		{
+			line = &g_array_index (lines, struct replay_line, i);
+			server_inline (serv, line->text, line->len);
+
+			if ((i & 1023) == 1023)
+				replay_idle (peer);
+		}
+	}
+
+	bench_enabled = FALSE;
+	count_allocs = FALSE;
+
+	replay_report ((guint64) lines->len * arg_repeat, bench_now () - start - idle_ns);
+
+	close (peer);
+	g_array_free (lines, TRUE);
+	g_free (data);
+}